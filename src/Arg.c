@@ -16,6 +16,7 @@
  * Email: burgerk@asu.edu
  * Web:   http://kevin.floorsoup.com
  **************************************************************************************************************/
+#include <ctype.h>    // For isdigit()
 #include <stdbool.h>  // For bool, false, true
 #include <stdio.h>    // For sprintf(), NULL
 #include <string.h>   // For strchr(), strlen(), strstr()
@@ -147,11 +148,11 @@ const int cArgUnexpStr   = -7;
  *     -- should be followed by an argument.
  *     < Check: pScan->index >= pScan->argc
  *         nextState = tArgState_MissingArg; >
- *     < Check: *pScan->argv[pScan->index] == '-'
+ *     < Check: *pScan->argv[pScan->index] == '-' and the hyphen is not followed by a digit
  *         nextState = tArgState_MissingArg; >
  *     < Default:
- *         -- Following the option, there is a string that does not start with a hyphen, so we will assume that it
- *         -- is an argument. Make pScan->arg point to it.
+ *         -- Following the option, there is a string that does not start with a hyphen, or is a negative number,
+ *         -- so we will assume that it is an argument. Make pScan->arg point to it.
  *         pScan->arg = pScan->argv[pScan->index];
  *         retVal = shortOpt ? tArgState_ShortOpt : tArgState_LongOpt;
  *         nextState = tArgState_End; >
@@ -291,11 +292,11 @@ int ArgScan(tArgScan *pScan)
 				// $ binary -o -f, where -o should be followed by an argument.
 				if (pScan->index >= pScan->argc) {
 					nextState = tArgState_MissingArg;
-				} else if (*pScan->argv[pScan->index] == '-') {
+				} else if (*pScan->argv[pScan->index] == '-' && !isdigit((unsigned char)pScan->argv[pScan->index][1])) {
 					nextState = tArgState_MissingArg;
 				} else {
-					// Following the option, there is a string that does not start with a hyphen, so we will
-					// assume that it is an argument. Make pScan->arg point to it.
+					// Following the option, there is a string that does not start with a hyphen, or is a negative
+					// number, so we will assume that it is an argument. Make pScan->arg point to it.
 					pScan->arg = pScan->argv[pScan->index];
 					retVal = shortOpt ? tArgState_ShortOpt : tArgState_LongOpt;
 					nextState = tArgState_End;
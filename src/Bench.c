@@ -0,0 +1,572 @@
+/***************************************************************************************************************
+ * FILE: Bench.c
+ *
+ * DESCRIPTION
+ * bimpie-bench - Times each I/O and transform kernel of bimpie on synthetic images from 1 MP up to 256 MP.
+ * The image widths are chosen so that all four row padding cases of the BMP format are covered. Each kernel is
+ * run several times per size and reported with its mean time, best time and standard deviation, in MB/s and
+ * ns/pixel of the image, along with the buffer allocations and page faults of the timed runs. The results go to
+ * stdout as a table and, optionally, to a CSV file so that runs can be compared to catch regressions.
+ *
+ * Usage: bimpie-bench [-r runs] [-s maxMP] [-t threads] [-b bits] [-d dir] [--csv file]
+ *
+ *     -r runs      Times each kernel runs times per size (default 5).
+ *     -s maxMP     Stops after the largest size of at most maxMP megapixels (default 256).
+ *     -t threads   Runs the transforms on a pool of threads threads (default 1).
+ *     -b bits      Makes the images of bits bits per pixel: 8, 16, 24 or 32 (default 24).
+ *     -d dir       Writes the temporary BMP file in dir (default /tmp).
+ *     --csv file   Also writes the results to file as CSV.
+ *
+ * The file kernels read and write a file that was just written, so they measure bimpie's own parsing and copying
+ * with the file in the page cache, not the disk.
+ **************************************************************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "Main.h"
+#include "Bimpie.h"
+#include "Convolve.h"
+#include "Image.h"
+#include "Resize.h"
+#include "String.h"
+
+//==============================================================================================================
+// CONSTANT DEFINITIONS
+//==============================================================================================================
+
+const char *cBinary = "bimpie-bench";
+
+// The image sizes, in megapixels of 2^20 pixels.
+static const int cSizes[] = { 1, 4, 16, 64, 256 };
+
+//==============================================================================================================
+// TYPE DEFINITIONS
+//==============================================================================================================
+
+// Everything the kernels of one image size work on.
+typedef struct {
+	tImage		   *src;		// The synthetic image
+	tImage		   *dst;		// An image for the transforms to write into, big enough for any orientation
+	tImage		   *work;		// The image a kernel creates or consumes, NULL between runs
+	tBmp			bmp;		// The headers the synthetic image is written with
+	tBmp			in;			// The headers the read kernels read back
+	tBufferPool	   *buffers;
+	tThreadPool	   *pool;
+	char			path[4096];	// The temporary BMP file
+	tOrient			o;			// The orientation of the current transform kernel
+	int				bpp;		// Bits per pixel of the images
+} tCase;
+
+/* One kernel of the suite. setup() and teardown() run around every timed run() and are not timed. Kernels that
+ * are slow by design only run up to maxMP megapixels, and those that look into the pixels need minBits bits.
+ */
+typedef struct {
+	const char	   *name;
+	void		  (*setup)(tCase *);
+	void		  (*run)(tCase *);
+	void		  (*teardown)(tCase *);
+	tOrient			o;
+	int				maxMP;
+	int				minBits;
+} tKernel;
+
+//==============================================================================================================
+// FUNCTION DEFINITIONS
+//==============================================================================================================
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Now()
+ *
+ * DESCRIPTION
+ * Returns the monotonic clock in seconds.
+ *------------------------------------------------------------------------------------------------------------*/
+static double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MinorFaults()
+ *
+ * DESCRIPTION
+ * Returns the number of minor page faults the process has taken so far.
+ *------------------------------------------------------------------------------------------------------------*/
+static long MinorFaults()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_minflt;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Check()
+ *
+ * DESCRIPTION
+ * Exits with a message if pStatus is not 0, since a failed kernel leaves nothing to time.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Check(int pStatus, tCase *pCase, tBmp *pBmp)
+{
+	if (pStatus != 0) {
+		fprintf(stderr, "%s: %s: %s\n", cBinary, pCase->path, pBmp->error);
+		exit(1);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CreateImage()
+ *
+ * DESCRIPTION
+ * createImage() from the case's buffer pool, exiting if there is no memory.
+ *------------------------------------------------------------------------------------------------------------*/
+static tImage *CreateImage(tCase *pCase, int pWidth, int pHeight)
+{
+	tImage *image = createImage(pWidth, pHeight, pCase->bpp, pCase->buffers);
+	if (image == NULL) {
+		fprintf(stderr, "%s: out of memory\n", cBinary);
+		exit(1);
+	}
+	return image;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: FillImage()
+ *
+ * DESCRIPTION
+ * Fills pImage with pseudo-random pixels, a 64-bit word at a time so that 256 MP do not take minutes.
+ *------------------------------------------------------------------------------------------------------------*/
+static void FillImage(tImage *pImage)
+{
+	uint64_t x = 88172645463325252ull;
+	for (size_t i = 0; i + 8 <= pImage->stride * pImage->height; i += 8) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		memcpy(pImage->pixels + i, &x, 8);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ResizeDst()
+ *
+ * DESCRIPTION
+ * Makes the destination image of the case the right shape for the source in orientation pO.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ResizeDst(tCase *pCase, tOrient pO)
+{
+	tImage *dst = pCase->dst;
+	dst->width = pO.transpose ? pCase->src->height : pCase->src->width;
+	dst->height = pO.transpose ? pCase->src->width : pCase->src->height;
+	dst->stride = ((size_t)dst->width * (pCase->bpp / 8) + cImageAlign - 1) / cImageAlign * cImageAlign;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * The kernels. Each one times a single function of Bmp.c, Image.c or Resize.c, except for the naive rotation, which
+ * is the original column-writing quarter turn kept as a reference, and memcpy(), which is the bound for a pass over
+ * the image.
+ *------------------------------------------------------------------------------------------------------------*/
+static void CopyWork(tCase *pCase)
+{
+	pCase->work = CreateImage(pCase, pCase->src->width, pCase->src->height);
+	for (int r = 0; r < pCase->src->height; r++) {
+		memcpy(imageRow(pCase->work, r), imageRow(pCase->src, r), (size_t)pCase->src->width * (pCase->bpp / 8));
+	}
+}
+
+static void SquareWork(tCase *pCase)
+{
+	int side = (int)sqrt((double)pCase->src->width * pCase->src->height);
+	pCase->work = CreateImage(pCase, side, side);
+	FillImage(pCase->work);
+}
+
+static void FreeWork(tCase *pCase)
+{
+	freeImage(pCase->work);
+	pCase->work = NULL;
+}
+
+static void ReadHeaders(tCase *pCase)
+{
+	Check(readBmpHeaders(&pCase->in, pCase->path), pCase, &pCase->in);
+}
+
+static void CloseHeaders(tCase *pCase)
+{
+	freeBmp(&pCase->in);
+}
+
+static void ReadPixels(tCase *pCase)
+{
+	Check(readBmpPixels(&pCase->in, &pCase->work), pCase, &pCase->in);
+}
+
+static void FreeRead(tCase *pCase)
+{
+	FreeWork(pCase);
+	CloseHeaders(pCase);
+}
+
+static void WritePixels(tCase *pCase)
+{
+	Check(writeBmp(&pCase->bmp, pCase->path, pCase->work), pCase, &pCase->bmp);
+}
+
+static void Memcpy(tCase *pCase)
+{
+	memcpy(pCase->dst->pixels, pCase->src->pixels, pCase->src->stride * pCase->src->height);
+}
+
+static void TransformInto(tCase *pCase)
+{
+	ResizeDst(pCase, pCase->o);
+	transformBmpInto(pCase->src, pCase->dst, pCase->o, NULL, pCase->pool);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BenchColor()
+ *
+ * DESCRIPTION
+ * Returns the colors of the color kernels: grayscale, a mix, and then invert, a table, so that both kinds of
+ * stage are timed.
+ *------------------------------------------------------------------------------------------------------------*/
+static const tColor *BenchColor()
+{
+	static tColor color;
+	static bool built = false;
+	if (!built) {
+		const double gray[3][3] = { { 0.114, 0.587, 0.299 }, { 0.114, 0.587, 0.299 }, { 0.114, 0.587, 0.299 } };
+		byte invert[3][256];
+		for (int v = 0; v < 256; v++) invert[0][v] = invert[1][v] = invert[2][v] = (byte)(255 - v);
+		colorIdentity(&color);
+		colorAddMatrix(&color, gray);
+		colorAddTables(&color, invert);
+		built = true;
+	}
+	return &color;
+}
+
+static void TransformIntoColor(tCase *pCase)
+{
+	ResizeDst(pCase, pCase->o);
+	transformBmpInto(pCase->src, pCase->dst, pCase->o, BenchColor(), pCase->pool);
+}
+
+static void NaiveRotate(tCase *pCase)
+{
+	const tImage *src = pCase->src;
+	tImage *dst = pCase->dst;
+	int M = src->height;
+	int N = src->width;
+
+	int size = pCase->bpp / 8;
+
+	ResizeDst(pCase, pCase->o);
+	for (int r = 0; r < M; r++) {
+		const byte *from = (const byte *)imageRow(src, r);
+		for (int c = 0; c < N; c++) {
+			if (size == sizeof(tPixel)) {
+				imageRow(dst, c)[r] = ((const tPixel *)from)[N-1-c];
+			} else {
+				memcpy((byte *)imageRow(dst, c) + (size_t)r * size, from + (size_t)(N-1-c) * size, size);
+			}
+		}
+	}
+}
+
+static void Rotate180(tCase *pCase)
+{
+	rotateBmp180(pCase->src, NULL, pCase->pool);
+}
+
+static void FlipHoriz(tCase *pCase)
+{
+	flipBmpHoriz(pCase->src, NULL, pCase->pool);
+}
+
+static void FlipVer(tCase *pCase)
+{
+	flipBmpVer(pCase->src, pCase->pool);
+}
+
+static void Transform(tCase *pCase)
+{
+	pCase->work = transformBmp(pCase->work, pCase->o, NULL, false, pCase->pool);
+}
+
+static void TransformLowMemory(tCase *pCase)
+{
+	pCase->work = transformBmp(pCase->work, pCase->o, NULL, true, pCase->pool);
+}
+
+static void ResizeBilinear(tCase *pCase)
+{
+	freeImage(resizeImage(pCase->src, pCase->src->width / 2, pCase->src->height / 2, cBimpieFilterBilinear, pCase->o,
+		NULL, pCase->pool));
+}
+
+static void ResizeLanczos(tCase *pCase)
+{
+	freeImage(resizeImage(pCase->src, pCase->src->width / 2, pCase->src->height / 2, cBimpieFilterLanczos, pCase->o,
+		NULL, pCase->pool));
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: BenchConvolveKernel()
+ *
+ * DESCRIPTION
+ * Returns the convolution kernels: a Gaussian blur of sigma 2, separable and 13 taps each way, or a 3x3 unsharp
+ * mask, summed in one 2D pass.
+ *------------------------------------------------------------------------------------------------------------*/
+static const tConvolveKernel *BenchConvolveKernel(bool pSeparable)
+{
+	static tConvolveKernel *blur, *sharpen;
+	if (blur == NULL) {
+		double weights[13], values[13 * 13], sum = 0;
+		for (int i = 0; i < 13; i++) sum += weights[i] = exp(-(i - 6) * (i - 6) / 8.0);
+		for (int i = 0; i < 13 * 13; i++) values[i] = weights[i / 13] / sum * weights[i % 13] / sum;
+		blur = createKernel(13, 13, values);
+		const double mask[9] = { -1 / 16.0, -2 / 16.0, -1 / 16.0, -2 / 16.0, 1.75, -2 / 16.0, -1 / 16.0, -2 / 16.0,
+			-1 / 16.0 };
+		sharpen = createKernel(3, 3, mask);
+	}
+	return pSeparable ? blur : sharpen;
+}
+
+static void ConvolveBlur(tCase *pCase)
+{
+	freeImage(convolveImage(pCase->src, BenchConvolveKernel(true), pCase->pool));
+}
+
+static void ConvolveSharpen(tCase *pCase)
+{
+	freeImage(convolveImage(pCase->src, BenchConvolveKernel(false), pCase->pool));
+}
+
+// The orientations of the transform kernels, as { transpose, flipX, flipY }.
+#define cIdentity	{ false, false, false }
+#define cFlipX		{ false, true,  false }
+#define cFlipY		{ false, false, true  }
+#define cRotate180	{ false, true,  true  }
+#define cTranspose	{ true,  false, false }
+#define cRotate90	{ true,  false, true  }
+#define cRotate270	{ true,  true,  false }
+#define cTransverse	{ true,  true,  true  }
+
+static const tKernel cKernels[] = {
+	{ "readBmpHeaders",              NULL,       ReadHeaders,        CloseHeaders, cIdentity,   256,  8 },
+	{ "readBmpPixels",               ReadHeaders, ReadPixels,        FreeRead,     cIdentity,   256,  8 },
+	{ "writeBmp",                    CopyWork,   WritePixels,        FreeWork,     cIdentity,   256,  8 },
+	{ "memcpy",                      NULL,       Memcpy,             NULL,         cIdentity,   256,  8 },
+	{ "transformBmpInto copy",       NULL,       TransformInto,      NULL,         cIdentity,   256,  8 },
+	{ "transformBmpInto fliph",      NULL,       TransformInto,      NULL,         cFlipX,      256,  8 },
+	{ "transformBmpInto flipv",      NULL,       TransformInto,      NULL,         cFlipY,      256,  8 },
+	{ "transformBmpInto rotr 2",     NULL,       TransformInto,      NULL,         cRotate180,  256,  8 },
+	{ "transformBmpInto transpose",  NULL,       TransformInto,      NULL,         cTranspose,  256,  8 },
+	{ "transformBmpInto rotr 1",     NULL,       TransformInto,      NULL,         cRotate90,   256,  8 },
+	{ "transformBmpInto rotr 3",     NULL,       TransformInto,      NULL,         cRotate270,  256,  8 },
+	{ "transformBmpInto transverse", NULL,       TransformInto,      NULL,         cTransverse, 256,  8 },
+	{ "transformBmpInto copy color", NULL,       TransformIntoColor, NULL,         cIdentity,   256, 24 },
+	{ "transformBmpInto rotr1 color",NULL,       TransformIntoColor, NULL,         cRotate90,   256, 24 },
+	{ "naive rotr 1",                NULL,       NaiveRotate,        NULL,         cRotate90,   16,   8 },
+	{ "rotateBmp180",                NULL,       Rotate180,          NULL,         cIdentity,   256,  8 },
+	{ "flipBmpHoriz",                NULL,       FlipHoriz,          NULL,         cIdentity,   256,  8 },
+	{ "flipBmpVer",                  NULL,       FlipVer,            NULL,         cIdentity,   256,  8 },
+	{ "transformBmp rotr 1",         CopyWork,   Transform,          FreeWork,     cRotate90,   256,  8 },
+	{ "transformBmp rotr 1 square",  SquareWork, Transform,          FreeWork,     cRotate90,   256,  8 },
+	{ "transformBmp rotr 1 low-mem", CopyWork,   TransformLowMemory, FreeWork,     cRotate90,   16,   8 },
+	{ "transformBmp flipv",          CopyWork,   Transform,          FreeWork,     cFlipY,      256,  8 },
+	{ "resizeImage half bilinear",   NULL,       ResizeBilinear,     NULL,         cIdentity,   256, 24 },
+	{ "resizeImage half bilin rotr1",NULL,       ResizeBilinear,     NULL,         cRotate90,   256, 24 },
+	{ "resizeImage half lanczos",    NULL,       ResizeLanczos,      NULL,         cIdentity,   64,  24 },
+	{ "convolveImage blur 2",        NULL,       ConvolveBlur,       NULL,         cIdentity,   64,  24 },
+	{ "convolveImage sharpen",       NULL,       ConvolveSharpen,    NULL,         cIdentity,   64,  24 },
+};
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MakeCase()
+ *
+ * DESCRIPTION
+ * Creates a synthetic image of about pMP megapixels and 4:3 in a fresh buffer pool, and writes it to the temporary
+ * file. The width is pPadCase more than a multiple of 4, so 8 and 24-bit file rows end in each of the 4 possible
+ * amounts of padding in turn. An 8-bit file gets a gray palette.
+ *------------------------------------------------------------------------------------------------------------*/
+static void MakeCase(tCase *pCase, int pMP, int pPadCase)
+{
+	long pixels = (long)pMP << 20;
+	int width = (int)sqrt(pixels * 4.0 / 3.0);
+	width = width - width % 4 + pPadCase;
+	int height = (int)(pixels / width);
+	int side = width > height ? width : height;
+
+	pCase->buffers = createBufferPool();
+	pCase->src = CreateImage(pCase, width, height);
+	pCase->dst = CreateImage(pCase, side, side);
+	FillImage(pCase->src);
+	// Touch every destination page once so no kernel pays for the first faults.
+	memset(pCase->dst->pixels, 0, pCase->dst->stride * pCase->dst->height);
+
+	memset(&pCase->bmp, 0, sizeof(tBmp));
+	memset(&pCase->in, 0, sizeof(tBmp));
+	pCase->in.buffers = pCase->buffers;
+	pCase->bmp.header.signature_B = 'B';
+	pCase->bmp.header.signature_M = 'M';
+	pCase->bmp.info.sizeBmpInfoHeader = 40;
+	pCase->bmp.info.bitPlanes = 1;
+	pCase->bmp.info.bitsPerPixel = pCase->bpp;
+	pCase->bmp.buffers = pCase->buffers;
+	if (pCase->bpp == 8) {
+		pCase->bmp.extraHeaderSize = 4 * 256;
+		if ((pCase->bmp.extraHeader = takeBuffer(pCase->buffers, pCase->bmp.extraHeaderSize)) == NULL) {
+			fprintf(stderr, "%s: out of memory\n", cBinary);
+			exit(1);
+		}
+		for (int i = 0; i < 256; i++) {
+			byte entry[4] = { i, i, i, 0 };
+			memcpy(&pCase->bmp.extraHeader[4 * i], entry, 4);
+		}
+	}
+	CopyWork(pCase);
+	WritePixels(pCase);
+	FreeWork(pCase);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: FreeCase()
+ *------------------------------------------------------------------------------------------------------------*/
+static void FreeCase(tCase *pCase)
+{
+	freeImage(pCase->src);
+	freeImage(pCase->dst);
+	freeBmp(&pCase->bmp);
+	freeBufferPool(pCase->buffers);
+	unlink(pCase->path);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: TimeKernel()
+ *
+ * DESCRIPTION
+ * Runs pKernel pRuns times on pCase after one untimed warm-up run, and prints its mean time, best time, standard
+ * deviation, and the buffer allocations and page faults of the timed runs to stdout and, if pCsv is not NULL, to
+ * pCsv.
+ *------------------------------------------------------------------------------------------------------------*/
+static void TimeKernel(const tKernel *pKernel, tCase *pCase, int pRuns, int pMP, FILE *pCsv)
+{
+	double sum = 0, sumSq = 0, best = 0;
+	long allocs = 0, faults = 0;
+	pCase->o = pKernel->o;
+
+	for (int run = -1; run < pRuns; run++) {
+		if (pKernel->setup) pKernel->setup(pCase);
+		long allocs0 = bufferPoolStats(pCase->buffers).allocs;
+		long faults0 = MinorFaults();
+		double start = Now();
+		pKernel->run(pCase);
+		double secs = Now() - start;
+		if (run >= 0) {
+			faults += MinorFaults() - faults0;
+			allocs += bufferPoolStats(pCase->buffers).allocs - allocs0;
+			sum += secs;
+			sumSq += secs * secs;
+			if (run == 0 || secs < best) best = secs;
+		}
+		if (pKernel->teardown) pKernel->teardown(pCase);
+	}
+
+	double pixels = (double)pCase->src->width * pCase->src->height;
+	double mean = sum / pRuns;
+	double variance = sumSq / pRuns - mean * mean;
+	double stddev = variance > 0 ? sqrt(variance) : 0;
+	double mbps = pixels * (pCase->bpp / 8) / mean / 1e6;
+	double nsPerPixel = mean * 1e9 / pixels;
+
+	printf("%-28s %4d MP %9.4f s %9.4f s %6.1f%% %9.1f MB/s %7.3f ns %6ld %8ld\n", pKernel->name, pMP, mean,
+		best, mean > 0 ? 100 * stddev / mean : 0, mbps, nsPerPixel, allocs, faults);
+	if (pCsv) {
+		fprintf(pCsv, "%s,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.1f,%.4f,%ld,%ld\n", pKernel->name, pCase->src->width,
+			pCase->src->height, pCase->bpp, pMP, pRuns, mean, best, stddev, mbps, nsPerPixel, allocs, faults);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Usage()
+ *------------------------------------------------------------------------------------------------------------*/
+static void Usage()
+{
+	fprintf(stderr, "usage: %s [-r runs] [-s maxMP] [-t threads] [-b bits] [-d dir] [--csv file]\n", cBinary);
+	exit(1);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: main()
+ *------------------------------------------------------------------------------------------------------------*/
+int main(int pArgc, char *pArgv[])
+{
+	int runs = 5;
+	int maxMP = 256;
+	int threads = 1;
+	int bits = 24;
+	char *dir = "/tmp";
+	char *csvFile = NULL;
+
+	for (int i = 1; i < pArgc; i++) {
+		if (i + 1 >= pArgc) Usage();
+		if (streq(pArgv[i], "-r")) {
+			runs = atoi(pArgv[++i]);
+		} else if (streq(pArgv[i], "-s")) {
+			maxMP = atoi(pArgv[++i]);
+		} else if (streq(pArgv[i], "-t")) {
+			threads = atoi(pArgv[++i]);
+		} else if (streq(pArgv[i], "-b")) {
+			bits = atoi(pArgv[++i]);
+		} else if (streq(pArgv[i], "-d")) {
+			dir = pArgv[++i];
+		} else if (streq(pArgv[i], "--csv")) {
+			csvFile = pArgv[++i];
+		} else {
+			Usage();
+		}
+	}
+	if (runs < 1 || maxMP < 1 || threads < 1 || (bits != 8 && bits != 16 && bits != 24 && bits != 32)) Usage();
+
+	FILE *csv = NULL;
+	if (csvFile) {
+		if ((csv = fopen(csvFile, "w")) == NULL) {
+			fprintf(stderr, "%s: cannot open %s\n", cBinary, csvFile);
+			return 1;
+		}
+		fprintf(csv, "kernel,width,height,bits,mpixels,runs,mean_s,best_s,stddev_s,mb_per_s,ns_per_pixel,allocs,faults\n");
+	}
+
+	tCase benchCase;
+	memset(&benchCase, 0, sizeof(tCase));
+	benchCase.pool = threads > 1 ? createThreadPool(threads) : NULL;
+	benchCase.bpp = bits;
+	snprintf(benchCase.path, sizeof(benchCase.path), "%s/%s-%d.bmp", dir, cBinary, (int)getpid());
+
+	printf("%d runs per kernel, %d thread%s, %d-bit pixels\n", runs, threads, threads == 1 ? "" : "s", bits);
+	printf("%-28s %7s %11s %11s %7s %14s %10s %6s %8s\n", "kernel", "size", "mean", "best", "stddev",
+		"throughput", "per pixel", "allocs", "faults");
+
+	for (int s = 0; s < (int)(sizeof(cSizes) / sizeof(cSizes[0])) && cSizes[s] <= maxMP; s++) {
+		MakeCase(&benchCase, cSizes[s], s % 4);
+		printf("-- %d x %d, %d padding bytes per row\n", benchCase.src->width, benchCase.src->height,
+			(4 - bits / 8 * benchCase.src->width % 4) % 4);
+		for (int k = 0; k < (int)(sizeof(cKernels) / sizeof(cKernels[0])); k++) {
+			if (cSizes[s] <= cKernels[k].maxMP && bits >= cKernels[k].minBits) {
+				TimeKernel(&cKernels[k], &benchCase, runs, cSizes[s], csv);
+			}
+		}
+		FreeCase(&benchCase);
+	}
+
+	if (csv) fclose(csv);
+	if (benchCase.pool) freeThreadPool(benchCase.pool);
+	return 0;
+}
@@ -0,0 +1,833 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "Bimpie.h"
+#include "Convolve.h"
+#include "Edit.h"
+#include "Image.h"
+#include "Resize.h"
+#include "Tile.h"
+
+// What bimpieTransformToFile() may hold of an image it streams, unless bimpieSetMaxMemory() says otherwise.
+#define cDefaultMaxMemory ((size_t)256 << 20)
+
+struct tBimpie {
+	tThreadPool	   *pool;		// NULL when there is only the calling thread
+	tBufferPool	   *buffers;
+	size_t			maxMemory;	// Bytes of pixels a streamed image may hold at once
+};
+
+struct tBimpieImage {
+	tBmp			bmp;
+	tImage		   *image;		// The pixels once decoded or mapped, else NULL
+	tColor			color;		// The colors set for the pixels and not yet given to image
+	bool			recolored;	// bimpieSetColor() changed the colors
+};
+
+struct tBimpieColor {
+	tColor			color;
+};
+
+struct tBimpieKernel {
+	tConvolveKernel	   *kernel;
+};
+
+// The message for the calling thread's last failed call.
+static __thread char lastError[1024];
+
+/* records message as the calling thread's last error
+ * Returns: code
+ */
+
+static int bimpieError(int code, const char *message) {
+	snprintf(lastError, sizeof(lastError), "%s", message);
+	return code;
+}
+
+/* Returns: the colors set for image that its pixels do not have yet, or
+ * NULL if there are none
+ */
+
+static const tColor *pendingColor(const tBimpieImage *image) {
+	return image->color.stageCount > 0 ? &image->color : NULL;
+}
+
+/* converts between the public orientation and the one of Image.h
+ */
+
+static tOrient toOrient(tBimpieOrient o) {
+	tOrient orient = { o.transpose, o.flipX, o.flipY };
+	return orient;
+}
+
+static tBimpieOrient fromOrient(tOrient o) {
+	tBimpieOrient orient = { o.transpose, o.flipX, o.flipY };
+	return orient;
+}
+
+/* creates a context whose calls share threads threads, counting the
+ * calling thread, and one buffer pool
+ * @params: threads - number of threads, or 0 for one per online CPU
+ * Returns: the context, or NULL if out of memory or the threads cannot start
+ */
+
+tBimpie *bimpieCreate(int threads) {
+	tBimpie *bimpie = (tBimpie *)calloc(1, sizeof(tBimpie));
+	if (bimpie == NULL) {
+		return NULL;
+	}
+
+	bimpie->maxMemory = cDefaultMaxMemory;
+	if (threads == 0) threads = onlineCpuCount();
+	bimpie->buffers = createBufferPool();
+	if (threads > 1) bimpie->pool = createThreadPool(threads);
+	if (bimpie->buffers == NULL || (threads > 1 && bimpie->pool == NULL)) {
+		bimpieFree(bimpie);
+		return NULL;
+	}
+	return bimpie;
+}
+
+/* stops the threads of bimpie and frees it. Every image must have been
+ * closed.
+ */
+
+void bimpieFree(tBimpie *bimpie) {
+	if (bimpie->pool) freeThreadPool(bimpie->pool);
+	if (bimpie->buffers) freeBufferPool(bimpie->buffers);
+	free(bimpie);
+}
+
+/* runs task(arg, n) for n = 0..taskCount-1 on the threads of bimpie,
+ * returning when all of them are done. Calls made from inside the tasks
+ * run their own work on the task's thread.
+ */
+
+void bimpieRun(tBimpie *bimpie, int taskCount, tBimpieTask task, void *arg) {
+	threadPoolRun(bimpie->pool, taskCount, task, arg);
+}
+
+/* Returns: how many threads bimpieRun() runs tasks on
+ */
+
+int bimpieThreads(const tBimpie *bimpie) {
+	return threadPoolSize(bimpie->pool);
+}
+
+/* allocates count buffers of bytes each and touches every page of them,
+ * then leaves them free in bimpie's buffer pool. Images of about that size
+ * then decode into memory that is already mapped, from the first one on.
+ * Returns: 0 or cBimpieErrorMemory
+ */
+
+int bimpieReserveBuffers(tBimpie *bimpie, size_t bytes, int count) {
+	void **buffers = (void **)calloc(count, sizeof(void *));
+	int status = buffers ? 0 : bimpieError(cBimpieErrorMemory, "Out of memory.");
+	for (int i = 0; i < count && status == 0; i++) {
+		buffers[i] = takeBuffer(bimpie->buffers, bytes);
+		if (buffers[i] == NULL) {
+			status = bimpieError(cBimpieErrorMemory, "Out of memory.");
+		} else {
+			memset(buffers[i], 0, bytes);
+		}
+	}
+	for (int i = 0; buffers && i < count; i++) {
+		giveBuffer(bimpie->buffers, buffers[i]);
+	}
+	free(buffers);
+	return status;
+}
+
+/* gives the free buffers of bimpie back to the system, the largest first,
+ * until no more than bytes of them are left for the images to come
+ */
+
+void bimpieTrimBuffers(tBimpie *bimpie, size_t bytes) {
+	trimBufferPool(bimpie->buffers, bytes);
+}
+
+/* gets the most bytes of image and I/O buffers bimpie has had in use at
+ * once, and how many buffers it has allocated in all
+ */
+
+void bimpieBufferStats(tBimpie *bimpie, size_t *highWater, long *allocs) {
+	tBufferPoolStats stats = bufferPoolStats(bimpie->buffers);
+	*highWater = stats.highWater;
+	*allocs = stats.allocs;
+}
+
+/* sets how many bytes of pixels bimpieTransformToFile() may hold at once
+ * for each image it streams from file to file
+ */
+
+void bimpieSetMaxMemory(tBimpie *bimpie, size_t bytes) {
+	bimpie->maxMemory = bytes;
+}
+
+/* opens fileName and reads and checks its headers; the pixels are read
+ * later by bimpieDecode() or bimpieMap(). An in-place edit of the file
+ * that was cut short is undone first; while one is still running, the
+ * file cannot be opened.
+ * Returns: 0 or a cBimpieError code, with *image set only on success
+ */
+
+int bimpieOpen(tBimpie *bimpie, const char *fileName, tBimpieImage **image) {
+	tBimpieImage *opened = (tBimpieImage *)calloc(1, sizeof(tBimpieImage));
+	if (opened == NULL) {
+		return bimpieError(cBimpieErrorMemory, "Out of memory.");
+	}
+	opened->bmp.buffers = bimpie->buffers;
+
+	int status = readBmpHeaders(&opened->bmp, (char *)fileName);
+	bool recovered = false;
+	if (status == 0) status = recoverBmpEdit(&opened->bmp, (char *)fileName, &recovered);
+	if (status == 0 && recovered) {
+		// The headers may have changed under the ones read.
+		freeBmp(&opened->bmp);
+		memset(&opened->bmp, 0, sizeof(opened->bmp));
+		opened->bmp.buffers = bimpie->buffers;
+		status = readBmpHeaders(&opened->bmp, (char *)fileName);
+	}
+	if (status != 0) {
+		bimpieError(status, opened->bmp.error);
+		bimpieClose(bimpie, opened);
+		return status;
+	}
+	*image = opened;
+	return 0;
+}
+
+/* reads the pixels of an image opened by bimpieOpen() into memory
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieDecode(tBimpie *bimpie, tBimpieImage *image) {
+	if (image->image || image->bmp.file == NULL) {
+		return bimpieError(cBimpieErrorState, "The pixels have already been read.");
+	}
+	int status = readBmpPixels(&image->bmp, &image->image);
+	return status == 0 ? 0 : bimpieError(status, image->bmp.error);
+}
+
+/* reads only the pixels of rect of an image opened by bimpieOpen() into
+ * memory; the image becomes that part of itself
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieDecodeRect(tBimpie *bimpie, tBimpieImage *image, tBimpieRect rect) {
+	if (image->image || image->bmp.file == NULL) {
+		return bimpieError(cBimpieErrorState, "The pixels have already been read.");
+	}
+	int width = image->bmp.info.width;
+	int height = image->bmp.info.height;
+	if (rect.width <= 0 || rect.height <= 0 || rect.x < 0 || rect.y < 0 ||
+			rect.width > width - rect.x || rect.height > height - rect.y) {
+		return bimpieError(cBimpieErrorArg, "The crop region is outside the image.");
+	}
+	tRegion region = { rect.x, height - rect.y - rect.height, rect.width, rect.height };
+	int status = readBmpRegion(&image->bmp, region, &image->image);
+	return status == 0 ? 0 : bimpieError(status, image->bmp.error);
+}
+
+/* reads the pixels of an image opened by bimpieOpen() shrunk by the
+ * smallest whole factor that makes both sides at most maxSize pixels, see
+ * readBmpThumbnail(); an image that fits already is read as it is
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieDecodeThumbnail(tBimpie *bimpie, tBimpieImage *image, int maxSize) {
+	if (image->image || image->bmp.file == NULL) {
+		return bimpieError(cBimpieErrorState, "The pixels have already been read.");
+	}
+	if (maxSize <= 0) {
+		return bimpieError(cBimpieErrorArg, "The size of the thumbnail is not valid.");
+	}
+	int side = image->bmp.info.width > image->bmp.info.height ? image->bmp.info.width : image->bmp.info.height;
+	int factor = (side + maxSize - 1) / maxSize;
+	int status = factor > 1 ? readBmpThumbnail(&image->bmp, factor, &image->image) :
+		readBmpPixels(&image->bmp, &image->image);
+	return status == 0 ? 0 : bimpieError(status, image->bmp.error);
+}
+
+/* maps the pixels of an image opened by bimpieOpen() read-only instead of
+ * reading them; they are paged in as they are used
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieMap(tBimpie *bimpie, tBimpieImage *image) {
+	if (image->image || image->bmp.file == NULL) {
+		return bimpieError(cBimpieErrorState, "The pixels have already been read.");
+	}
+	int status = mapBmpPixels(&image->bmp, &image->image);
+	return status == 0 ? 0 : bimpieError(status, image->bmp.error);
+}
+
+/* Returns: true if o is a vertical flip and nothing else. BMP rows can be
+ * stored either way up, so such a flip is encoded by turning the file
+ * over instead: its rows are written in the order they already lie in.
+ */
+
+static bool isFlipV(tBimpieOrient o) {
+	return !o.transpose && !o.flipX && o.flipY;
+}
+
+/* applies orientation o to the pixels of image, and gives them the colors
+ * set for them in the same pass. A decoded image is transformed in place
+ * where it can be, and entirely in place if lowMemory is set; a mapped
+ * image is copied into memory on the way. A vertical flip on its own moves
+ * no pixels at all, unless the colors of a mapped image change.
+ * Returns: 0 or a cBimpieError code; the image is unchanged on failure
+ */
+
+int bimpieTransform(tBimpie *bimpie, tBimpieImage *image, tBimpieOrient o, bool lowMemory) {
+	tImage *src = image->image;
+	if (src == NULL) {
+		return bimpieError(cBimpieErrorState, "The pixels have not been read.");
+	}
+
+	tImage *transformed;
+	const tColor *color = pendingColor(image);
+	bool copy = src->mapping && (!isFlipV(o) || color);
+	if (copy) {
+		transformed = o.transpose ? createImage(src->height, src->width, src->bpp, bimpie->buffers) :
+			createImage(src->width, src->height, src->bpp, bimpie->buffers);
+		if (transformed) {
+			transformBmpInto(src, transformed, toOrient(o), color, bimpie->pool);
+			freeImage(src);
+		}
+	} else {
+		transformed = transformBmp(src, toOrient(o), color, lowMemory, bimpie->pool);
+	}
+
+	if (transformed == NULL) {
+		return bimpieError(cBimpieErrorMemory, "Out of memory.");
+	}
+	image->image = transformed;
+	colorIdentity(&image->color);
+	if (isFlipV(o) && !copy) image->bmp.topDown = !image->bmp.topDown;
+	return 0;
+}
+
+/* resizes the decoded or mapped pixels of image to width x height after
+ * turning them to orientation o, with filter, one of the cBimpieFilter
+ * codes, and gives the resized pixels the colors set for them, all in one
+ * pass over the pixels
+ * Returns: 0 or a cBimpieError code; the image is unchanged on failure
+ */
+
+int bimpieResize(tBimpie *bimpie, tBimpieImage *image, tBimpieOrient o, int width, int height, int filter) {
+	tImage *src = image->image;
+	if (src == NULL) {
+		return bimpieError(cBimpieErrorState, "The pixels have not been read.");
+	}
+	if (width <= 0 || height <= 0 || filter < cBimpieFilterBox || filter > cBimpieFilterLanczos) {
+		return bimpieError(cBimpieErrorArg, "The size or filter of the resize is not valid.");
+	}
+	if (src->bpp < 24) {
+		return bimpieError(cBimpieErrorFileFormat, "Only 24 and 32-bit images can be resized.");
+	}
+
+	tImage *resized = resizeImage(src, width, height, filter, toOrient(o), pendingColor(image), bimpie->pool);
+	if (resized == NULL) {
+		return bimpieError(cBimpieErrorMemory, "Out of memory.");
+	}
+	freeImage(src);
+	image->image = resized;
+	colorIdentity(&image->color);
+	return 0;
+}
+
+/* convolves the decoded or mapped pixels of image with kernel, turned so
+ * that turning the result to orientation o is the same as convolving the
+ * image turned to o. That lets the convolution go before the transform to
+ * o, and a kernel be given as it is to look in the output. Colors set for
+ * the pixels are still given them afterwards.
+ * Returns: 0 or a cBimpieError code; the image is unchanged on failure
+ */
+
+int bimpieConvolve(tBimpie *bimpie, tBimpieImage *image, const tBimpieKernel *kernel, tBimpieOrient o) {
+	tImage *src = image->image;
+	if (src == NULL) {
+		return bimpieError(cBimpieErrorState, "The pixels have not been read.");
+	}
+	if (src->bpp < 24) {
+		return bimpieError(cBimpieErrorFileFormat, "Only 24 and 32-bit images can be convolved.");
+	}
+
+	tConvolveKernel *oriented = orientKernel(kernel->kernel, toOrient(o));
+	tImage *convolved = oriented ? convolveImage(src, oriented, bimpie->pool) : NULL;
+	freeKernel(oriented);
+	if (convolved == NULL) {
+		return bimpieError(cBimpieErrorMemory, "Out of memory.");
+	}
+	freeImage(src);
+	image->image = convolved;
+	return 0;
+}
+
+/* writes the pixels of image to fileName as a BMP file. The image stays
+ * open and may be transformed and encoded again. Colors set for the
+ * pixels that no transform has given them yet are given them first.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieEncode(tBimpie *bimpie, tBimpieImage *image, const char *fileName) {
+	if (image->image == NULL) {
+		return bimpieError(cBimpieErrorState, "The pixels have not been read.");
+	}
+	if (pendingColor(image)) {
+		int status = bimpieTransform(bimpie, image, bimpieIdentity(), false);
+		if (status != 0) return status;
+	}
+	int status = writeBmp(&image->bmp, (char *)fileName, image->image);
+	return status == 0 ? 0 : bimpieError(status, image->bmp.error);
+}
+
+/* writes the pixels of image in orientation o to a new fileName, which
+ * replaces any old file only once it is complete, so fileName may be the
+ * file the image came from. Decoded or mapped pixels are written straight
+ * into a mapping of the new file; with bimpieMap() they are never all in
+ * memory. Pixels not read at all are streamed from file to file in strips
+ * and tiles, holding no more than bimpieSetMaxMemory() allows however big
+ * the image is. The pixels written have the colors set for them; the image
+ * itself is unchanged, colors included.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieTransformToFile(tBimpie *bimpie, tBimpieImage *image, tBimpieOrient o, const char *fileName) {
+	tImage *src = image->image;
+	if (src == NULL && image->bmp.file) {
+		int status = transformBmpFile(&image->bmp, (char *)fileName, toOrient(o), pendingColor(image),
+			bimpie->maxMemory, bimpie->pool);
+		return status == 0 ? 0 : bimpieError(status, image->bmp.error);
+	}
+	if (src == NULL) {
+		return bimpieError(cBimpieErrorState, "The pixels have not been read.");
+	}
+
+	tImage *output;
+	bool topDown = image->bmp.topDown;
+	if (isFlipV(o)) image->bmp.topDown = !topDown;
+	int status = mapBmpOutput(&image->bmp, (char *)fileName, o.transpose ? src->height : src->width,
+		o.transpose ? src->width : src->height, &output);
+	if (status == 0) {
+		transformBmpInto(src, output, toOrient(o), pendingColor(image), bimpie->pool);
+		status = closeBmpOutput(&image->bmp, output);
+	}
+	image->bmp.topDown = topDown;
+	return status == 0 ? 0 : bimpieError(status, image->bmp.error);
+}
+
+/* flips or half turns image, opened by bimpieOpen() from fileName and not
+ * yet read, where it lies in the file, without reading it into memory. The
+ * file is changed as it goes; with journal set, a crash part way leaves a
+ * journal that the next bimpieOpen() undoes the edit with.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieEditInPlace(tBimpie *bimpie, tBimpieImage *image, tBimpieOrient o, const char *fileName, bool journal) {
+	if (image->image != NULL || o.transpose || image->recolored) {
+		return bimpieError(cBimpieErrorState, "Only flips and half turns of unread images can be done in place.");
+	}
+	int status = editBmpInPlace(&image->bmp, (char *)fileName, toOrient(o), journal);
+	return status == 0 ? 0 : bimpieError(status, image->bmp.error);
+}
+
+/* adds the stages of from after those of to
+ * Returns: false, with to unchanged, if they come to more than
+ * cColorStages
+ */
+
+static bool addColor(tColor *to, const tColor *from) {
+	tColor sum = *to;
+	for (int s = 0; s < from->stageCount; s++) {
+		const tColorStage *stage = &from->stages[s];
+		if (stage->mix ? !colorAddMatrix(&sum, stage->matrix) : !colorAddTables(&sum, stage->tables)) {
+			return false;
+		}
+	}
+	*to = sum;
+	return true;
+}
+
+/* sets the color operations of color for the pixels of image, after any
+ * set before. They are applied by the next call that moves the pixels:
+ * bimpieTransform(), bimpieResize(), bimpieTransformToFile(), or else
+ * bimpieEncode(). An 8-bit image has its palette changed at once instead.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieSetColor(tBimpie *bimpie, tBimpieImage *image, const tBimpieColor *color) {
+	tBmp *bmp = &image->bmp;
+	if (color->color.stageCount == 0) {
+		return 0;
+	}
+	if (bmp->info.bitsPerPixel == 16) {
+		return bimpieError(cBimpieErrorFileFormat, "The colors of 16-bit images cannot be changed.");
+	}
+
+	if (bmp->info.bitsPerPixel == 8) {
+		// The palette follows the info header; its entries are 4 bytes, blue, green, red and 0.
+		byte *palette = bmp->extraHeader + (bmp->info.sizeBmpInfoHeader - cBmpInfoHeaderV1);
+		colorRow(&color->color, palette, bmp->info.colorsUsed ? bmp->info.colorsUsed : 256, 4);
+	} else if (!addColor(&image->color, &color->color)) {
+		return bimpieError(cBimpieErrorArg, "There are too many color operations.");
+	}
+	image->recolored = true;
+	return 0;
+}
+
+/* closes image and frees its pixels; image may be NULL
+ */
+
+void bimpieClose(tBimpie *bimpie, tBimpieImage *image) {
+	if (image == NULL) return;
+	freeBmp(&image->bmp);
+	if (image->image) freeImage(image->image);
+	free(image);
+}
+
+/* Returns: the current width and height of image in pixels
+ */
+
+int bimpieWidth(const tBimpieImage *image) {
+	return image->image ? image->image->width : image->bmp.info.width;
+}
+
+int bimpieHeight(const tBimpieImage *image) {
+	return image->image ? image->image->height : image->bmp.info.height;
+}
+
+/* Returns: the bits per pixel of image: 8, 16, 24 or 32
+ */
+
+int bimpieBitsPerPixel(const tBimpieImage *image) {
+	return image->bmp.info.bitsPerPixel;
+}
+
+/* Returns: about how many bytes of memory bimpieDecode() and then
+ * bimpieTransform() with o and lowMemory take for image
+ */
+
+size_t bimpieMemoryNeeded(const tBimpieImage *image, tBimpieOrient o, bool lowMemory) {
+	int width = bimpieWidth(image);
+	int height = bimpieHeight(image);
+	size_t size = calculateImageSize(width, height, bimpieBitsPerPixel(image));
+
+	// Only a transpose that changes the shape needs more: a second image, or a bit per pixel in place.
+	if (!o.transpose || width == height) return size;
+	return lowMemory ? size + (size_t)width * height / 8 : 2 * size;
+}
+
+/* Returns: the file bytes read and written for image so far. Mapped pixels
+ * count as read once mapped, and the whole output file of
+ * bimpieTransformToFile() as written once it is mapped.
+ */
+
+size_t bimpieBytesRead(const tBimpieImage *image) {
+	return image->bmp.bytesRead;
+}
+
+size_t bimpieBytesWritten(const tBimpieImage *image) {
+	return image->bmp.bytesWritten;
+}
+
+/* Returns: the orientation that leaves an image as it is, and o followed
+ * by a horizontal flip, a vertical flip or quarterTurns clockwise turns
+ */
+
+tBimpieOrient bimpieIdentity() {
+	tBimpieOrient o = { false, false, false };
+	return o;
+}
+
+tBimpieOrient bimpieFlipH(tBimpieOrient o) {
+	return fromOrient(orientFlipH(toOrient(o)));
+}
+
+tBimpieOrient bimpieFlipV(tBimpieOrient o) {
+	return fromOrient(orientFlipV(toOrient(o)));
+}
+
+tBimpieOrient bimpieRotate(tBimpieOrient o, int quarterTurns) {
+	return fromOrient(orientRotate(toOrient(o), quarterTurns));
+}
+
+/* maps rect, a region of the image o makes of a width x height image,
+ * back to that image
+ * Returns: the region of the width x height image rect's pixels come from
+ */
+
+tBimpieRect bimpieSourceRect(tBimpieOrient o, int width, int height, tBimpieRect rect) {
+	int orientedHeight = o.transpose ? width : height;
+	tRegion region = { rect.x, orientedHeight - rect.y - rect.height, rect.width, rect.height };
+	region = orientSourceRegion(toOrient(o), width, height, region);
+	tBimpieRect source = { region.col, height - region.row - region.height, region.width, region.height };
+	return source;
+}
+
+/* Returns: a message about the last call of the calling thread that
+ * failed
+ */
+
+const char *bimpieLastError() {
+	return lastError;
+}
+
+/* creates an empty chain of color operations, which leaves the colors as
+ * they are
+ * Returns: the chain, or NULL if out of memory, with bimpieLastError() set
+ */
+
+tBimpieColor *bimpieColorCreate() {
+	tBimpieColor *color = (tBimpieColor *)malloc(sizeof(tBimpieColor));
+	if (color == NULL) {
+		bimpieError(cBimpieErrorMemory, "Out of memory.");
+		return NULL;
+	}
+	colorIdentity(&color->color);
+	return color;
+}
+
+/* frees color; color may be NULL
+ */
+
+void bimpieColorFree(tBimpieColor *color) {
+	free(color);
+}
+
+/* adds an operation to the end of color: a table of the new value of each
+ * old value for blue, green and red, or a 3x3 matrix whose row ch holds
+ * the weights of the old blue, green and red in the new value of channel
+ * ch, between -8 and 8. Operations are folded into those before them
+ * where they can be.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieColorTables(tBimpieColor *color, const unsigned char tables[3][256]) {
+	if (!colorAddTables(&color->color, tables)) {
+		return bimpieError(cBimpieErrorArg, "There are too many color operations.");
+	}
+	return 0;
+}
+
+int bimpieColorMatrix(tBimpieColor *color, const double matrix[3][3]) {
+	if (!colorAddMatrix(&color->color, matrix)) {
+		return bimpieError(cBimpieErrorArg, "There are too many color operations.");
+	}
+	return 0;
+}
+
+/* Returns: v rounded and clamped to a channel value
+ */
+
+static byte channelValue(double v) {
+	return v <= 0 ? 0 : v >= 255 ? 255 : (byte)(v + 0.5);
+}
+
+/* adds the operations of Bimpie.h to the end of color. Grayscale sets each
+ * channel to the luma of ITU-R BT.601. Brightness adds amount, from -255
+ * to 255, to each channel, contrast scales each channel's distance from
+ * the middle by factor, and gamma raises each channel, from 0 to 1, to the
+ * power 1/gamma, so that a gamma above 1 brightens.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieGrayscale(tBimpieColor *color) {
+	const double luma[3][3] = { { 0.114, 0.587, 0.299 }, { 0.114, 0.587, 0.299 }, { 0.114, 0.587, 0.299 } };
+	return bimpieColorMatrix(color, luma);
+}
+
+int bimpieInvert(tBimpieColor *color) {
+	byte tables[3][256];
+	for (int v = 0; v < 256; v++) tables[0][v] = tables[1][v] = tables[2][v] = (byte)(255 - v);
+	return bimpieColorTables(color, tables);
+}
+
+int bimpieBrightness(tBimpieColor *color, double amount) {
+	if (!(amount >= -255 && amount <= 255)) {
+		return bimpieError(cBimpieErrorArg, "The brightness amount is not from -255 to 255.");
+	}
+	byte tables[3][256];
+	for (int v = 0; v < 256; v++) tables[0][v] = tables[1][v] = tables[2][v] = channelValue(v + amount);
+	return bimpieColorTables(color, tables);
+}
+
+int bimpieContrast(tBimpieColor *color, double factor) {
+	if (!(factor >= 0)) {
+		return bimpieError(cBimpieErrorArg, "The contrast factor is not valid.");
+	}
+	byte tables[3][256];
+	for (int v = 0; v < 256; v++) {
+		tables[0][v] = tables[1][v] = tables[2][v] = channelValue((v - 127.5) * factor + 127.5);
+	}
+	return bimpieColorTables(color, tables);
+}
+
+int bimpieGamma(tBimpieColor *color, double gamma) {
+	if (!(gamma > 0)) {
+		return bimpieError(cBimpieErrorArg, "The gamma is not valid.");
+	}
+	byte tables[3][256];
+	for (int v = 0; v < 256; v++) {
+		tables[0][v] = tables[1][v] = tables[2][v] = channelValue(255 * pow(v / 255.0, 1 / gamma));
+	}
+	return bimpieColorTables(color, tables);
+}
+
+/* creates a kernel of width x height weights, both odd and at most 255,
+ * from values, the top row first, as the pixels they weigh lie around the
+ * middle one. The weights are used as they are: a kernel that does not
+ * add up to 1 brightens or darkens the image.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieKernelCreate(int width, int height, const double *values, tBimpieKernel **kernel) {
+	if (width < 1 || height < 1 || width % 2 == 0 || height % 2 == 0 || width > cKernelMaxSize ||
+			height > cKernelMaxSize) {
+		return bimpieError(cBimpieErrorArg, "The width and height of a kernel must be odd and at most 255.");
+	}
+	double magnitude = 0;
+	for (int i = 0; i < width * height; i++) {
+		if (!isfinite(values[i])) magnitude = INFINITY;
+		magnitude += fabs(values[i]);
+	}
+	if (magnitude == 0 || !(magnitude <= cKernelMaxWeight)) {
+		return bimpieError(cBimpieErrorArg, "The weights of a kernel must not all be 0, nor their sizes add up to more "
+			"than 256.");
+	}
+
+	// Kernels keep their bottom row first, like images.
+	double *flipped = (double *)malloc((size_t)width * height * sizeof(double));
+	tBimpieKernel *created = (tBimpieKernel *)malloc(sizeof(tBimpieKernel));
+	if (created) created->kernel = NULL;
+	if (flipped && created) {
+		for (int i = 0; i < height; i++) {
+			memcpy(flipped + (size_t)(height - 1 - i) * width, values + (size_t)i * width, width * sizeof(double));
+		}
+		created->kernel = createKernel(width, height, flipped);
+	}
+	free(flipped);
+	if (created == NULL || created->kernel == NULL) {
+		free(created);
+		return bimpieError(cBimpieErrorMemory, "Out of memory.");
+	}
+	*kernel = created;
+	return 0;
+}
+
+/* creates a Gaussian blur of standard deviation sigma pixels, 3 sigma each
+ * way; sigma may be at most 42
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieKernelBlur(double sigma, tBimpieKernel **kernel) {
+	if (!(sigma > 0) || ceil(3 * sigma) > cKernelMaxSize / 2) {
+		return bimpieError(cBimpieErrorArg, "The sigma of a blur must be above 0 and at most 42.");
+	}
+	int radius = (int)ceil(3 * sigma), size = 2 * radius + 1;
+	double weights[size], sum = 0;
+	for (int i = 0; i < size; i++) {
+		weights[i] = exp(-(double)(i - radius) * (i - radius) / (2 * sigma * sigma));
+		sum += weights[i];
+	}
+
+	double *values = (double *)malloc((size_t)size * size * sizeof(double));
+	if (values == NULL) {
+		return bimpieError(cBimpieErrorMemory, "Out of memory.");
+	}
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < size; j++) values[i * size + j] = weights[i] / sum * weights[j] / sum;
+	}
+	int status = bimpieKernelCreate(size, size, values, kernel);
+	free(values);
+	return status;
+}
+
+/* creates a 3x3 unsharp mask: twice the pixel less a binomial blur of it,
+ * which adds back to each pixel how much it differs from those around it
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieKernelSharpen(tBimpieKernel **kernel) {
+	const double values[9] = { -1 / 16.0, -2 / 16.0, -1 / 16.0, -2 / 16.0, 2 - 4 / 16.0, -2 / 16.0,
+		-1 / 16.0, -2 / 16.0, -1 / 16.0 };
+	return bimpieKernelCreate(3, 3, values, kernel);
+}
+
+/* reads a kernel from fileName: a row of weights per line, the top row
+ * first, separated by spaces, tabs or commas. Blank lines and anything
+ * after a # are skipped. The weights are divided by their sum unless it
+ * is 0, as for edge detection, so any multiple of a kernel does the same.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int bimpieKernelRead(const char *fileName, tBimpieKernel **kernel) {
+	FILE *file = fopen(fileName, "r");
+	if (file == NULL) {
+		return bimpieError(cBimpieErrorFileOpen, "The kernel file could not be opened.");
+	}
+
+	double *values = NULL, sum = 0;
+	int width = 0, height = 0, count = 0, room = 0, status = 0;
+	char line[8192];
+	while (status == 0 && fgets(line, sizeof(line), file)) {
+		char *end = strchr(line, '#');
+		if (end) *end = '\0';
+		int rowWidth = 0;
+		for (char *p = line; status == 0; p = end) {
+			while (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r' || *p == '\n') p++;
+			if (*p == '\0') break;
+			double value = strtod(p, &end);
+			if (count == room) {
+				double *grown = (double *)realloc(values, (room ? 2 * room : 256) * sizeof(double));
+				if (grown == NULL) {
+					status = bimpieError(cBimpieErrorMemory, "Out of memory.");
+					break;
+				}
+				values = grown;
+				room = room ? 2 * room : 256;
+			}
+			if (end == p || count == cKernelMaxSize * cKernelMaxSize) {
+				status = bimpieError(cBimpieErrorFileFormat, "The kernel file holds something other than weights, "
+					"or too many of them.");
+			} else {
+				values[count++] = value;
+				sum += value;
+				rowWidth++;
+			}
+		}
+		if (status == 0 && rowWidth > 0) {
+			if (height > 0 && rowWidth != width) {
+				status = bimpieError(cBimpieErrorFileFormat, "The rows of the kernel file are not all as wide.");
+			}
+			width = rowWidth;
+			height++;
+		}
+	}
+	if (status == 0 && ferror(file)) {
+		status = bimpieError(cBimpieErrorFileRead, "The kernel file could not be read.");
+	}
+	fclose(file);
+	if (status == 0 && count == 0) {
+		status = bimpieError(cBimpieErrorFileFormat, "The kernel file holds no weights.");
+	}
+
+	if (status == 0) {
+		if (fabs(sum) > 1e-9) {
+			for (int i = 0; i < count; i++) values[i] /= sum;
+		}
+		status = bimpieKernelCreate(width, height, values, kernel);
+	}
+	free(values);
+	return status;
+}
+
+/* frees kernel; kernel may be NULL
+ */
+
+void bimpieKernelFree(tBimpieKernel *kernel) {
+	if (kernel == NULL) return;
+	freeKernel(kernel->kernel);
+	free(kernel);
+}
@@ -0,0 +1,177 @@
+/***************************************************************************************************************
+ * FILE: Bimpie.h
+ *
+ * DESCRIPTION
+ * libbimpie - the BMP decoding, transforming and encoding behind bimpie, as a library.
+ *
+ * A context (tBimpie) holds the worker threads and the buffer pool that the calls share. One context may be
+ * used from any number of threads at once. An image (tBimpieImage) belongs to one thread at a time. The pool
+ * keeps the buffers of closed images for the next ones; a long-running caller gives back what it does not expect
+ * to need with bimpieTrimBuffers(). A typical use is
+ *
+ *     tBimpie *bimpie = bimpieCreate(0);
+ *     tBimpieImage *image;
+ *     int status = bimpieOpen(bimpie, "in.bmp", &image);
+ *     if (status == 0) status = bimpieDecode(bimpie, image);
+ *     if (status == 0) status = bimpieTransform(bimpie, image, bimpieRotate(bimpieIdentity(), 1), false);
+ *     if (status == 0) status = bimpieEncode(bimpie, image, "out.bmp");
+ *     if (status != 0) fprintf(stderr, "%s\n", bimpieLastError());
+ *     bimpieClose(bimpie, image);
+ *     bimpieFree(bimpie);
+ *
+ * 8-bit palettized, 16-bit 5-5-5 and 5-6-5, 24-bit and 32-bit BGRA files are read and written as they are. The
+ * header bytes between the info header and the pixels (the rest of a V4 or V5 header, color masks, the palette,
+ * an embedded ICC profile, any gap) are carried over to the output unchanged, as is a V5 profile stored after the
+ * pixels; only the sizes and offsets are updated. Top-down files are written top-down, except
+ * that a vertical flip on its own is done by turning the file over, with no pixels moved.
+ *
+ * Images too big for memory are transformed without being decoded: open them and call bimpieTransformToFile()
+ * straight away, and the pixels are streamed from file to file in strips, through a scratch file of tiles next to
+ * the output for orientations that transpose. bimpieMemoryNeeded() tells when that is worth it, and
+ * bimpieSetMaxMemory() bounds the memory it takes. All sizes are 64-bit; files past 4 GB are read and written,
+ * with the 32-bit size fields of their headers set to 0.
+ *
+ * Flips and half turns can also be done on the file itself with bimpieEditInPlace(), holding a few MB and no
+ * second copy of the file. With a journal the edit is crash-safe: bimpieOpen() finds the journal an interrupted
+ * edit left next to the file and puts the file back as it was before that edit. An edit locks the file while it
+ * runs, and bimpieOpen() fails rather than undo an edit that is still running.
+ *
+ * To cut a region out of an image, decode only that with bimpieDecodeRect(): just the rows it touches, and the
+ * bytes of each row it covers, are read. To crop after a transform, map the region back to the image as it is in
+ * the file with bimpieSourceRect(), decode that, then transform it.
+ *
+ * bimpieDecodeThumbnail() shrinks an image by a whole factor while it reads it, in one pass over the file and in
+ * memory for the thumbnail alone.
+ *
+ * bimpieResize() scales decoded or mapped 24 and 32-bit images with a choice of filters, turning them to an
+ * orientation in the same pass, so resizing and rotating costs no more than resizing.
+ *
+ * Point color operations (grayscale, invert, brightness, contrast, gamma, or any table per channel or 3x3 mix of
+ * the channels) are chained in a tBimpieColor and set on an image with bimpieSetColor(). A chain folds into a
+ * table per channel, a mix, or a few of those in turn, and is applied in the same pass as the next transform,
+ * resize or encode, or as the pixels are streamed by bimpieTransformToFile(). 8-bit images have their palette
+ * changed instead; 16-bit ones cannot be changed.
+ *
+ * bimpieConvolve() blurs, sharpens or finds the edges of decoded or mapped 24 and 32-bit images with a kernel from
+ * bimpieKernelBlur(), bimpieKernelSharpen(), bimpieKernelRead() or bimpieKernelCreate(). The image is cut into
+ * tiles spread over the threads; separable kernels, such as the Gaussian of a blur, take two passes over each tile
+ * and cost their width plus their height per pixel, others their width times their height.
+ *
+ * Every call returns 0 or one of the cBimpieError codes below, and never exits. The calling thread can then get
+ * a message about the failure from bimpieLastError().
+ **************************************************************************************************************/
+#ifndef BIMPIE_H
+#define BIMPIE_H
+#include <stdbool.h>
+#include <stddef.h>
+
+//==============================================================================================================
+// CONSTANT DEFINITIONS
+//==============================================================================================================
+
+// The codes returned by the calls. The argument, file and memory codes have the same values as bimpie's cError
+// codes.
+#define cBimpieErrorArg			-1
+#define cBimpieErrorFileOpen	-7
+#define cBimpieErrorFileRead	-9
+#define cBimpieErrorFileWrite	-10
+#define cBimpieErrorFileFormat	-11
+#define cBimpieErrorMemory		-12
+#define cBimpieErrorState		-13
+
+// The filters of bimpieResize(): the average of the pixels each new one covers, the same as nearest neighbour
+// when enlarging; a tent over the two nearest pixels each way, scaled up when shrinking; and a Lanczos window
+// three pixels each way, the sharpest and slowest.
+#define cBimpieFilterBox		0
+#define cBimpieFilterBilinear	1
+#define cBimpieFilterLanczos	2
+
+//==============================================================================================================
+// TYPE DEFINITIONS
+//==============================================================================================================
+
+typedef struct tBimpie tBimpie;
+typedef struct tBimpieImage tBimpieImage;
+typedef struct tBimpieColor tBimpieColor;
+typedef struct tBimpieKernel tBimpieKernel;
+
+/* One of the 8 orientations reachable with flips and quarter turns: transpose first if set, then reverse the
+ * columns if flipX, then the rows if flipY. Build them with bimpieIdentity(), bimpieFlipH(), bimpieFlipV() and
+ * bimpieRotate() rather than by hand, so that any chain of operations costs one pass over the pixels.
+ */
+typedef struct {
+	bool	transpose;
+	bool	flipX;
+	bool	flipY;
+} tBimpieOrient;
+
+// A rectangle of pixels: its top left corner x pixels from the left and y from the top, and its size.
+typedef struct {
+	int		x;
+	int		y;
+	int		width;
+	int		height;
+} tBimpieRect;
+
+// A task for bimpieRun(): runs task number task; arg is passed through from bimpieRun().
+typedef void (*tBimpieTask)(void *arg, int task);
+
+//==============================================================================================================
+// FUNCTION DECLARATIONS
+//==============================================================================================================
+
+tBimpie *bimpieCreate(int threads);
+void bimpieFree(tBimpie *);
+void bimpieRun(tBimpie *, int taskCount, tBimpieTask, void *arg);
+int bimpieThreads(const tBimpie *);
+void bimpieBufferStats(tBimpie *, size_t *highWater, long *allocs);
+int bimpieReserveBuffers(tBimpie *, size_t bytes, int count);
+void bimpieTrimBuffers(tBimpie *, size_t bytes);
+void bimpieSetMaxMemory(tBimpie *, size_t bytes);
+
+int bimpieOpen(tBimpie *, const char *fileName, tBimpieImage **);
+int bimpieDecode(tBimpie *, tBimpieImage *);
+int bimpieDecodeRect(tBimpie *, tBimpieImage *, tBimpieRect);
+int bimpieDecodeThumbnail(tBimpie *, tBimpieImage *, int maxSize);
+int bimpieMap(tBimpie *, tBimpieImage *);
+int bimpieTransform(tBimpie *, tBimpieImage *, tBimpieOrient, bool lowMemory);
+int bimpieResize(tBimpie *, tBimpieImage *, tBimpieOrient, int width, int height, int filter);
+int bimpieEncode(tBimpie *, tBimpieImage *, const char *fileName);
+int bimpieTransformToFile(tBimpie *, tBimpieImage *, tBimpieOrient, const char *fileName);
+int bimpieEditInPlace(tBimpie *, tBimpieImage *, tBimpieOrient, const char *fileName, bool journal);
+int bimpieSetColor(tBimpie *, tBimpieImage *, const tBimpieColor *);
+int bimpieConvolve(tBimpie *, tBimpieImage *, const tBimpieKernel *, tBimpieOrient);
+void bimpieClose(tBimpie *, tBimpieImage *);
+
+int bimpieWidth(const tBimpieImage *);
+int bimpieHeight(const tBimpieImage *);
+int bimpieBitsPerPixel(const tBimpieImage *);
+size_t bimpieMemoryNeeded(const tBimpieImage *, tBimpieOrient, bool lowMemory);
+size_t bimpieBytesRead(const tBimpieImage *);
+size_t bimpieBytesWritten(const tBimpieImage *);
+
+tBimpieOrient bimpieIdentity();
+tBimpieOrient bimpieFlipH(tBimpieOrient);
+tBimpieOrient bimpieFlipV(tBimpieOrient);
+tBimpieOrient bimpieRotate(tBimpieOrient, int quarterTurns);
+tBimpieRect bimpieSourceRect(tBimpieOrient, int width, int height, tBimpieRect);
+
+tBimpieColor *bimpieColorCreate();
+void bimpieColorFree(tBimpieColor *);
+int bimpieGrayscale(tBimpieColor *);
+int bimpieInvert(tBimpieColor *);
+int bimpieBrightness(tBimpieColor *, double amount);
+int bimpieContrast(tBimpieColor *, double factor);
+int bimpieGamma(tBimpieColor *, double gamma);
+int bimpieColorTables(tBimpieColor *, const unsigned char tables[3][256]);
+int bimpieColorMatrix(tBimpieColor *, const double matrix[3][3]);
+
+int bimpieKernelCreate(int width, int height, const double *values, tBimpieKernel **);
+int bimpieKernelBlur(double sigma, tBimpieKernel **);
+int bimpieKernelSharpen(tBimpieKernel **);
+int bimpieKernelRead(const char *fileName, tBimpieKernel **);
+void bimpieKernelFree(tBimpieKernel *);
+
+const char *bimpieLastError();
+
+#endif
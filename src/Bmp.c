@@ -8,40 +8,286 @@
  * Brian Blanchard and Brittney Russell
  *
  **************************************************************************************************************/
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "String.h"
-#include "Error.h"
+#include "Bimpie.h"
 #include "Bmp.h"
-
-FILE *bmpFileIn;
-FILE *bmpFileOut;
-
-int paddingBytes;
+#include "Image.h"
+#include "Simd.h"
 
 const size_t cBmpHeaderSize = 14;
 const size_t cBmpInfoHeaderSize = 40;
-const size_t cSizeOfPixel = 3;
 
+// Where the fields of a BITMAPV5HEADER about an embedded color profile lie in the extra header bytes.
+const size_t cV5CsType = 16;
+const size_t cV5ProfileData = 72;
+const size_t cV5ProfileSize = 76;
+const int32_t cProfileEmbedded = 0x4D424544;	// 'MBED'
+
+// Pixel rows are read and written in blocks of about this many bytes.
+const size_t cIoBlockSize = 1 << 20;
+
+
+/* Records an error message in bmp->error
+ * @params: bmp - the file the error is about
+ *			code - the cBimpieError code to return
+ *			message - what went wrong
+ * Returns: code
+ */
+
+static int bmpError(tBmp *bmp, int code, char *message) {
+	snprintf(bmp->error, sizeof(bmp->error), "%s", message);
+	return code;
+}
+
+/* Reads size bytes at offset in the file fd into buffer, however many
+ * calls that takes
+ * Returns: true if they were all read
+ */
+
+bool readAt(int fd, void *buffer, size_t size, off_t offset) {
+	while (size > 0) {
+		ssize_t n = pread(fd, buffer, size, offset);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		buffer = (byte *) buffer + n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+}
+
+/* Writes the size bytes at buffer to offset in the file fd, however many
+ * calls that takes
+ * Returns: true if they were all written
+ */
+
+bool writeAt(int fd, const void *buffer, size_t size, off_t offset) {
+	while (size > 0) {
+		ssize_t n = pwrite(fd, buffer, size, offset);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		buffer = (const byte *) buffer + n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+}
 
 /* Calculates the padding bytes for the read bmp
  * @params: width - width of the read bmp
+ *			bitsPerPixel - 8, 16, 24 or 32
  */
 
-int static calculatePaddingBytes(int width) {
-	int padding = (4-(3*width) % 4) % 4;
+int static calculatePaddingBytes(int width, int bitsPerPixel) {
+	int padding = (4-(bitsPerPixel/8*(size_t)width) % 4) % 4;
 	return padding;
 }
 
+/* Calculates the bytes of one pixel row of bmp in the file, padding included
+ */
+
+size_t calculateFileRowSize(tBmp *bmp) {
+	return (size_t)bmp->info.width * (bmp->info.bitsPerPixel / 8) + bmp->paddingBytes;
+}
+
+/* Calculates the fewest bytes that must lie between tBmpInfoHeader and
+ * the pixels of bmp: the rest of a longer info header, the color masks
+ * that follow a 40-byte one, and the palette
+ */
+
+static long calculateExtraHeaderSize(tBmp *bmp) {
+	long size = bmp->info.sizeBmpInfoHeader - (long)cBmpInfoHeaderSize;
+	if (bmp->info.sizeBmpInfoHeader == cBmpInfoHeaderV1) {
+		if (bmp->info.compression == cBmpBitfields) size += 12;
+		if (bmp->info.compression == cBmpAlphaBitfields) size += 16;
+	}
+	if (bmp->info.bitsPerPixel == 8) {
+		size += 4 * (bmp->info.colorsUsed ? bmp->info.colorsUsed : 256);
+	}
+	return size;
+}
+
+/* Checks that bimpie can read the pixels described by the info header:
+ * 8-bit palette indexes, 16-bit 5-5-5 or with color masks, 24-bit BGR, or
+ * 32-bit BGRA with or without color masks
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int checkBmpFormat(tBmp *bmp) {
+	int bpp = bmp->info.bitsPerPixel;
+	int size = bmp->info.sizeBmpInfoHeader;
+	bool masks = bmp->info.compression == cBmpBitfields || bmp->info.compression == cBmpAlphaBitfields;
+
+	if (size != cBmpInfoHeaderV1 && size != cBmpInfoHeaderV2 && size != cBmpInfoHeaderV3 &&
+			size != cBmpInfoHeaderV4 && size != cBmpInfoHeaderV5) {
+		return bmpError(bmp, cBimpieErrorFileFormat, "This program does not support this kind of info header");
+	}
+	if (bpp != 8 && bpp != 16 && bpp != 24 && bpp != 32) {
+		return bmpError(bmp, cBimpieErrorFileFormat, "This program only supports 8, 16, 24 and 32 bit pixels");
+	}
+	if (masks ? bpp != 16 && bpp != 32 : bmp->info.compression != cBmpRgb) {
+		return bmpError(bmp, cBimpieErrorFileFormat, "This program does not support compressed pixels");
+	}
+	if (bmp->info.width <= 0 || bmp->info.height <= 0) {
+		return bmpError(bmp, cBimpieErrorFileFormat, "The file is corrupted");
+	}
+	if (bpp == 8 && (bmp->info.colorsUsed < 0 || bmp->info.colorsUsed > 256)) {
+		return bmpError(bmp, cBimpieErrorFileFormat, "The palette is corrupted");
+	}
+	return 0;
+}
+
+/* Calculates how many padded file rows fit in one I/O block, at least one
+ * @params: fileRowSize - bytes per row in the file, including padding
+ *			height - number of rows in the image
+ */
+
+static int calculateRowsPerBlock(size_t fileRowSize, int height) {
+	size_t rows = cIoBlockSize / fileRowSize;
+	if (rows < 1) rows = 1;
+	if (rows > (size_t)height) rows = height;
+	return (int)rows;
+}
+
+/* Packs the headers of bmp into their on-disk form
+ * @params: buffer - receives cBmpHeaderSize + cBmpInfoHeaderSize bytes
+ */
+
+static void packBmpHeaders(tBmp *bmp, byte *buffer) {
+	buffer[0] = bmp->header.signature_B;
+	buffer[1] = bmp->header.signature_M;
+	memcpy(&buffer[2], &bmp->header.fileSize, sizeof(bmp->header.fileSize));
+	memcpy(&buffer[6], &bmp->header.reserved1, sizeof(bmp->header.reserved1));
+	memcpy(&buffer[8], &bmp->header.reserved2, sizeof(bmp->header.reserved2));
+	memcpy(&buffer[10], &bmp->header.pixelOffset, sizeof(bmp->header.pixelOffset));
+	tBmpInfoHeader info = bmp->info;
+	if (bmp->topDown) info.height = -info.height;
+	memcpy(&buffer[cBmpHeaderSize], &info, cBmpInfoHeaderSize);
+}
+
+/* Returns: the 32-bit field at offset in the extra header bytes of bmp
+ */
+
+static int32_t extraHeaderField(tBmp *bmp, size_t offset) {
+	int32_t field;
+	memcpy(&field, bmp->extraHeader + offset, sizeof(field));
+	return field;
+}
+
+/* Returns: the file offset of the color profile embedded in the V5 header
+ * of bmp, or -1 if there is none
+ */
+
+static long embeddedProfileOffset(tBmp *bmp) {
+	if (bmp->info.sizeBmpInfoHeader < cBmpInfoHeaderV5 || extraHeaderField(bmp, cV5CsType) != cProfileEmbedded ||
+			extraHeaderField(bmp, cV5ProfileSize) <= 0) {
+		return -1;
+	}
+	return cBmpHeaderSize + (long)(uint32_t)extraHeaderField(bmp, cV5ProfileData);
+}
+
+/* Takes a buffer of size bytes and reads them from the current position of
+ * the input file of bmp, or leaves *bytes NULL if size is 0
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int readKeptBytes(tBmp *bmp, byte **bytes, size_t size) {
+	if (size == 0) {
+		return 0;
+	}
+	if ((*bytes = (byte *) takeBuffer(bmp->buffers, size)) == NULL) {
+		return bmpError(bmp, cBimpieErrorMemory, "Out of memory.");
+	}
+	if (fread(*bytes, size, 1, bmp->file) != 1) {
+		return bmpError(bmp, cBimpieErrorFileRead, "Error reading File");
+	}
+	bmp->bytesRead += size;
+	return 0;
+}
+
+/* Writes the size bytes at bytes to file, if there are any
+ * Returns: true if they were written
+ */
+
+static bool writeKeptBytes(FILE *file, byte *bytes, size_t size) {
+	return size == 0 || fwrite(bytes, size, 1, file) == 1;
+}
+
+/* Returns: the image row that file row row of bmp holds. Image row 0 is
+ * the bottom one, which a top-down file stores last.
+ */
+
+static int imageRowOf(tBmp *bmp, int row) {
+	return bmp->topDown ? bmp->info.height - 1 - row : row;
+}
+
+/* Points image at pixel rows laid out as in the file of bmp, from the first
+ * row in the file on. A top-down file starts with the top row, so its rows
+ * are walked backwards from the last one with a negative stride.
+ */
+
+static void setFileRows(tBmp *bmp, tImage *image, byte *firstRow, size_t fileRowSize) {
+	image->pixels = firstRow;
+	image->stride = fileRowSize;
+	if (bmp->topDown) {
+		image->pixels += (ptrdiff_t)(image->height - 1) * image->stride;
+		image->stride = -image->stride;
+	}
+}
+
+/* Returns: the lowest address of the rows of image, which is where the
+ * first of them in the file goes; see setFileRows()
+ */
+
+static byte *fileRowsStart(const tImage *image) {
+	return image->stride < 0 ? (byte *) imageRow(image, image->height - 1) : image->pixels;
+}
+
+/* Lays out the headers of bmp for writing its current width and height.
+ * The sizes are worked out in 64 bits; the header fields only have 32, so
+ * past 4 GB they are written as 0, which readers take as unknown.
+ * @params: fileRowSize - receives the bytes per pixel row in the file
+ * Returns: the size of the whole file in bytes
+ */
+
+static size_t setBmpLayout(tBmp *bmp, int width, int height, size_t *fileRowSize) {
+	bmp->info.width = width;
+	bmp->info.height = height;
+	bmp->paddingBytes = calculatePaddingBytes(width, bmp->info.bitsPerPixel);
+	*fileRowSize = calculateFileRowSize(bmp);
+
+	size_t imageSize = *fileRowSize * height;
+	size_t pixelOffset = cBmpHeaderSize + cBmpInfoHeaderSize + bmp->extraHeaderSize;
+	size_t fileSize = pixelOffset + imageSize + bmp->trailerSize;
+	bmp->info.imageSize = imageSize <= UINT32_MAX ? imageSize : 0;
+	bmp->header.pixelOffset = pixelOffset;
+	bmp->header.fileSize = fileSize <= UINT32_MAX ? fileSize : 0;
+
+	// A profile after the pixels moves with their end.
+	if (bmp->trailerSize > 0 && bmp->profileOffset >= 0) {
+		uint32_t profileData = pixelOffset + imageSize + bmp->profileOffset - cBmpHeaderSize;
+		memcpy(bmp->extraHeader + cV5ProfileData, &profileData, sizeof(profileData));
+	}
+	return fileSize;
+}
+
 /* gets the size of the file on the actual system
  * @params: fileName - name of the file to be read.
+ * Returns: the size, or -1 if it cannot be determined
  */
 
 long static getFileSize(char *fileName) {
 	struct stat fileStat;
 	if (stat(fileName, &fileStat) != 0) {
-		ErrorExit(EXIT_FAILURE, "Error determining file size.");
+		return -1;
 	}
 	long fileSize = (long)fileStat.st_size;
 	return fileSize;
@@ -51,169 +297,776 @@ long static getFileSize(char *fileName) {
  * into the bmpInfoHeader
  */
 
-static long calculateBmpFileSize() {
-	long bmpFileSize = bmpInfoHeader.height * (3 * bmpInfoHeader.width + paddingBytes) + 54;
+static long calculateBmpFileSize(tBmp *bmp) {
+	long bmpFileSize = (long)bmp->info.height * (long)calculateFileRowSize(bmp) + (long)bmp->header.pixelOffset;
 	return bmpFileSize;
 }
 
-static void freePixels(tPixel** pixelsToFree) {
-	int height = bmpInfoHeader.height;
-	for (int i = 0; i < height; i++) {
-		free(pixelsToFree[i]);
-	}
-	free(pixelsToFree);
+/* Creates an image for the pixels of bmp
+ */
+
+static tImage *createBmpImage(tBmp *bmp) {
+	return createImage(bmp->info.width, bmp->info.height, bmp->info.bitsPerPixel, bmp->buffers);
 }
 
-void readBmpHeaders(char * fileName) {	
+/* Opens fileName and reads and checks its headers
+ * Returns: 0 or a cBimpieError code
+ */
+
+int readBmpHeaders(tBmp *bmp, char * fileName) {	
 	byte bufferHeader[sizeof(tBmpHeader)];	
-	bmpFileIn = fopen(fileName, "rb");
+	bmp->file = fopen(fileName, "rb");
 
 	long fileSize;
 	long bmpFileSize;
 
-	if (bmpFileIn == NULL) {
-		ErrorExit(EXIT_FAILURE, "The file could not be opened");
+	if (bmp->file == NULL) {
+		return bmpError(bmp, cBimpieErrorFileOpen, "The file could not be opened");
 	}
 
-	if (fread(bufferHeader, cBmpHeaderSize, 1, bmpFileIn) != 1) {
-		ErrorExit(EXIT_FAILURE, "Error reading File");
+	if (fread(bufferHeader, cBmpHeaderSize, 1, bmp->file) != 1) {
+		return bmpError(bmp, cBimpieErrorFileRead, "Error reading File");
 	}
 
+	bmp->bytesRead += cBmpHeaderSize;
+
 	if (bufferHeader[0] != 'B' || bufferHeader[1] != 'M') {
-		ErrorExit(EXIT_FAILURE, "Not a BMP File");
+		return bmpError(bmp, cBimpieErrorFileFormat, "Not a BMP File");
 	}
 
 	// using a buffer to avoid struct packing issues
 
-	bmpHeader.signature_B = bufferHeader[0];
-	bmpHeader.signature_M = bufferHeader[1];
-	memcpy(&bmpHeader.fileSize, &bufferHeader[2], sizeof(bmpHeader.fileSize));
-	memcpy(&bmpHeader.reserved1, &bufferHeader[6], sizeof(bmpHeader.reserved1));
-	memcpy(&bmpHeader.reserved2, &bufferHeader[8], sizeof(bmpHeader.reserved2));
-	memcpy(&bmpHeader.pixelOffset, &bufferHeader[10], sizeof(bmpHeader.pixelOffset));
+	bmp->header.signature_B = bufferHeader[0];
+	bmp->header.signature_M = bufferHeader[1];
+	memcpy(&bmp->header.fileSize, &bufferHeader[2], sizeof(bmp->header.fileSize));
+	memcpy(&bmp->header.reserved1, &bufferHeader[6], sizeof(bmp->header.reserved1));
+	memcpy(&bmp->header.reserved2, &bufferHeader[8], sizeof(bmp->header.reserved2));
+	memcpy(&bmp->header.pixelOffset, &bufferHeader[10], sizeof(bmp->header.pixelOffset));
 
-	printf("Size of tBmpInfoHeader: %ld\n", sizeof(tBmpInfoHeader));
-
-	if (fread(&bmpInfoHeader, cBmpInfoHeaderSize, 1, bmpFileIn) != 1) {
-		ErrorExit(EXIT_FAILURE, "Error reading File");
+	if (fread(&bmp->info, cBmpInfoHeaderSize, 1, bmp->file) != 1) {
+		return bmpError(bmp, cBimpieErrorFileRead, "Error reading File");
 	}	
+	bmp->bytesRead += cBmpInfoHeaderSize;
 
-	paddingBytes = calculatePaddingBytes(bmpInfoHeader.width);
+	// A negative height marks a top-down file; from here on the height is kept positive.
+	bmp->topDown = bmp->info.height < 0;
+	if (bmp->topDown) {
+		if (bmp->info.height == INT32_MIN) {
+			return bmpError(bmp, cBimpieErrorFileFormat, "The file is corrupted");
+		}
+		bmp->info.height = -bmp->info.height;
+	}
 
-	printf("paddingBytes: %d\n", paddingBytes);
+	int status = checkBmpFormat(bmp);
+	if (status != 0) {
+		return status;
+	}
 
 	fileSize = getFileSize(fileName);
-	bmpFileSize = calculateBmpFileSize();
 
-	printf("File Size: %ld\n", fileSize);
-	printf("bmpFileSize: %ld\n", bmpFileSize);
-	printf("bits per pixel: %d\n", bmpInfoHeader.bitsPerPixel);
-
-	if (bmpInfoHeader.bitsPerPixel != 24) {
-		ErrorExit(EXIT_FAILURE, "This program only supports 24 bit pixels");
+	// Whatever lies between the info header and the pixels is kept as it is, to be written back.
+	long extraHeaderSize = (long)bmp->header.pixelOffset - (long)(cBmpHeaderSize + cBmpInfoHeaderSize);
+	if (extraHeaderSize < calculateExtraHeaderSize(bmp) || (long)bmp->header.pixelOffset > fileSize) {
+		return bmpError(bmp, cBimpieErrorFileFormat, "The file is corrupted");
+	}
+	bmp->extraHeaderSize = extraHeaderSize;
+	if ((status = readKeptBytes(bmp, &bmp->extraHeader, bmp->extraHeaderSize)) != 0) {
+		return status;
 	}
 
+	bmp->paddingBytes = calculatePaddingBytes(bmp->info.width, bmp->info.bitsPerPixel);
+	bmpFileSize = calculateBmpFileSize(bmp);
+
+	// The only thing allowed after the pixels is a color profile, which a V5 header may point to there.
+	bmp->profileOffset = -1;
 	if (fileSize != bmpFileSize) {
-		printf("%s is corrupted\n", fileName);
-		exit(EXIT_FAILURE);
+		long profile = embeddedProfileOffset(bmp);
+		if (fileSize < bmpFileSize || profile < bmpFileSize ||
+				profile + extraHeaderField(bmp, cV5ProfileSize) > fileSize) {
+			return bmpError(bmp, cBimpieErrorFileFormat, "The file is corrupted");
+		}
+		bmp->trailerSize = fileSize - bmpFileSize;
+		if (fseek(bmp->file, bmpFileSize, SEEK_SET) != 0 ||
+				(status = readKeptBytes(bmp, &bmp->trailer, bmp->trailerSize)) != 0 ||
+				fseek(bmp->file, bmp->header.pixelOffset, SEEK_SET) != 0) {
+			return status ? status : bmpError(bmp, cBimpieErrorFileRead, "Error reading File");
+		}
+		bmp->profileOffset = profile - bmpFileSize;
 	}
 
+	return 0;
 }
 
 /*****************************
-* Initializes the 2D array of pixels
-* and reads the actual file pixels into the array
+* Allocates the image
+* and reads the actual file pixels into it
 *****************************/
 
-tPixel **readBmpPixels() {
+int readBmpPixels(tBmp *bmp, tImage **imageRead) {
 	
-	int height = bmpInfoHeader.height;
-	int width = bmpInfoHeader.width;
-
-	byte *bmpPaddingBytes = (byte*) malloc(height * sizeof(byte));
+	int height = bmp->info.height;
+	size_t fileRowSize = calculateFileRowSize(bmp);
+	size_t rowSize = fileRowSize - bmp->paddingBytes;
+	int rowsPerBlock = calculateRowsPerBlock(fileRowSize, height);
 
-	tPixel **pixels = (tPixel **) malloc(height * sizeof(tPixel *));
-	for (int row = 0; row < height; row++) {
-		pixels[row] = (tPixel *) malloc(width * sizeof(tPixel));
-		
+	byte *block = (byte *) takeBuffer(bmp->buffers, rowsPerBlock * fileRowSize);
+	tImage *image = createBmpImage(bmp);
+	if (block == NULL || image == NULL) {
+		giveBuffer(bmp->buffers, block);
+		if (image) freeImage(image);
+		return bmpError(bmp, cBimpieErrorMemory, "Out of memory.");
 	}
 	
-	printf("Width: %d\n", bmpInfoHeader.width);
-	printf("Height: %d\n", bmpInfoHeader.height);	
+	int status = 0;
+	for (int row = 0; row < height && status == 0; row += rowsPerBlock) {
+		int rows = height - row < rowsPerBlock ? height - row : rowsPerBlock;
+		if (fread(block, fileRowSize, rows, bmp->file) != (size_t)rows) {
+			status = bmpError(bmp, cBimpieErrorFileRead, "Pixel Error.");
+			break;
+		}
+		bmp->bytesRead += rows * fileRowSize;
 
-	for (int row = 0; row < height; row++) {
-		for (int col = 0; col < width; col++) {
-			if(fread(&pixels[row][col], cSizeOfPixel, 1, bmpFileIn) != 1) {
-				ErrorExit(EXIT_FAILURE, "Pixel Error.");
-			}					
+		// The padding is left behind unchecked, as the readers that skip it cannot check it either.
+		byte *fileRow = block;
+		for (int i = 0; i < rows; i++, fileRow += fileRowSize) {
+			memcpy(imageRow(image, imageRowOf(bmp, row + i)), fileRow, rowSize);
 		}
-		fread(&bmpPaddingBytes[row], sizeof(byte), paddingBytes, bmpFileIn);
- 	}
-  	
- 	for (int i = 0; i < height * paddingBytes; i++) {
- 		if (bmpPaddingBytes[i] != 0) {
- 			ErrorExit(EXIT_FAILURE, "Padding bytes not 0.");
- 		}
  	}
 
- 	free(bmpPaddingBytes);
+ 	giveBuffer(bmp->buffers, block);
+ 	closeBmp(bmp);
+	if (status != 0) {
+		freeImage(image);
+		return status;
+	}
   	
-	return pixels;
+	*imageRead = image;
+	return 0;
 }
 
-/* Writes the processed bmp file
- * @params: fileName - name of file to be written
- * 			pixelsToWrite - the processed image pixels
+/* Reads only the pixels of region of the image, which must lie inside it,
+ * into an image of the region's size. Each row's slice is read on its own
+ * with pread(), unless the region takes up most of a row; then blocks of
+ * whole rows are read and the slices copied out, as fewer, larger reads
+ * cost less than skipping the little left over. Rows the region does not
+ * touch are never read.
+ * Returns: 0 or a cBimpieError code
  */
 
-void writeBmp(char *fileName, tPixel **pixelsToWrite) {
-	int height = bmpInfoHeader.height;
-	int width = bmpInfoHeader.width;
+int readBmpRegion(tBmp *bmp, tRegion region, tImage **imageRead) {
+	size_t fileRowSize = calculateFileRowSize(bmp);
+	size_t pixelSize = bmp->info.bitsPerPixel / 8;
+	size_t sliceSize = region.width * pixelSize;
+	size_t sliceOffset = region.col * pixelSize;
+	bool wholeRows = sliceSize * 2 > fileRowSize;
+	int rowsPerBlock = wholeRows ? calculateRowsPerBlock(fileRowSize, region.height) : 0;
 
-	printf("outfile name: %s\n", fileName);
+	byte *block = wholeRows ? (byte *) takeBuffer(bmp->buffers, rowsPerBlock * fileRowSize) : NULL;
+	tImage *image = createImage(region.width, region.height, bmp->info.bitsPerPixel, bmp->buffers);
+	if ((wholeRows && block == NULL) || image == NULL) {
+		giveBuffer(bmp->buffers, block);
+		if (image) freeImage(image);
+		return bmpError(bmp, cBimpieErrorMemory, "Out of memory.");
+	}
 
-	char *padding = "\0\0\0\0";
+	// The region's rows lie together in the file, from its lowest one up or, top-down, from its highest one down.
+	int fd = fileno(bmp->file);
+	int firstFileRow = bmp->topDown ? bmp->info.height - region.row - region.height : region.row;
+	int status = 0;
+	for (int i = 0; i < region.height && status == 0; ) {
+		int rows = wholeRows ? region.height - i < rowsPerBlock ? region.height - i : rowsPerBlock : 1;
+		off_t offset = bmp->header.pixelOffset + (off_t)(firstFileRow + i) * fileRowSize;
+		if (wholeRows) {
+			if (!readAt(fd, block, rows * fileRowSize, offset)) {
+				status = bmpError(bmp, cBimpieErrorFileRead, "Pixel Error.");
+				break;
+			}
+			bmp->bytesRead += rows * fileRowSize;
+		}
+		for (int j = 0; j < rows; j++, i++) {
+			byte *row = (byte *)imageRow(image, bmp->topDown ? region.height - 1 - i : i);
+			if (wholeRows) {
+				memcpy(row, block + j * fileRowSize + sliceOffset, sliceSize);
+			} else if (readAt(fd, row, sliceSize, offset + sliceOffset)) {
+				bmp->bytesRead += sliceSize;
+			} else {
+				status = bmpError(bmp, cBimpieErrorFileRead, "Pixel Error.");
+				break;
+			}
+		}
+	}
+
+	giveBuffer(bmp->buffers, block);
+	closeBmp(bmp);
+	if (status != 0) {
+		freeImage(image);
+		return status;
+	}
 
-	paddingBytes = calculatePaddingBytes(width);
+	*imageRead = image;
+	return 0;
+}
 
-	printf("Updated paddingBytes: %d\n", paddingBytes);
+/* Returns: the size of a side of an image of size pixels shrunk by factor,
+ * a block of factor pixels, or what is left at the edge, to each pixel
+ */
 
-	bmpFileOut = fopen(fileName, "wb");
-	if(bmpFileOut == NULL) {
-		ErrorExit(EXIT_FAILURE, "The file could not be opened.");
+static int shrunkSize(int size, int factor) {
+	return (size + factor - 1) / factor;
+}
+
+/* Adds each channel of the pixels of a file row of width pixels to the
+ * sum of the thumbnail pixel whose block of factor pixels they lie in
+ * @params: sums - a sum for each channel of each pixel of a thumbnail row
+ */
+
+static void accumulateThumbnailRow(uint64_t *sums, const byte *from, int width, int size, int factor) {
+	for (int j = 0; j * factor < width; j++, sums += size) {
+		int cols = width - j * factor < factor ? width - j * factor : factor;
+		uint64_t b = 0, g = 0, r = 0, a = 0;
+		for (int c = 0; c < cols; c++, from += size) {
+			b += from[0];
+			g += from[1];
+			r += from[2];
+			if (size == 4) a += from[3];
+		}
+		sums[0] += b;
+		sums[1] += g;
+		sums[2] += r;
+		if (size == 4) sums[3] += a;
 	}
-	byte bufferHeader[sizeof(tBmpHeader)];
+}
 
-	bufferHeader[0] = bmpHeader.signature_B;
-	bufferHeader[1] = bmpHeader.signature_M;
-	memcpy(&bufferHeader[2], &bmpHeader.fileSize, sizeof(bmpHeader.fileSize));
-	memcpy(&bufferHeader[6], &bmpHeader.reserved1, sizeof(bmpHeader.reserved1));
-	memcpy(&bufferHeader[8], &bmpHeader.reserved2, sizeof(bmpHeader.reserved2));
-	memcpy(&bufferHeader[10], &bmpHeader.pixelOffset, sizeof(bmpHeader.pixelOffset));
+/* Averages the sums of one band of rows of a thumbnail into row row of
+ * image. Each pixel gets the rounded mean of the block of factor x factor
+ * pixels it stands for, fewer at the right and top edges.
+ * @params: sums - the sums of accumulateThumbnailRow() over the band
+ *			rows - the number of rows in the band
+ */
 
-	if(fwrite(bufferHeader, cBmpHeaderSize, 1, bmpFileOut) != 1) {
-		ErrorExit(EXIT_FAILURE, "Error writing file 1");
+static void averageThumbnailRow(tImage *image, int row, const uint64_t *sums, int rows, int factor, int width) {
+	int size = image->bpp / 8;
+	byte *to = (byte *)imageRow(image, row);
+	for (int j = 0; j < image->width; j++, to += size, sums += size) {
+		int cols = width - j * factor < factor ? width - j * factor : factor;
+		uint64_t count = (uint64_t)cols * rows;
+		for (int ch = 0; ch < size; ch++) {
+			to[ch] = (byte)((sums[ch] + count / 2) / count);
+		}
 	}
+}
 
-	if(fwrite(&bmpInfoHeader, cBmpInfoHeaderSize, 1, bmpFileOut) != 1) {
-		ErrorExit(EXIT_FAILURE, "Error writing file 2");
+/* Reads a thumbnail of 24 or 32-bit pixels: reads the rows in blocks, in
+ * the order they lie in the file, and adds each one to one row of 64-bit
+ * sums, one for each channel of a thumbnail pixel, which becomes a row of
+ * the thumbnail once all the rows of its band are in. A top-down file meets its bands from the top, and the top band may
+ * be short, so the bands are counted from the bottom either way.
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int averageThumbnail(tBmp *bmp, int factor, tImage *image) {
+	int width = bmp->info.width;
+	int height = bmp->info.height;
+	size_t fileRowSize = calculateFileRowSize(bmp);
+	int size = image->bpp / 8;
+	size_t sumsSize = (size_t)image->width * size * sizeof(uint64_t);
+	int rowsPerBlock = calculateRowsPerBlock(fileRowSize, height);
+
+	byte *block = (byte *) takeBuffer(bmp->buffers, rowsPerBlock * fileRowSize);
+	uint64_t *sums = (uint64_t *) takeBuffer(bmp->buffers, sumsSize);
+	if (block == NULL || sums == NULL) {
+		giveBuffer(bmp->buffers, block);
+		giveBuffer(bmp->buffers, sums);
+		return bmpError(bmp, cBimpieErrorMemory, "Out of memory.");
 	}
+	memset(sums, 0, sumsSize);
 
-	for (int row = 0; row < height; row++) {
-		for (int col = 0; col < width; col++) {
-			
-			if(fwrite(&pixelsToWrite[row][col], cSizeOfPixel, 1, bmpFileOut) != 1) {
-				ErrorExit(EXIT_FAILURE, "Error writing file 3");
-			}	
+	int status = 0, bandRows = 0;
+	for (int row = 0; row < height && status == 0; row += rowsPerBlock) {
+		int rows = height - row < rowsPerBlock ? height - row : rowsPerBlock;
+		if (fread(block, fileRowSize, rows, bmp->file) != (size_t)rows) {
+			status = bmpError(bmp, cBimpieErrorFileRead, "Pixel Error.");
+			break;
 		}
-		if(fwrite(&padding, sizeof(byte), paddingBytes, bmpFileOut) != paddingBytes) {
-				ErrorExit(EXIT_FAILURE, "Error writing padding");
+		bmp->bytesRead += rows * fileRowSize;
+
+		for (int i = 0; i < rows; i++) {
+			int r = imageRowOf(bmp, row + i);
+			accumulateThumbnailRow(sums, block + i * fileRowSize, width, size, factor);
+			bandRows++;
+
+			// The band is in once its last row in file order is: its top row, or top-down its bottom one.
+			bool last = bmp->topDown ? r % factor == 0 : r % factor == factor - 1 || r == height - 1;
+			if (last) {
+				averageThumbnailRow(image, r / factor, sums, bandRows, factor, width);
+				memset(sums, 0, sumsSize);
+				bandRows = 0;
+			}
 		}
+	}
+
+	giveBuffer(bmp->buffers, block);
+	giveBuffer(bmp->buffers, sums);
+	return status;
+}
+
+/* Reads a thumbnail of 8 or 16-bit pixels, which are palette indices or
+ * packed fields that cannot be averaged: each pixel of the thumbnail is
+ * the one in the middle of its block. Only those rows are read.
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int sampleThumbnail(tBmp *bmp, int factor, tImage *image) {
+	int height = bmp->info.height;
+	int size = image->bpp / 8;
+	size_t fileRowSize = calculateFileRowSize(bmp);
+	byte *fileRow = (byte *) takeBuffer(bmp->buffers, fileRowSize);
+	if (fileRow == NULL) {
+		return bmpError(bmp, cBimpieErrorMemory, "Out of memory.");
+	}
+
+	int status = 0;
+	for (int r = 0; r < image->height; r++) {
+		int middle = r * factor + factor / 2 < height ? r * factor + factor / 2 : height - 1;
+		if (!readAt(fileno(bmp->file), fileRow, fileRowSize,
+				bmp->header.pixelOffset + (off_t)imageRowOf(bmp, middle) * fileRowSize)) {
+			status = bmpError(bmp, cBimpieErrorFileRead, "Pixel Error.");
+			break;
+		}
+		bmp->bytesRead += fileRowSize;
+
+		byte *to = (byte *)imageRow(image, r);
+		for (int j = 0; j < image->width; j++, to += size) {
+			int col = j * factor + factor / 2 < bmp->info.width ? j * factor + factor / 2 : bmp->info.width - 1;
+			memcpy(to, fileRow + (size_t)col * size, size);
+		}
+	}
+
+	giveBuffer(bmp->buffers, fileRow);
+	return status;
+}
+
+/* Reads the image shrunk by factor on each side, without ever holding it
+ * at full size: 24 and 32-bit pixels are averaged over each block of
+ * factor x factor pixels as the rows stream past, 8 and 16-bit ones are
+ * sampled. Memory is the thumbnail, one I/O block and a row of sums for
+ * one thumbnail row.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int readBmpThumbnail(tBmp *bmp, int factor, tImage **imageRead) {
+	tImage *image = createImage(shrunkSize(bmp->info.width, factor), shrunkSize(bmp->info.height, factor),
+		bmp->info.bitsPerPixel, bmp->buffers);
+	if (image == NULL) {
+		closeBmp(bmp);
+		return bmpError(bmp, cBimpieErrorMemory, "Out of memory.");
+	}
+
+	int status = bmp->info.bitsPerPixel >= 24 ? averageThumbnail(bmp, factor, image) :
+		sampleThumbnail(bmp, factor, image);
+	closeBmp(bmp);
+	if (status != 0) {
+		freeImage(image);
+		return status;
+	}
+
+	*imageRead = image;
+	return 0;
+}
+
+/* Creates the temporary file that replaces fileName once the output of
+ * bmp is closed, size bytes long. The bytes are not written yet, so they
+ * take no disk space and read as zero until they are. The file is created
+ * with mode 0666 less the umask, as fopen() would, by a name no other
+ * file has, rather than by mkstemp(), whose mode 0600 could only be
+ * widened by reading the umask, which changes it for every thread. If
+ * fileName is there already, the file gets its mode, and its owner and
+ * group where that is allowed, so that replacing it does not widen who
+ * can read it. Its other hard links still name the old file.
+ * Returns: the file descriptor, or -1 if the file cannot be created
+ */
+
+static int createOutputFile(tBmp *bmp, char *fileName, size_t size) {
+	static unsigned long count;
+	bmp->outName = fileName;
+	int fd = -1;
+	for (int tries = 0; fd < 0 && tries < 100; tries++) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		unsigned long n = __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+		snprintf(bmp->outTemp, sizeof(bmp->outTemp), "%s.%ld.%lx", fileName, (long)getpid(),
+			n * 2654435761u ^ (unsigned long)now.tv_nsec);
+		fd = open(bmp->outTemp, O_RDWR | O_CREAT | O_EXCL, 0666);
+		if (fd < 0 && errno != EEXIST) {
+			return -1;
+		}
+	}
+	if (fd < 0) {
+		return -1;
+	}
+
+	// The owner goes first, as changing it clears the set-user-ID bit of the mode.
+	struct stat old;
+	if (stat(fileName, &old) == 0 && S_ISREG(old.st_mode)) {
+		if (fchown(fd, old.st_uid, old.st_gid) != 0 && fchown(fd, -1, old.st_gid) != 0) {
+			old.st_mode &= ~(S_ISUID | S_ISGID);
+		}
+		fchmod(fd, old.st_mode & 07777);
+	}
+
+	if (ftruncate(fd, size) != 0) {
+		close(fd);
+		unlink(bmp->outTemp);
+		return -1;
+	}
+	return fd;
+}
+
+/* Writes the processed bmp file, top-down if bmp->topDown is set, to a
+ * temporary file that is only renamed over fileName once it is whole, so
+ * fileName may be the input
+ * @params: fileName - name of file to be written
+ * 			imageToWrite - the processed image
+ * Returns: 0 or a cBimpieError code
+ */
+
+int writeBmp(tBmp *bmp, char *fileName, tImage *imageToWrite) {
+	int height = imageToWrite->height;
+	size_t fileRowSize;
+	setBmpLayout(bmp, imageToWrite->width, height, &fileRowSize);
+	size_t rowSize = fileRowSize - bmp->paddingBytes;
+	int rowsPerBlock = calculateRowsPerBlock(fileRowSize, height);
+
+	byte *block = (byte *) takeBuffer(bmp->buffers, rowsPerBlock * fileRowSize);
+	if (block == NULL) {
+		return bmpError(bmp, cBimpieErrorMemory, "Out of memory.");
+	}
+
+	// Zero the block once so the padding at the end of each row is zero.
+	memset(block, 0, rowsPerBlock * fileRowSize);
+
+	int fd = createOutputFile(bmp, fileName, 0);
+	FILE *bmpFileOut = fd < 0 ? NULL : fdopen(fd, "wb");
+	if(bmpFileOut == NULL) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(bmp->outTemp);
+		}
+		giveBuffer(bmp->buffers, block);
+		return bmpError(bmp, cBimpieErrorFileOpen, "The file could not be opened.");
+	}
+	byte bufferHeader[cBmpHeaderSize + cBmpInfoHeaderSize];
+	packBmpHeaders(bmp, bufferHeader);
+
+	int status = 0;
+	if(fwrite(bufferHeader, sizeof(bufferHeader), 1, bmpFileOut) != 1 ||
+			!writeKeptBytes(bmpFileOut, bmp->extraHeader, bmp->extraHeaderSize)) {
+		status = bmpError(bmp, cBimpieErrorFileWrite, "Error writing file 1");
+	} else {
+		bmp->bytesWritten += bmp->header.pixelOffset;
+	}
+
+	for (int row = 0; row < height && status == 0; row += rowsPerBlock) {
+		int rows = height - row < rowsPerBlock ? height - row : rowsPerBlock;
+
+		byte *fileRow = block;
+		for (int i = 0; i < rows; i++, fileRow += fileRowSize) {
+			memcpy(fileRow, imageRow(imageToWrite, imageRowOf(bmp, row + i)), rowSize);
+		}
+
+		if(fwrite(block, fileRowSize, rows, bmpFileOut) != (size_t)rows) {
+			status = bmpError(bmp, cBimpieErrorFileWrite, "Error writing file 3");
+		}
+		bmp->bytesWritten += rows * fileRowSize;
  	}
 
- 	freePixels(pixelsToWrite);
+	if (status == 0) {
+		if (!writeKeptBytes(bmpFileOut, bmp->trailer, bmp->trailerSize)) {
+			status = bmpError(bmp, cBimpieErrorFileWrite, "Error writing file 3");
+		}
+		bmp->bytesWritten += bmp->trailerSize;
+	}
 
- 	fclose(bmpFileOut);
- 	
+ 	giveBuffer(bmp->buffers, block);
+
+ 	if (fclose(bmpFileOut) != 0 && status == 0) {
+ 		status = bmpError(bmp, cBimpieErrorFileWrite, "Error writing file 3");
+ 	}
+	if (status == 0 && rename(bmp->outTemp, bmp->outName) != 0) {
+		status = bmpError(bmp, cBimpieErrorFileWrite, "Error writing file 3");
+	}
+	if (status != 0) {
+		unlink(bmp->outTemp);
+	}
+ 	return status;
 }	
 
+/* Maps the file opened by readBmpHeaders() and returns a read-only view
+ * of its pixel rows, located with the header's pixelOffset. No pixels are
+ * copied; rows are paged in as the transforms touch them.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int mapBmpPixels(tBmp *bmp, tImage **imageMapped) {
+	size_t fileRowSize = calculateFileRowSize(bmp);
+
+	tImage *image = (tImage *) takeBuffer(bmp->buffers, sizeof(tImage));
+	if (image == NULL) {
+		return bmpError(bmp, cBimpieErrorMemory, "Out of memory.");
+	}
+	image->buffers = bmp->buffers;
+
+	image->mappingSize = bmp->header.pixelOffset + fileRowSize * (size_t)bmp->info.height;
+	image->mapping = mmap(NULL, image->mappingSize, PROT_READ, MAP_PRIVATE, fileno(bmp->file), 0);
+	closeBmp(bmp);
+	if (image->mapping == MAP_FAILED) {
+		giveBuffer(bmp->buffers, image);
+		return bmpError(bmp, cBimpieErrorFileRead, "The file could not be mapped.");
+	}
+
+	bmp->bytesRead += fileRowSize * bmp->info.height;
+	image->width = bmp->info.width;
+	image->height = bmp->info.height;
+	image->bpp = bmp->info.bitsPerPixel;
+	setFileRows(bmp, image, (byte *) image->mapping + bmp->header.pixelOffset, fileRowSize);
+
+	*imageMapped = image;
+	return 0;
+}
+
+/* Creates the output file at its final size, top-down if bmp->topDown is
+ * set, maps it and writes the headers into the mapping. The transforms
+ * then write their pixels straight into the returned view; the padding
+ * bytes are already zero.
+ * @params: fileName - name of file to be written
+ * 			width - width of the output image
+ * 			height - height of the output image
+ * 			imageMapped - receives a writable view of the output pixel rows
+ * Returns: 0 or a cBimpieError code
+ */
+
+int mapBmpOutput(tBmp *bmp, char *fileName, int width, int height, tImage **imageMapped) {
+	size_t fileRowSize;
+	size_t fileSize = setBmpLayout(bmp, width, height, &fileRowSize);
+
+	tImage *image = (tImage *) takeBuffer(bmp->buffers, sizeof(tImage));
+	if (image == NULL) {
+		return bmpError(bmp, cBimpieErrorMemory, "Out of memory.");
+	}
+	image->buffers = bmp->buffers;
+
+	int fd = createOutputFile(bmp, fileName, fileSize);
+	if (fd < 0) {
+		giveBuffer(bmp->buffers, image);
+		return bmpError(bmp, cBimpieErrorFileOpen, "The file could not be opened.");
+	}
+
+	image->mappingSize = fileSize;
+	image->mapping = mmap(NULL, image->mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (image->mapping == MAP_FAILED) {
+		giveBuffer(bmp->buffers, image);
+		unlink(bmp->outTemp);
+		return bmpError(bmp, cBimpieErrorFileWrite, "The file could not be mapped.");
+	}
+
+	packBmpHeaders(bmp, (byte *) image->mapping);
+	if (bmp->extraHeaderSize > 0) {
+		memcpy((byte *) image->mapping + cBmpHeaderSize + cBmpInfoHeaderSize, bmp->extraHeader, bmp->extraHeaderSize);
+	}
+	if (bmp->trailerSize > 0) {
+		memcpy((byte *) image->mapping + fileSize - bmp->trailerSize, bmp->trailer, bmp->trailerSize);
+	}
+	bmp->bytesWritten += image->mappingSize;
+
+	image->width = width;
+	image->height = height;
+	image->bpp = bmp->info.bitsPerPixel;
+	setFileRows(bmp, image, (byte *) image->mapping + bmp->header.pixelOffset, fileRowSize);
+
+	*imageMapped = image;
+	return 0;
+}
+
+/* Starts out, the output of in, as a file of its own, so that its rows
+ * can be written with writeBmpRows() while those of in are still being
+ * read with readBmpRows(). out gets copies of the header bytes in keeps,
+ * so it is released with freeBmp() whether or not this succeeds.
+ * @params: out - a zeroed tBmp, receives the output
+ *			fileName - name of file to be written; it is only replaced by
+ *			closeBmpOutput()
+ *			width - width of the output image
+ *			height - height of the output image
+ *			topDown - whether the output file stores its top row first
+ * Returns: 0 or a cBimpieError code
+ */
+
+int openBmpOutput(tBmp *out, const tBmp *in, char *fileName, int width, int height, bool topDown) {
+	out->header = in->header;
+	out->info = in->info;
+	out->topDown = topDown;
+	out->profileOffset = in->profileOffset;
+	out->buffers = in->buffers;
+	out->outFd = -1;
+
+	if ((in->extraHeaderSize > 0 && (out->extraHeader = (byte *) takeBuffer(out->buffers, in->extraHeaderSize)) == NULL) ||
+			(in->trailerSize > 0 && (out->trailer = (byte *) takeBuffer(out->buffers, in->trailerSize)) == NULL)) {
+		return bmpError(out, cBimpieErrorMemory, "Out of memory.");
+	}
+	out->extraHeaderSize = in->extraHeaderSize;
+	out->trailerSize = in->trailerSize;
+	if (out->extraHeaderSize > 0) memcpy(out->extraHeader, in->extraHeader, out->extraHeaderSize);
+	if (out->trailerSize > 0) memcpy(out->trailer, in->trailer, out->trailerSize);
+
+	size_t fileRowSize;
+	size_t fileSize = setBmpLayout(out, width, height, &fileRowSize);
+	if ((out->outFd = createOutputFile(out, fileName, fileSize)) < 0) {
+		return bmpError(out, cBimpieErrorFileOpen, "The file could not be opened.");
+	}
+
+	byte bufferHeader[cBmpHeaderSize + cBmpInfoHeaderSize];
+	packBmpHeaders(out, bufferHeader);
+	if (!writeAt(out->outFd, bufferHeader, sizeof(bufferHeader), 0) ||
+			!writeAt(out->outFd, out->extraHeader, out->extraHeaderSize, sizeof(bufferHeader)) ||
+			!writeAt(out->outFd, out->trailer, out->trailerSize, fileSize - out->trailerSize)) {
+		discardBmpOutput(out);
+		return bmpError(out, cBimpieErrorFileWrite, "Error writing file 1");
+	}
+	out->bytesWritten += out->header.pixelOffset + out->trailerSize;
+	return 0;
+}
+
+/* Creates an image for up to rows pixel rows of bmp laid out as they are
+ * in its file, padding included, so that readBmpRows() and writeBmpRows()
+ * move them with one call. The padding bytes are zero.
+ * Returns: the image, rows tall, or NULL if out of memory
+ */
+
+tImage *createBmpRows(tBmp *bmp, int rows) {
+	size_t fileRowSize = calculateFileRowSize(bmp);
+	tImage *image = (tImage *) takeBuffer(bmp->buffers, sizeof(tImage));
+	byte *pixels = (byte *) takeBuffer(bmp->buffers, rows * fileRowSize);
+	if (image == NULL || pixels == NULL) {
+		giveBuffer(bmp->buffers, image);
+		giveBuffer(bmp->buffers, pixels);
+		return NULL;
+	}
+	memset(pixels, 0, rows * fileRowSize);
+
+	image->width = bmp->info.width;
+	image->height = rows;
+	image->bpp = bmp->info.bitsPerPixel;
+	image->mapping = NULL;
+	image->mappingSize = 0;
+	image->buffers = bmp->buffers;
+	setFileRows(bmp, image, pixels, fileRowSize);
+	return image;
+}
+
+/* Makes an image from createBmpRows() hold rows rows, no more than it was
+ * created with, still laid out as in the file of bmp
+ */
+
+void setBmpRowCount(tBmp *bmp, tImage *image, int rows) {
+	byte *firstRow = fileRowsStart(image);
+	image->height = rows;
+	setFileRows(bmp, image, firstRow, calculateFileRowSize(bmp));
+}
+
+/* Reads image rows row to row+rows-1 of the input of bmp into image, an
+ * image from createBmpRows(). They are read from where they lie in the
+ * file, so rows may be read in any order, and again.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int readBmpRows(tBmp *bmp, int row, int rows, tImage *image) {
+	size_t fileRowSize = calculateFileRowSize(bmp);
+	setBmpRowCount(bmp, image, rows);
+
+	// A top-down file stores the same rows the other way round, ending where bottom-up ones start.
+	int fileRow = bmp->topDown ? bmp->info.height - row - rows : row;
+	if (!readAt(fileno(bmp->file), fileRowsStart(image), rows * fileRowSize,
+			bmp->header.pixelOffset + (off_t)fileRow * fileRowSize)) {
+		return bmpError(bmp, cBimpieErrorFileRead, "Pixel Error.");
+	}
+	bmp->bytesRead += rows * fileRowSize;
+	return 0;
+}
+
+/* Writes image, an image from createBmpRows(), as image rows row to
+ * row+image->height-1 of the output opened by openBmpOutput(). The rows
+ * may be written in any order.
+ * Returns: 0 or a cBimpieError code
+ */
+
+int writeBmpRows(tBmp *bmp, int row, tImage *image) {
+	size_t fileRowSize = calculateFileRowSize(bmp);
+	int rows = image->height;
+
+	int fileRow = bmp->topDown ? bmp->info.height - row - rows : row;
+	if (!writeAt(bmp->outFd, fileRowsStart(image), rows * fileRowSize,
+			bmp->header.pixelOffset + (off_t)fileRow * fileRowSize)) {
+		return bmpError(bmp, cBimpieErrorFileWrite, "Error writing file 3");
+	}
+	bmp->bytesWritten += rows * fileRowSize;
+	return 0;
+}
+
+/* Finishes the output created by mapBmpOutput() or openBmpOutput() and
+ * moves it into place
+ * @params: image - the view returned by mapBmpOutput(), or NULL after
+ *			openBmpOutput()
+ * Returns: 0 or a cBimpieError code
+ */
+
+int closeBmpOutput(tBmp *bmp, tImage *image) {
+	int status;
+	if (image) {
+		status = munmap(image->mapping, image->mappingSize);
+		giveBuffer(image->buffers, image);
+	} else {
+		status = close(bmp->outFd);
+		bmp->outFd = -1;
+	}
+
+	if (status != 0 || rename(bmp->outTemp, bmp->outName) != 0) {
+		unlink(bmp->outTemp);
+		return bmpError(bmp, cBimpieErrorFileWrite, "Error writing file 3");
+	}
+	return 0;
+}
+
+/* Abandons the output started by openBmpOutput(), removing the file
+ */
+
+void discardBmpOutput(tBmp *bmp) {
+	if (bmp->outFd >= 0) {
+		close(bmp->outFd);
+		bmp->outFd = -1;
+	}
+	unlink(bmp->outTemp);
+}
+
+/* Closes the input file of bmp if it is still open
+ */
+
+void closeBmp(tBmp *bmp) {
+	if (bmp->file) {
+		fclose(bmp->file);
+		bmp->file = NULL;
+	}
+}
+
+/* Closes the input file of bmp if it is still open and gives back the
+ * header bytes kept for writing it
+ */
+
+void freeBmp(tBmp *bmp) {
+	closeBmp(bmp);
+	giveBuffer(bmp->buffers, bmp->extraHeader);
+	giveBuffer(bmp->buffers, bmp->trailer);
+	bmp->extraHeader = NULL;
+	bmp->trailer = NULL;
+	bmp->extraHeaderSize = 0;
+	bmp->trailerSize = 0;
+}
@@ -5,6 +5,9 @@
 #include <stdio.h>    // For printf()
 #include <stdlib.h>   // For exit(), strtod()
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "Pool.h"
 
 //==============================================================================================================
 // TYPE DEFINITIONS
@@ -15,10 +18,10 @@ typedef uint8_t byte;
 typedef struct {
 	char 	signature_B;
 	char 	signature_M;
-	int32_t fileSize;
+	uint32_t fileSize;			// 0 past 4 GB
 	int16_t reserved1;
 	int16_t reserved2;
-	int32_t pixelOffset;
+	uint32_t pixelOffset;
 } tBmpHeader;
 
 typedef struct {
@@ -27,9 +30,28 @@ typedef struct {
 	int32_t height;
 	int16_t bitPlanes;
 	int16_t bitsPerPixel;
-	byte 	zeros[24];
+	int32_t compression;		// cBmpRgb, or cBmpBitfields or cBmpAlphaBitfields with color masks
+	uint32_t imageSize;			// Bytes of pixel rows, padding included, 0 past 4 GB
+	int32_t xPixelsPerMeter;
+	int32_t yPixelsPerMeter;
+	int32_t colorsUsed;			// Palette entries of an 8-bit image, 0 for all 256
+	int32_t colorsImportant;
 } tBmpInfoHeader;
 
+// The compression values bimpie reads: plain pixels, and 16 or 32-bit pixels described by color masks.
+#define cBmpRgb				0
+#define cBmpBitfields		3
+#define cBmpAlphaBitfields	6
+
+/* The info header sizes bimpie reads: BITMAPINFOHEADER, the two Adobe
+ * versions with color masks, BITMAPV4HEADER and BITMAPV5HEADER. They all
+ * start with the 40 bytes of tBmpInfoHeader.
+ */
+#define cBmpInfoHeaderV1	40
+#define cBmpInfoHeaderV2	52
+#define cBmpInfoHeaderV3	56
+#define cBmpInfoHeaderV4	108
+#define cBmpInfoHeaderV5	124
 
 typedef struct {
     byte blue;
@@ -37,13 +59,89 @@ typedef struct {
     byte red;
 } tPixel;
 
-tBmpHeader bmpHeader;
-tBmpInfoHeader bmpInfoHeader;
+/* The other pixel sizes. They are only ever moved, never looked into, so
+ * they are kept as the bytes of the file: a palette index, a 16-bit word
+ * with its 5-5-5 or 5-6-5 fields, or BGRA. Like tPixel they may sit at any
+ * address.
+ */
+typedef byte tPixel8;
+typedef struct { byte bytes[2]; } tPixel16;
+typedef struct { byte bytes[4]; } tPixel32;
+
+/* An image is one contiguous, 64-byte aligned block of pixels. Row r starts
+ * stride bytes after row r-1; stride is a multiple of 64 so every row is
+ * aligned too. Row 0 is the bottom row, whichever way up the file is. An
+ * image can also be a view of the pixel rows of a mapped BMP file, in which
+ * case stride is the padded row size in the file. A negative stride walks
+ * the rows from the end of the block: that is how a top-down file is
+ * mapped, and how an image is flipped vertically without moving a pixel.
+ */
+typedef struct {
+	byte   *pixels;		// First byte of row 0
+	int		width;		// Width in pixels
+	int		height;		// Height in pixels
+	int		bpp;		// Bits per pixel
+	ptrdiff_t stride;	// Bytes from the start of one row to the start of the next
+	void   *mapping;	// Start of the file mapping the pixels live in, NULL if allocated
+	size_t	mappingSize;	// Length of that mapping in bytes
+	tBufferPool *buffers;	// Where the image and its scratch buffers come from, NULL for the heap
+} tImage;
+
+// A rectangle of pixels, its columns counted from the left and its rows from the bottom, like those of a tImage.
+typedef struct {
+	int		col;
+	int		row;
+	int		width;
+	int		height;
+} tRegion;
+
+/* Everything known about one BMP file while it is read or written. Each
+ * file gets its own, so several files can be processed at once. When a
+ * function fails it returns one of the cBimpieError codes and leaves a message
+ * in error. The header bytes bimpie does not need are kept as they are and
+ * written back, so only the sizes in the headers ever change. A tBmp
+ * starts out zeroed and is released with freeBmp().
+ */
+typedef struct {
+	tBmpHeader		header;
+	tBmpInfoHeader	info;
+	int				paddingBytes;
+	bool			topDown;		// The file's first row is the top one: its height is stored negated
+	byte		   *extraHeader;	// Everything between tBmpInfoHeader and the pixels: the rest of a
+	size_t			extraHeaderSize;// V4 or V5 header, color masks, the palette, an ICC profile or a gap
+	byte		   *trailer;		// An ICC profile stored after the pixels,
+	size_t			trailerSize;	// and anything between the pixels and it
+	long			profileOffset;	// Where the profile starts in the trailer, -1 if it is not there
+	FILE		   *file;			// The input file between readBmpHeaders() and reading the pixels
+	char		   *outName;		// Every output is built in outTemp, which replaces
+	char			outTemp[4096];	// outName when it is closed, so the input may be the output
+	int				outFd;			// The output between openBmpOutput() and closeBmpOutput()
+	char			error[1024];
+	tBufferPool	   *buffers;		// Where images and I/O blocks come from, NULL for the heap
+	size_t			bytesRead;		// File bytes read so far, counting mapped pixels once mapped
+	size_t			bytesWritten;	// File bytes written so far, likewise
+} tBmp;
 
 /***********************
 * Function Declerations
 ***********************/
-void readBmpHeaders(char *fileName);
-tPixel **readBmpPixels();
-void writeBmp(char *fileName, tPixel **);
+int readBmpHeaders(tBmp *, char *fileName);
+int readBmpPixels(tBmp *, tImage **);
+int readBmpRegion(tBmp *, tRegion, tImage **);
+int readBmpThumbnail(tBmp *, int factor, tImage **);
+int writeBmp(tBmp *, char *fileName, tImage *);
+int mapBmpPixels(tBmp *, tImage **);
+int mapBmpOutput(tBmp *, char *fileName, int width, int height, tImage **);
+int openBmpOutput(tBmp *out, const tBmp *in, char *fileName, int width, int height, bool topDown);
+tImage *createBmpRows(tBmp *, int rows);
+void setBmpRowCount(tBmp *, tImage *, int rows);
+int readBmpRows(tBmp *, int row, int rows, tImage *);
+int writeBmpRows(tBmp *, int row, tImage *);
+int closeBmpOutput(tBmp *, tImage *);
+void discardBmpOutput(tBmp *);
+size_t calculateFileRowSize(tBmp *);
+bool readAt(int fd, void *buffer, size_t size, off_t offset);
+bool writeAt(int fd, const void *buffer, size_t size, off_t offset);
+void closeBmp(tBmp *);
+void freeBmp(tBmp *);
 #endif
\ No newline at end of file
@@ -0,0 +1,281 @@
+/***************************************************************************************************************
+ * FILE: Client.c
+ *
+ * DESCRIPTION
+ * bimpie-client - Sends transform jobs to a bimpie --serve server and prints the replies, or, with more than one
+ * job, runs them as a load test and reports the throughput and the latency percentiles.
+ *
+ * Usage: bimpie-client [-n jobs] [-c connections] [--fd] socket ops input [output]
+ *
+ *     -n jobs          Sends the job jobs times (default 1).
+ *     -c connections   Over connections connections at once, each sending its next job as soon as the reply to
+ *                      the last one is in (default 1).
+ *     --fd             Opens input and sends it as a file descriptor instead of by name.
+ *
+ * ops are the operations as in a job, e.g., "rotr 1 fliph" or "-" for none. output defaults to input; a %n in it
+ * is replaced by the job number, so that concurrent jobs write different files, e.g., /tmp/out-%n.bmp.
+ *
+ * A single job prints its reply: ok or the error, the time it took on the server and the time of each stage. A
+ * load test prints the jobs per second and the round trip latency of the jobs, as seen by the client, at the
+ * 50th, 90th, 99th percentile and the worst, along with the mean time they took on the server. The exit status
+ * is 1 if any job failed.
+ **************************************************************************************************************/
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Main.h"
+#include "Serve.h"
+#include "String.h"
+
+//==============================================================================================================
+// CONSTANT DEFINITIONS
+//==============================================================================================================
+
+const char *cBinary = "bimpie-client";
+
+//==============================================================================================================
+// TYPE DEFINITIONS
+//==============================================================================================================
+
+// What the connections of a load test share.
+typedef struct {
+	char		   *socketFile;
+	char		   *ops;
+	char		   *input;
+	char		   *output;		// The output file name, with %n for the job number
+	int				passFd;		// --fd
+	int				jobs;		// The number of jobs to send in all
+	int				nextJob;	// The number of the next job to send, taken atomically
+	double		   *latency;	// The round trip of each job in seconds
+	long		   *serverMicros;	// The time each job took on the server
+	tJobReply		firstReply;		// The reply to job 0
+	int				failures;
+	tJobReply		firstFailure;
+	pthread_mutex_t	lock;		// Guards failures and firstFailure
+} tLoad;
+
+//==============================================================================================================
+// FUNCTION DEFINITIONS
+//==============================================================================================================
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Now()
+ *
+ * DESCRIPTION
+ * Returns the monotonic clock in seconds.
+ *------------------------------------------------------------------------------------------------------------*/
+static double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Usage()
+ *
+ * DESCRIPTION
+ * Prints how to run the client and exits.
+ *------------------------------------------------------------------------------------------------------------*/
+static void Usage()
+{
+	fprintf(stderr, "Usage: %s [-n jobs] [-c connections] [--fd] socket ops input [output]\n", cBinary);
+	exit(2);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MakeOutput()
+ *
+ * DESCRIPTION
+ * Builds the output file name of job pJob from pTemplate, replacing %n with the job number.
+ *------------------------------------------------------------------------------------------------------------*/
+static void MakeOutput(char *pTemplate, int pJob, char *pOutput, size_t pSize)
+{
+	size_t len = 0;
+	pOutput[0] = '\0';
+	for (char *t = pTemplate; *t && len + 1 < pSize; t++) {
+		if (*t == '%' && t[1] == 'n') {
+			len += snprintf(pOutput + len, pSize - len, "%d", pJob);
+			t++;
+		} else {
+			pOutput[len++] = *t;
+			pOutput[len] = '\0';
+		}
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RunJob()
+ *
+ * DESCRIPTION
+ * Sends job number pJob of pLoad on the connection pFd and waits for its reply.
+ *
+ * RETURNS
+ * 0, or -1 if the connection failed, in which case pReply says so.
+ *------------------------------------------------------------------------------------------------------------*/
+static int RunJob(tLoad *pLoad, int pFd, int pJob, tJobReply *pReply)
+{
+	char output[4096];
+	MakeOutput(pLoad->output, pJob, output, sizeof(output));
+
+	int inputFd = -1;
+	if (pLoad->passFd && (inputFd = open(pLoad->input, O_RDONLY)) < 0) {
+		pReply->status = -1;
+		snprintf(pReply->message, sizeof(pReply->message), "%s: cannot open the input", pLoad->input);
+		return 0;
+	}
+	int result = sendJob(pFd, pLoad->ops, pLoad->input, inputFd, output);
+	if (inputFd >= 0) close(inputFd);
+	if (result != 0 || readReply(pFd, pReply) != 0) {
+		pReply->status = -1;
+		snprintf(pReply->message, sizeof(pReply->message), "the connection to the server failed");
+		return -1;
+	}
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RunConnection()
+ *
+ * DESCRIPTION
+ * The thread of one connection of a load test. Takes the next job number and runs that job until they have all
+ * been sent, or the connection fails.
+ *------------------------------------------------------------------------------------------------------------*/
+static void *RunConnection(void *pArg)
+{
+	tLoad *load = (tLoad *) pArg;
+	tJobReply reply;
+	int fd = connectSocket(load->socketFile);
+
+	for (;;) {
+		int job = __atomic_fetch_add(&load->nextJob, 1, __ATOMIC_RELAXED);
+		if (job >= load->jobs) break;
+
+		double start = Now();
+		int result = fd < 0 ? -1 : RunJob(load, fd, job, &reply);
+		load->latency[job] = Now() - start;
+		load->serverMicros[job] = result == 0 ? reply.micros : 0;
+		if (fd < 0) {
+			reply.status = -1;
+			snprintf(reply.message, sizeof(reply.message), "%s: cannot connect to the server", load->socketFile);
+		}
+		if (job == 0) load->firstReply = reply;
+
+		if (reply.status != 0) {
+			pthread_mutex_lock(&load->lock);
+			if (load->failures++ == 0) load->firstFailure = reply;
+			pthread_mutex_unlock(&load->lock);
+		}
+		if (result != 0) break;
+	}
+
+	if (fd >= 0) close(fd);
+	return NULL;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: CompareDoubles()
+ *
+ * DESCRIPTION
+ * Orders doubles for qsort().
+ *------------------------------------------------------------------------------------------------------------*/
+static int CompareDoubles(const void *pA, const void *pB)
+{
+	double a = *(const double *) pA, b = *(const double *) pB;
+	return a < b ? -1 : a > b;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Percentile()
+ *
+ * DESCRIPTION
+ * Returns the pPercent percentile of the pCount sorted values pSorted, by the nearest rank.
+ *------------------------------------------------------------------------------------------------------------*/
+static double Percentile(double *pSorted, int pCount, double pPercent)
+{
+	int rank = (int)(pPercent / 100 * pCount + 0.999999);
+	return pSorted[rank < 1 ? 0 : rank > pCount ? pCount - 1 : rank - 1];
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: main()
+ *
+ * DESCRIPTION
+ * Scans the command line, runs the jobs on their connections and reports them.
+ *------------------------------------------------------------------------------------------------------------*/
+int main(int pArgc, char *pArgv[])
+{
+	tLoad load;
+	int connections = 1;
+	memset(&load, 0, sizeof(load));
+	load.jobs = 1;
+
+	int i;
+	for (i = 1; i < pArgc && pArgv[i][0] == '-' && pArgv[i][1] != '\0'; i++) {
+		if (streq(pArgv[i], "--fd")) {
+			load.passFd = 1;
+		} else if (streq(pArgv[i], "-n") && i + 1 < pArgc) {
+			load.jobs = atoi(pArgv[++i]);
+		} else if (streq(pArgv[i], "-c") && i + 1 < pArgc) {
+			connections = atoi(pArgv[++i]);
+		} else {
+			Usage();
+		}
+	}
+	if (pArgc - i < 3 || pArgc - i > 4 || load.jobs < 1 || connections < 1) Usage();
+	load.socketFile = pArgv[i];
+	load.ops = pArgv[i + 1];
+	load.input = pArgv[i + 2];
+	load.output = pArgc - i == 4 ? pArgv[i + 3] : "";
+	if (connections > load.jobs) connections = load.jobs;
+
+	load.latency = (double *) calloc(load.jobs, sizeof(double));
+	load.serverMicros = (long *) calloc(load.jobs, sizeof(long));
+	pthread_t *threads = (pthread_t *) calloc(connections, sizeof(pthread_t));
+	if (!load.latency || !load.serverMicros || !threads) {
+		fprintf(stderr, "%s: out of memory\n", cBinary);
+		return 1;
+	}
+	pthread_mutex_init(&load.lock, NULL);
+
+	double start = Now();
+	int started = 0;
+	for (; started < connections; started++) {
+		if (pthread_create(&threads[started], NULL, RunConnection, &load) != 0) break;
+	}
+	if (started == 0) RunConnection(&load);
+	for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+	double wall = Now() - start;
+
+	// A single job is reported as it came back.
+	int sent = load.nextJob < load.jobs ? load.nextJob : load.jobs;
+	if (load.jobs == 1) {
+		if (load.failures) {
+			printf("%s (status %d)\n", load.firstFailure.message, load.firstFailure.status);
+		} else {
+			printf("ok in %.3f ms on the server, %.3f ms round trip: %s\n", load.serverMicros[0] / 1e3,
+				load.latency[0] * 1e3, load.firstReply.stages);
+		}
+	} else {
+		double serverTime = 0;
+		for (int j = 0; j < sent; j++) serverTime += load.serverMicros[j] / 1e6;
+		qsort(load.latency, sent, sizeof(double), CompareDoubles);
+		printf("%d jobs over %d connection%s in %.3f s: %.1f jobs/s, %d failed\n", sent, connections,
+			connections == 1 ? "" : "s", wall, sent / wall, load.failures);
+		printf("latency ms: p50 %.3f  p90 %.3f  p99 %.3f  max %.3f  (server mean %.3f)\n",
+			Percentile(load.latency, sent, 50) * 1e3, Percentile(load.latency, sent, 90) * 1e3,
+			Percentile(load.latency, sent, 99) * 1e3, load.latency[sent - 1] * 1e3, serverTime / sent * 1e3);
+		if (load.failures) printf("first failure: %s (status %d)\n", load.firstFailure.message,
+			load.firstFailure.status);
+	}
+
+	pthread_mutex_destroy(&load.lock);
+	free(threads);
+	free(load.latency);
+	free(load.serverMicros);
+	return load.failures ? 1 : 0;
+}
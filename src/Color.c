@@ -0,0 +1,149 @@
+#include <math.h>
+#include "Color.h"
+#include "Simd.h"
+#include "String.h"
+
+/* starts color with no operations
+ */
+
+void colorIdentity(tColor *color) {
+	color->stageCount = 0;
+}
+
+/* Returns: the last stage of color if it is a mix, or is not, as mix says;
+ * NULL if there is none such
+ */
+
+static tColorStage *lastStage(tColor *color, bool mix) {
+	if (color->stageCount == 0) return NULL;
+	tColorStage *stage = &color->stages[color->stageCount - 1];
+	return stage->mix == mix ? stage : NULL;
+}
+
+/* Returns: a new last stage of color, or NULL if it has cColorStages
+ */
+
+static tColorStage *addStage(tColor *color, bool mix) {
+	if (color->stageCount == cColorStages) return NULL;
+	tColorStage *stage = &color->stages[color->stageCount++];
+	stage->mix = mix;
+	return stage;
+}
+
+/* adds an operation on each channel alone after those of color: tables
+ * hold the new blue, green and red for each old value. It is folded into
+ * the tables of the last stage if that is not a mix, and the stage is
+ * dropped if they then leave every value as it is.
+ * Returns: false, with color unchanged, if it already has cColorStages
+ */
+
+bool colorAddTables(tColor *color, const byte tables[3][256]) {
+	tColorStage *stage = lastStage(color, false);
+	if (stage) {
+		for (int ch = 0; ch < 3; ch++) {
+			for (int v = 0; v < 256; v++) {
+				stage->tables[ch][v] = tables[ch][stage->tables[ch][v]];
+			}
+		}
+	} else if ((stage = addStage(color, false)) != NULL) {
+		memcpy(stage->tables, tables, sizeof(stage->tables));
+	} else {
+		return false;
+	}
+
+	for (int ch = 0; ch < 3; ch++) {
+		for (int v = 0; v < 256; v++) {
+			if (stage->tables[ch][v] != v) return true;
+		}
+	}
+	color->stageCount--;
+	return true;
+}
+
+/* sets the fixed point weights of a mix. Each row is rounded so that its
+ * weights add up to its sum rounded, the difference going to its largest
+ * weight: a gray stays the same gray under a mix whose rows add up to 1.
+ * Weights beyond what cMixBits allows are clamped.
+ */
+
+static void setMixWeights(tColorStage *stage) {
+	const double limit = (double)INT16_MAX / (1 << cMixBits);
+	for (int ch = 0; ch < 3; ch++) {
+		double sum = 0;
+		int total = 0, largest = 0;
+		for (int k = 0; k < 3; k++) {
+			double m = stage->matrix[ch][k];
+			m = m > limit ? limit : m < -limit ? -limit : m;
+			stage->weights[ch * 3 + k] = (int16_t)lround(m * (1 << cMixBits));
+			sum += m;
+			total += stage->weights[ch * 3 + k];
+			if (fabs(m) > fabs(stage->matrix[ch][largest])) largest = k;
+		}
+		long rounded = lround(sum * (1 << cMixBits));
+		long weight = stage->weights[ch * 3 + largest] + rounded - total;
+		if (weight >= INT16_MIN && weight <= INT16_MAX) stage->weights[ch * 3 + largest] = (int16_t)weight;
+	}
+}
+
+/* adds a mix of the channels after the operations of color: row ch of
+ * matrix holds the weights of the old blue, green and red in the new
+ * value of channel ch. It is multiplied into the matrix of the last stage
+ * if that is a mix, and the stage is dropped if it then leaves every color
+ * as it is.
+ * Returns: false, with color unchanged, if it already has cColorStages
+ */
+
+bool colorAddMatrix(tColor *color, const double matrix[3][3]) {
+	tColorStage *stage = lastStage(color, true);
+	if (stage) {
+		double product[3][3];
+		for (int ch = 0; ch < 3; ch++) {
+			for (int k = 0; k < 3; k++) {
+				product[ch][k] = 0;
+				for (int i = 0; i < 3; i++) product[ch][k] += matrix[ch][i] * stage->matrix[i][k];
+			}
+		}
+		memcpy(stage->matrix, product, sizeof(product));
+	} else if ((stage = addStage(color, true)) != NULL) {
+		memcpy(stage->matrix, matrix, sizeof(stage->matrix));
+	} else {
+		return false;
+	}
+	setMixWeights(stage);
+
+	for (int i = 0; i < 9; i++) {
+		if (stage->weights[i] != (i % 4 == 0 ? 1 << cMixBits : 0)) return true;
+	}
+	color->stageCount--;
+	return true;
+}
+
+/* looks the channels of the count pixels of row, of size bytes, up in the
+ * tables of stage
+ */
+
+static void lookupRow(const tColorStage *stage, byte *row, int count, int size) {
+	const byte *blue = stage->tables[0], *green = stage->tables[1], *red = stage->tables[2];
+	for (int j = 0; j < count; j++, row += size) {
+		row[0] = blue[row[0]];
+		row[1] = green[row[1]];
+		row[2] = red[row[2]];
+	}
+}
+
+/* applies the stages of color, which may be NULL, to the count pixels of
+ * row, of size bytes, 3 or 4, in place. The row is short enough to stay
+ * in L1 from one stage to the next.
+ */
+
+void colorRow(const tColor *color, byte *row, int count, int size) {
+	if (color == NULL) return;
+	for (int s = 0; s < color->stageCount; s++) {
+		const tColorStage *stage = &color->stages[s];
+		if (stage->mix) {
+			mixRow(row, count, size, stage->weights);
+		} else {
+			lookupRow(stage, row, count, size);
+		}
+	}
+}
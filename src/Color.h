@@ -0,0 +1,37 @@
+#ifndef COLOR_H
+#define COLOR_H
+#include "Bmp.h"
+
+/* Point color operations: the new color of a pixel depends on its old
+ * color alone, not on where it is, so the colors are changed in whatever
+ * pass moves the pixels anyway, a row or a tile at a time while it is in
+ * cache, and never take a pass of their own unless nothing moves. A chain
+ * of operations is folded as it is built: operations on each channel
+ * alone, such as invert, brightness, contrast and gamma, into one table of
+ * 256 values per channel, and mixes of the channels, such as grayscale,
+ * into one 3x3 matrix. A chain that goes back and forth between the two
+ * keeps a stage for each run of either, up to cColorStages. Only the
+ * blue, green and red of 24 and 32-bit pixels are changed.
+ */
+
+#define cColorStages 8
+
+typedef struct {
+	bool	mix;				// The stage mixes the channels rather than looking them up
+	byte	tables[3][256];		// The new blue, green and red for each old value of each
+	double	matrix[3][3];		// The new blue, green and red, by rows, as sums of the old ones
+	int16_t	weights[9];			// matrix in fixed point for mixRow()
+} tColorStage;
+
+typedef struct {
+	int			stageCount;		// 0 leaves the colors as they are
+	tColorStage	stages[cColorStages];
+} tColor;
+
+//function declarations
+void colorIdentity(tColor *);
+bool colorAddTables(tColor *, const byte tables[3][256]);
+bool colorAddMatrix(tColor *, const double matrix[3][3]);
+void colorRow(const tColor *, byte *row, int count, int size);
+
+#endif
@@ -0,0 +1,343 @@
+#include <math.h>
+#include "Convolve.h"
+#include "Simd.h"
+#include "String.h"
+
+// Each parallel task convolves a tile whose scratch rows, halo included, come to about cTileSize bytes. A tile
+// is at least cMinTileWidth pixels wide, so the sums run over long rows, and at least as tall as its halo.
+#define cTileSize (256 * 1024)
+#define cMinTileWidth 512
+#define cMinTileHeight 16
+
+/* The fixed point taps of one pass: tap t adds the pixel dx[t] columns
+ * and dy[t] rows away times weights[t]. A weight too big for 16 bits is
+ * split over several taps on the same pixel.
+ */
+typedef struct {
+	int			count;
+	int		   *dx;
+	int		   *dy;
+	int16_t	   *weights;
+} tTaps;
+
+/* The arguments shared by the tasks of one convolution
+ */
+typedef struct {
+	const tImage   *src;
+	tImage		   *dst;
+	int				rx;				// The radius of the kernel along the rows
+	int				ry;				// The radius of the kernel down the columns
+	bool			separable;
+	tTaps			first;			// Along the rows if separable, else the whole kernel
+	tTaps			second;			// Down the columns if separable
+	int				tileWidth;
+	int				tileHeight;
+	int				tilesAcross;
+	int				failed;			// Set when a task runs out of memory
+} tConvolveJob;
+
+/* sets the rows and columns of kernel if it is the product of a column
+ * and a row of weights that suit two passes: the row must have no weights
+ * of both signs, and is scaled to add up to 1, so the bytes between the
+ * passes lose nothing but rounding; and the magnitudes of the column must
+ * add up to no more than 1, so the second pass does not magnify that
+ * rounding. Blurs pass; edge detectors, which are cheap in one pass, go
+ * through it.
+ */
+
+static void findFactors(tConvolveKernel *kernel) {
+	int width = kernel->width, height = kernel->height;
+	const double *values = kernel->values;
+	int i0 = 0, j0 = 0;
+	double largest = 0;
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			if (fabs(values[i * width + j]) > largest) {
+				largest = fabs(values[i * width + j]);
+				i0 = i;
+				j0 = j;
+			}
+		}
+	}
+	if (largest == 0) return;
+
+	bool positive = false, negative = false;
+	double sum = 0;
+	for (int j = 0; j < width; j++) {
+		positive |= values[i0 * width + j] > 0;
+		negative |= values[i0 * width + j] < 0;
+		sum += values[i0 * width + j];
+	}
+	if (positive && negative) return;
+
+	double *rows = (double *)malloc(width * sizeof(double));
+	double *columns = (double *)malloc(height * sizeof(double));
+	if (rows == NULL || columns == NULL) {
+		free(rows);
+		free(columns);
+		return;
+	}
+	double magnitude = 0;
+	for (int j = 0; j < width; j++) rows[j] = values[i0 * width + j] / sum;
+	for (int i = 0; i < height; i++) {
+		columns[i] = values[i * width + j0] / values[i0 * width + j0] * sum;
+		magnitude += fabs(columns[i]);
+	}
+
+	bool separable = magnitude <= 1 + 1e-9;
+	for (int i = 0; i < height && separable; i++) {
+		for (int j = 0; j < width; j++) {
+			if (fabs(values[i * width + j] - columns[i] * rows[j]) > 1e-9 * largest) separable = false;
+		}
+	}
+	if (!separable) {
+		free(rows);
+		free(columns);
+		return;
+	}
+	kernel->rows = rows;
+	kernel->columns = columns;
+}
+
+/* creates a kernel of width x height values, the bottom row first, and
+ * finds out whether it is separable
+ * Returns: the kernel, or NULL if out of memory
+ */
+
+tConvolveKernel *createKernel(int width, int height, const double *values) {
+	tConvolveKernel *kernel = (tConvolveKernel *)calloc(1, sizeof(tConvolveKernel));
+	if (kernel == NULL) return NULL;
+	kernel->width = width;
+	kernel->height = height;
+	kernel->values = (double *)malloc((size_t)width * height * sizeof(double));
+	if (kernel->values == NULL) {
+		free(kernel);
+		return NULL;
+	}
+	memcpy(kernel->values, values, (size_t)width * height * sizeof(double));
+	findFactors(kernel);
+	return kernel;
+}
+
+/* makes the kernel that convolves an image the way kernel convolves the
+ * image orientation o turns it to: each weight moves to where o maps the
+ * pixel it weighs back to, so the kernel turns the other way
+ * Returns: the kernel, or NULL if out of memory
+ */
+
+tConvolveKernel *orientKernel(const tConvolveKernel *kernel, tOrient o) {
+	int width = o.transpose ? kernel->height : kernel->width;
+	int height = o.transpose ? kernel->width : kernel->height;
+	double *values = (double *)malloc((size_t)width * height * sizeof(double));
+	if (values == NULL) return NULL;
+
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			int dx = j - width / 2, dy = i - height / 2;
+			if (o.transpose) {
+				int t = dx;
+				dx = dy;
+				dy = t;
+			}
+			if (o.flipX) dx = -dx;
+			if (o.flipY) dy = -dy;
+			dx += kernel->width / 2;
+			dy += kernel->height / 2;
+			values[i * width + j] = kernel->values[dy * kernel->width + dx];
+		}
+	}
+	tConvolveKernel *oriented = createKernel(width, height, values);
+	free(values);
+	return oriented;
+}
+
+/* frees kernel; kernel may be NULL
+ */
+
+void freeKernel(tConvolveKernel *kernel) {
+	if (kernel == NULL) return;
+	free(kernel->values);
+	free(kernel->rows);
+	free(kernel->columns);
+	free(kernel);
+}
+
+/* works out the fixed point taps of width x height weights, the bottom
+ * row first, around the middle one. The weights are rounded so that they
+ * add up to their sum rounded, the difference going to the heaviest, so
+ * a kernel that adds up to 1 leaves flat areas flat; weights that round
+ * to 0 are dropped.
+ * Returns: false if out of memory
+ */
+
+static bool createTaps(tTaps *taps, const double *weights, int width, int height) {
+	int count = width * height;
+	int *fixed = (int *)malloc(count * sizeof(int));
+	if (fixed == NULL) return false;
+	double sum = 0;
+	long total = 0;
+	int heaviest = 0;
+	for (int t = 0; t < count; t++) {
+		fixed[t] = (int)lround(weights[t] * (1 << cWeightBits));
+		sum += weights[t];
+		total += fixed[t];
+		if (abs(fixed[t]) > abs(fixed[heaviest])) heaviest = t;
+	}
+	fixed[heaviest] += (int)(lround(sum * (1 << cWeightBits)) - total);
+
+	taps->count = 0;
+	for (int t = 0; t < count; t++) taps->count += (abs(fixed[t]) + INT16_MAX - 1) / INT16_MAX;
+	taps->dx = (int *)malloc((taps->count + 1) * sizeof(int));
+	taps->dy = (int *)malloc((taps->count + 1) * sizeof(int));
+	taps->weights = (int16_t *)malloc((taps->count + 1) * sizeof(int16_t));
+	if (taps->dx == NULL || taps->dy == NULL || taps->weights == NULL) {
+		free(fixed);
+		return false;
+	}
+
+	int n = 0;
+	for (int t = 0; t < count; t++) {
+		for (int left = fixed[t]; left != 0; n++) {
+			int part = left > INT16_MAX ? INT16_MAX : left < -INT16_MAX ? -INT16_MAX : left;
+			taps->dx[n] = t % width - width / 2;
+			taps->dy[n] = t / width - height / 2;
+			taps->weights[n] = (int16_t)part;
+			left -= part;
+		}
+	}
+	free(fixed);
+	return true;
+}
+
+static void freeTaps(tTaps *taps) {
+	free(taps->dx);
+	free(taps->dy);
+	free(taps->weights);
+}
+
+/* copies the count pixels of a row of width pixels, of size bytes, from
+ * pixel start on to to, the first or last pixel standing in for those
+ * before or after the row
+ */
+
+static void padRow(byte *to, const byte *from, int start, int count, int width, int size) {
+	int j = 0;
+	for (; j < count && start + j < 0; j++) memcpy(to + (size_t)j * size, from, size);
+	int inside = width - (start + j) < count - j ? width - (start + j) : count - j;
+	if (inside > 0) {
+		memcpy(to + (size_t)j * size, from + (size_t)(start + j) * size, (size_t)inside * size);
+		j += inside;
+	}
+	for (; j < count; j++) memcpy(to + (size_t)j * size, from + (size_t)(width - 1) * size, size);
+}
+
+/* convolves one tile of the image. The rows it reads, from the kernel's
+ * radius above it to its radius below, are used where they lie in src
+ * unless the halo runs past the left or right edge, when they are padded
+ * out into scratch rows first. A separable kernel then filters them along
+ * the rows into a scratch tile, which it filters down the columns into
+ * dst; others sum all the taps into dst at once. Rows past the top or
+ * bottom are the edge rows again.
+ */
+
+static void convolveTileTask(void *arg, int task) {
+	tConvolveJob *job = (tConvolveJob *)arg;
+	const tImage *src = job->src;
+	tBufferPool *buffers = src->buffers;
+	int size = src->bpp / 8, rx = job->rx, ry = job->ry;
+	int c0 = task % job->tilesAcross * job->tileWidth;
+	int r0 = task / job->tilesAcross * job->tileHeight;
+	int c1 = c0 + job->tileWidth < src->width ? c0 + job->tileWidth : src->width;
+	int r1 = r0 + job->tileHeight < src->height ? r0 + job->tileHeight : src->height;
+	int lo = r0 - ry > 0 ? r0 - ry : 0;
+	int hi = r1 + ry < src->height ? r1 + ry : src->height;
+	size_t rowSize = (size_t)(c1 - c0) * size;
+	size_t paddedSize = (size_t)(c1 - c0 + 2 * rx) * size;
+	bool pad = c0 - rx < 0 || c1 + rx > src->width;
+	int tapCount = job->first.count > job->second.count ? job->first.count : job->second.count;
+
+	byte *padded = pad ? (byte *)takeBuffer(buffers, (hi - lo) * paddedSize) : NULL;
+	byte *mid = job->separable ? (byte *)takeBuffer(buffers, (hi - lo) * rowSize) : NULL;
+	const byte **rows = (const byte **)malloc((hi - lo) * sizeof(byte *));
+	const byte **taps = (const byte **)malloc((tapCount + 1) * sizeof(byte *));
+	if ((pad && padded == NULL) || (job->separable && mid == NULL) || rows == NULL || taps == NULL) {
+		__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+	} else {
+		// rows[r - lo] is row r from column c0 - rx on.
+		for (int r = lo; r < hi; r++) {
+			const byte *from = (const byte *)imageRow(src, r);
+			if (pad) {
+				padRow(padded + (r - lo) * paddedSize, from, c0 - rx, c1 - c0 + 2 * rx, src->width, size);
+				rows[r - lo] = padded + (r - lo) * paddedSize;
+			} else {
+				rows[r - lo] = from + (size_t)(c0 - rx) * size;
+			}
+		}
+
+		const tTaps *first = &job->first;
+		if (job->separable) {
+			for (int r = lo; r < hi; r++) {
+				for (int t = 0; t < first->count; t++) taps[t] = rows[r - lo] + (size_t)(rx + first->dx[t]) * size;
+				resampleColumns(mid + (r - lo) * rowSize, taps, first->weights, first->count, rowSize);
+			}
+		}
+		for (int r = r0; r < r1; r++) {
+			const tTaps *pass = job->separable ? &job->second : first;
+			for (int t = 0; t < pass->count; t++) {
+				int from = r + pass->dy[t] < lo ? lo : r + pass->dy[t] >= hi ? hi - 1 : r + pass->dy[t];
+				taps[t] = job->separable ? mid + (from - lo) * rowSize :
+					rows[from - lo] + (size_t)(rx + pass->dx[t]) * size;
+			}
+			resampleColumns((byte *)imageRow(job->dst, r) + (size_t)c0 * size, taps, pass->weights, pass->count,
+				rowSize);
+		}
+	}
+
+	free(taps);
+	free(rows);
+	giveBuffer(buffers, mid);
+	giveBuffer(buffers, padded);
+}
+
+/* convolves src with kernel into a new image of the same size, tile by
+ * tile over the threads of pool. src is left as it is.
+ * @params: pool - threads to share the work, or NULL
+ * Returns: the convolved image, or NULL if out of memory
+ */
+
+tImage *convolveImage(const tImage *src, const tConvolveKernel *kernel, tThreadPool *pool) {
+	tConvolveJob job;
+	memset(&job, 0, sizeof(job));
+	job.src = src;
+	job.rx = kernel->width / 2;
+	job.ry = kernel->height / 2;
+	job.separable = kernel->rows != NULL;
+	bool ok = job.separable ? createTaps(&job.first, kernel->rows, kernel->width, 1) &&
+		createTaps(&job.second, kernel->columns, 1, kernel->height) :
+		createTaps(&job.first, kernel->values, kernel->width, kernel->height);
+	job.dst = createImage(src->width, src->height, src->bpp, src->buffers);
+
+	if (ok && job.dst && src->width > 0 && src->height > 0) {
+		// Wide enough that the halo columns add little, then as tall as the scratch rows allow.
+		int size = src->bpp / 8;
+		job.tileWidth = cMinTileWidth > 8 * job.rx ? cMinTileWidth : 8 * job.rx;
+		if (job.tileWidth > src->width) job.tileWidth = src->width;
+		size_t scratchRow = (size_t)(2 * job.tileWidth + 2 * job.rx) * size;
+		job.tileHeight = (int)(cTileSize / scratchRow) - 2 * job.ry;
+		if (job.tileHeight < 2 * job.ry) job.tileHeight = 2 * job.ry;
+		if (job.tileHeight < cMinTileHeight) job.tileHeight = cMinTileHeight;
+		if (job.tileHeight > src->height) job.tileHeight = src->height;
+
+		job.tilesAcross = (src->width + job.tileWidth - 1) / job.tileWidth;
+		int tilesDown = (src->height + job.tileHeight - 1) / job.tileHeight;
+		threadPoolRun(pool, job.tilesAcross * tilesDown, convolveTileTask, &job);
+	}
+
+	freeTaps(&job.first);
+	freeTaps(&job.second);
+	if (!ok || job.dst == NULL || job.failed) {
+		if (job.dst) freeImage(job.dst);
+		return NULL;
+	}
+	return job.dst;
+}
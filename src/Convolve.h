@@ -0,0 +1,39 @@
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+#include "Image.h"
+
+/* Convolution with a kernel of odd width and height: each pixel becomes
+ * the weighted sum of the pixels around it, the edge pixels standing in
+ * for those past the edges. The image is cut into tiles that are spread
+ * over the threads; each reads a halo of the kernel's radius around it.
+ * A separable kernel, the product of a column and a row of weights, is
+ * run as two passes over each tile, along the rows into a scratch tile
+ * and then down its columns, so it costs width + height taps a pixel
+ * rather than width x height; others are summed in one 2D pass. Both
+ * passes are resampleColumns() of Simd.h: a tap along a row is just the
+ * same row a few pixels on, so every sum is over whole rows of bytes in
+ * 16-bit fixed point (see cWeightBits). As for resampling, the channels of
+ * a pixel are filtered independently, so only 24 and 32-bit pixels can be
+ * convolved.
+ */
+
+// The largest width or height of a kernel, and the largest sum of the magnitudes of its weights, which keeps the
+// fixed point sums within 32 bits
+#define cKernelMaxSize 255
+#define cKernelMaxWeight 256
+
+typedef struct {
+	int		width;			// Odd
+	int		height;			// Odd
+	double *values;			// height rows of width weights, the bottom row first like the rows of an image
+	double *rows;			// If separable, the weights along a row, none negative, adding up to 1; else NULL
+	double *columns;		// If separable, the weights down a column; values[i][j] is columns[i] * rows[j]
+} tConvolveKernel;
+
+//function declarations
+tConvolveKernel *createKernel(int width, int height, const double *values);
+tConvolveKernel *orientKernel(const tConvolveKernel *, tOrient);
+void freeKernel(tConvolveKernel *);
+tImage *convolveImage(const tImage *src, const tConvolveKernel *, tThreadPool *);
+
+#endif
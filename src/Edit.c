@@ -0,0 +1,328 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "Bimpie.h"
+#include "Edit.h"
+#include "Simd.h"
+#include "String.h"
+
+// Rows are reversed in blocks of about this many bytes.
+#define cEditBlockSize ((size_t)4 << 20)
+
+// Where the height lies in a BMP file: after the file header, the info header size and the width.
+#define cHeightOffset 22
+
+static const char cJournalMagic[8] = { 'B', 'I', 'M', 'P', 'J', 'R', 'N', 'L' };
+
+/* The start of a journal, written once before any record. Two record
+ * slots follow, each a tJournalRecord and the old bytes of a block.
+ */
+typedef struct {
+	char		magic[8];
+	uint64_t	rowSize;		// Bytes per row of the file, to check the journal belongs to it
+	uint64_t	slotSize;		// Bytes per record slot
+} tJournalHeader;
+
+/* One step of an edit. Records alternate between the two slots, so a
+ * record torn by a crash leaves the one before it whole; the whole record
+ * with the highest seq is the current one.
+ */
+typedef struct {
+	uint64_t	seq;
+	int32_t		undo;			// The edit puts back an interrupted one
+	int32_t		end;			// The edit reverses rows 0 to end-1,
+	int32_t		done;			// of which those before done are reversed already,
+	int32_t		blockRows;		// and those from done on are being rewritten: their old bytes follow
+	int32_t		height;			// The height to store once the rows are done
+	int32_t		oldHeight;		// The height stored before the edit, for undoing it
+	uint32_t	checksum;		// Of the record, with this field 0, and the old bytes
+} tJournalRecord;
+
+// The state of one edit.
+typedef struct {
+	int				fd;			// The BMP file, open for reading and writing
+	int				journal;	// Its journal, -1 for none
+	char			journalName[4096];
+	off_t			pixelOffset;
+	size_t			rowSize;	// Bytes per row in the file, padding included
+	int				width;
+	int				bpp;
+	int				blockRows;
+	byte		   *block;		// Rows as read, which are what the journal saves
+	byte		   *reversed;	// The same rows reversed
+	tJournalRecord	record;
+} tEdit;
+
+/* Records an error message in bmp->error
+ * Returns: code
+ */
+
+static int editError(tBmp *bmp, int code, char *message) {
+	snprintf(bmp->error, sizeof(bmp->error), "%s", message);
+	return code;
+}
+
+/* Adds size bytes to an FNV-1a checksum
+ * Returns: the new sum
+ */
+
+static uint32_t checksum(uint32_t sum, const byte *bytes, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		sum = (sum ^ bytes[i]) * 16777619u;
+	}
+	return sum;
+}
+
+/* Returns: the checksum of record and the rows after it
+ */
+
+static uint32_t recordChecksum(tJournalRecord record, const byte *rows, size_t size) {
+	record.checksum = 0;
+	return checksum(checksum(2166136261u, (const byte *)&record, sizeof(record)), rows, size);
+}
+
+/* Returns: where the slot of the record numbered seq starts in the journal
+ */
+
+static off_t slotOffset(size_t slotSize, uint64_t seq) {
+	return sizeof(tJournalHeader) + (off_t)(seq % 2) * slotSize;
+}
+
+/* Sets up edit for the file of bmp, locks the file for the edit and takes
+ * its blocks. The lock is on the open file, so it keeps out edits and
+ * recoveries from other threads of this process as well as from other
+ * processes, and goes with the file when endEdit() closes it.
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int startEdit(tEdit *edit, tBmp *bmp, char *fileName) {
+	memset(edit, 0, sizeof(*edit));
+	edit->journal = -1;
+	snprintf(edit->journalName, sizeof(edit->journalName), "%s.journal", fileName);
+	edit->pixelOffset = bmp->header.pixelOffset;
+	edit->rowSize = calculateFileRowSize(bmp);
+	edit->width = bmp->info.width;
+	edit->bpp = bmp->info.bitsPerPixel;
+	size_t rows = cEditBlockSize / edit->rowSize;
+	edit->blockRows = rows < 1 ? 1 : rows < (size_t)bmp->info.height ? (int)rows : bmp->info.height;
+
+	edit->fd = open(fileName, O_RDWR);
+	if (edit->fd < 0) {
+		return editError(bmp, cBimpieErrorFileOpen, "The file could not be opened.");
+	}
+	if (flock(edit->fd, LOCK_EX | LOCK_NB) != 0) {
+		return editError(bmp, cBimpieErrorFileOpen, errno == EWOULDBLOCK ?
+			"An edit of the file is in progress." : "The file could not be locked.");
+	}
+	edit->block = (byte *)takeBuffer(bmp->buffers, edit->blockRows * edit->rowSize);
+	edit->reversed = (byte *)takeBuffer(bmp->buffers, edit->blockRows * edit->rowSize);
+	if (edit->block == NULL || edit->reversed == NULL) {
+		return editError(bmp, cBimpieErrorMemory, "Out of memory.");
+	}
+	return 0;
+}
+
+/* Closes the files of edit and gives back its blocks
+ */
+
+static void endEdit(tEdit *edit, tBmp *bmp) {
+	if (edit->fd >= 0) close(edit->fd);
+	if (edit->journal >= 0) close(edit->journal);
+	giveBuffer(bmp->buffers, edit->block);
+	giveBuffer(bmp->buffers, edit->reversed);
+}
+
+/* Returns: the size of a record slot of the journal of edit
+ */
+
+static size_t calculateSlotSize(tEdit *edit) {
+	return sizeof(tJournalRecord) + edit->blockRows * edit->rowSize;
+}
+
+/* Saves the current record of edit and the rows rows in its block as the
+ * next record of the journal, and flushes it to disk
+ * Returns: true if it is on disk
+ */
+
+static bool writeRecord(tEdit *edit, int rows) {
+	tJournalRecord *record = &edit->record;
+	size_t size = rows * edit->rowSize;
+	record->seq++;
+	record->blockRows = rows;
+	record->checksum = recordChecksum(*record, edit->block, size);
+
+	off_t slot = slotOffset(calculateSlotSize(edit), record->seq);
+	return writeAt(edit->journal, record, sizeof(*record), slot) &&
+		writeAt(edit->journal, edit->block, size, slot + sizeof(*record)) && fdatasync(edit->journal) == 0;
+}
+
+/* Reverses the pixels of rows record.done to record.end-1 of the file of
+ * edit, a block at a time, journaling each block first if there is a
+ * journal. Then stores record.height as the height and removes the
+ * journal: the edit is complete.
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int runEdit(tEdit *edit, tBmp *bmp) {
+	tJournalRecord *record = &edit->record;
+	while (record->done < record->end) {
+		int rows = record->end - record->done < edit->blockRows ? record->end - record->done : edit->blockRows;
+		size_t size = rows * edit->rowSize;
+		off_t offset = edit->pixelOffset + (off_t)record->done * edit->rowSize;
+		if (!readAt(edit->fd, edit->block, size, offset)) {
+			return editError(bmp, cBimpieErrorFileRead, "Pixel Error.");
+		}
+		if (edit->journal >= 0 && !writeRecord(edit, rows)) {
+			return editError(bmp, cBimpieErrorFileWrite, "Error writing the journal.");
+		}
+
+		// The padding is copied along as it is.
+		memcpy(edit->reversed, edit->block, size);
+		for (int r = 0; r < rows; r++) {
+			reverseRow(edit->reversed + r * edit->rowSize, edit->block + r * edit->rowSize, edit->width, edit->bpp);
+		}
+		if (!writeAt(edit->fd, edit->reversed, size, offset) || (edit->journal >= 0 && fdatasync(edit->fd) != 0)) {
+			return editError(bmp, cBimpieErrorFileWrite, "Error writing the pixels.");
+		}
+		record->done += rows;
+		bmp->bytesRead += size;
+		bmp->bytesWritten += size;
+	}
+
+	if (!writeAt(edit->fd, &record->height, sizeof(record->height), cHeightOffset) ||
+			(edit->journal >= 0 && fdatasync(edit->fd) != 0)) {
+		return editError(bmp, cBimpieErrorFileWrite, "Error writing the header.");
+	}
+	if (edit->journal >= 0) unlink(edit->journalName);
+	return 0;
+}
+
+/* flips the image of bmp, opened by readBmpHeaders() from fileName, where
+ * it lies in the file, in orientation o, which must not transpose. A
+ * vertical flip turns the file over by negating its height; a horizontal
+ * one reverses every row. Nothing is read for an orientation that leaves
+ * the image as it is.
+ * @params: journal - make the edit crash-safe, see Edit.h
+ * Returns: 0 or a cBimpieError code
+ */
+
+int editBmpInPlace(tBmp *bmp, char *fileName, tOrient o, bool journal) {
+	if (orientIsIdentity(o)) {
+		return 0;
+	}
+
+	tEdit edit;
+	int status = startEdit(&edit, bmp, fileName);
+	int32_t height = bmp->topDown ? -bmp->info.height : bmp->info.height;
+	edit.record.end = o.flipX ? bmp->info.height : 0;
+	edit.record.height = o.flipY ? -height : height;
+	edit.record.oldHeight = height;
+
+	if (status == 0 && journal) {
+		tJournalHeader header;
+		memcpy(header.magic, cJournalMagic, sizeof(header.magic));
+		header.rowSize = edit.rowSize;
+		header.slotSize = calculateSlotSize(&edit);
+		edit.journal = open(edit.journalName, O_RDWR | O_CREAT | O_EXCL, 0666);
+		if (edit.journal < 0) {
+			status = editError(bmp, cBimpieErrorFileOpen, errno == EEXIST ?
+				"An interrupted edit left a journal; open the file again to undo it." : "The journal could not be created.");
+		} else if (!writeAt(edit.journal, &header, sizeof(header), 0) || fdatasync(edit.journal) != 0) {
+			status = editError(bmp, cBimpieErrorFileWrite, "Error writing the journal.");
+		}
+	}
+
+	if (status == 0) status = runEdit(&edit, bmp);
+	if (status == 0 && o.flipY) bmp->topDown = !bmp->topDown;
+	endEdit(&edit, bmp);
+	return status;
+}
+
+/* reads the record in the slot of journal for seq
+ * Returns: true if it is whole
+ */
+
+static bool readRecord(tEdit *edit, size_t slotSize, uint64_t seq, tJournalRecord *record) {
+	off_t slot = slotOffset(slotSize, seq);
+	if (!readAt(edit->journal, record, sizeof(*record), slot) || record->blockRows < 0 ||
+			record->blockRows > edit->blockRows || record->done < 0 || record->end < record->done) {
+		return false;
+	}
+	size_t size = record->blockRows * edit->rowSize;
+	return readAt(edit->journal, edit->block, size, slot + sizeof(*record)) &&
+		recordChecksum(*record, edit->block, size) == record->checksum;
+}
+
+/* undoes an edit of the file of bmp, opened by readBmpHeaders() from
+ * fileName, that was cut short, if its journal is there. The rows being
+ * rewritten get their old bytes back, then the rows already reversed are
+ * reversed again and the old height is stored, journaling all of that in
+ * turn, so a crash while recovering is recovered from too. A journal is
+ * only left by a crash if the file is not locked: an edit still running
+ * holds the lock, and is reported as in progress instead.
+ * @params: recovered - set if there was a journal; the headers of bmp are
+ *			then out of date
+ * Returns: 0 or a cBimpieError code
+ */
+
+int recoverBmpEdit(tBmp *bmp, char *fileName, bool *recovered) {
+	tEdit edit;
+	*recovered = false;
+	char journalName[4096];
+	snprintf(journalName, sizeof(journalName), "%s.journal", fileName);
+	if (access(journalName, F_OK) != 0) {
+		return 0;
+	}
+
+	// The edit that left the journal may have completed and removed it by the time the lock is taken.
+	int status = startEdit(&edit, bmp, fileName);
+	if (status == 0 && (edit.journal = open(edit.journalName, O_RDWR)) < 0 && errno == ENOENT) {
+		endEdit(&edit, bmp);
+		return 0;
+	}
+	*recovered = true;
+	tJournalHeader header;
+	if (status == 0 && (edit.journal < 0 || !readAt(edit.journal, &header, sizeof(header), 0))) {
+		status = editError(bmp, cBimpieErrorFileRead, "The journal could not be read.");
+	}
+	if (status == 0 && (memcmp(header.magic, cJournalMagic, sizeof(header.magic)) != 0 ||
+			header.rowSize != edit.rowSize || header.slotSize != calculateSlotSize(&edit))) {
+		status = editError(bmp, cBimpieErrorFileFormat, "The journal does not belong to this file.");
+	}
+	if (status != 0) {
+		endEdit(&edit, bmp);
+		return status;
+	}
+
+	// Without a whole record no row was touched yet, which is the same as a record with nothing done.
+	tJournalRecord records[2];
+	bool whole[2] = { readRecord(&edit, header.slotSize, 0, &records[0]),
+		readRecord(&edit, header.slotSize, 1, &records[1]) };
+	int current = whole[0] && (!whole[1] || records[0].seq > records[1].seq) ? 0 : whole[1] ? 1 : -1;
+	if (current >= 0) {
+		tJournalRecord *record = &records[current];
+		size_t size = record->blockRows * edit.rowSize;
+		if (!readRecord(&edit, header.slotSize, record->seq, record) ||
+				!writeAt(edit.fd, edit.block, size, edit.pixelOffset + (off_t)record->done * edit.rowSize) ||
+				fdatasync(edit.fd) != 0) {
+			status = editError(bmp, cBimpieErrorFileWrite, "Error writing the pixels.");
+		}
+
+		// Carry on putting the file back, or start doing so.
+		edit.record = *record;
+		if (!record->undo) {
+			edit.record.undo = 1;
+			edit.record.end = record->done;
+			edit.record.done = 0;
+			edit.record.height = record->oldHeight;
+		}
+		if (status == 0) status = runEdit(&edit, bmp);
+	} else {
+		unlink(edit.journalName);
+	}
+
+	endEdit(&edit, bmp);
+	return status;
+}
@@ -0,0 +1,24 @@
+#ifndef EDIT_H
+#define EDIT_H
+#include "Image.h"
+
+/* In-place edits: flips and half turns done on the file itself instead of
+ * on a copy. A vertical flip only rewrites the height in the header, which
+ * turns the file over; a horizontal flip reverses the rows a block at a
+ * time where they lie. Memory use is two blocks and no second copy of the
+ * file is made on disk.
+ *
+ * With a journal, the edit is crash-safe. Before each block is rewritten,
+ * its old bytes are saved in fileName.journal and flushed to disk, and the
+ * block is flushed before the next one is saved. If the edit is cut short,
+ * recoverBmpEdit() puts the file back as it was before the edit, so it can
+ * simply be run again. The journal is removed when the edit is complete.
+ * The file is locked for the whole edit, so a journal is only taken to be
+ * left by a crash when no edit holds that lock.
+ */
+
+//function declarations
+int editBmpInPlace(tBmp *, char *fileName, tOrient, bool journal);
+int recoverBmpEdit(tBmp *, char *fileName, bool *recovered);
+
+#endif
@@ -36,6 +36,10 @@ const int cErrorArgRot			= -5;
 const int cErrorArgUnexpStr		= -6;
 const int cErrorFileOpen		= -7;
 const int cErrorFileOpenRead	= -8;
+const int cErrorFileRead		= -9;
+const int cErrorFileWrite		= -10;
+const int cErrorFileFormat		= -11;
+const int cErrorMemory			= -12;
 
 //==============================================================================================================
 // FUNCTION DEFINITIONS
@@ -31,6 +31,10 @@ extern const int cErrorArgRot;
 extern const int cErrorArgUnexpStr;
 extern const int cErrorFileOpen;
 extern const int cErrorFileOpenRead;
+extern const int cErrorFileRead;
+extern const int cErrorFileWrite;
+extern const int cErrorFileFormat;
+extern const int cErrorMemory;
 
 //==============================================================================================================
 // FUNCTION DECLARATIONS
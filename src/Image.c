@@ -1,77 +1,639 @@
+#include <sys/mman.h>
 #include "Image.h"
+#include "String.h"
+#include "Simd.h"
 
-/* rotates image n % 4 times clockwise
- * @params: bmpToRot - pixels to be rotated
- *			n - number of times to rotate
- * Returns: rotated bmp pixels
+// Each parallel task transposes a block of this many source pixels a side,
+// and flips or copies a band of about cBandSize bytes of rows.
+#define cBlockSize 256
+#define cBandSize (256 * 1024)
+
+// Transposes work on square tiles of this many pixels a side: a source and
+// a destination tile of 24-bit pixels take 24 KB, of 32-bit pixels 32 KB,
+// inside L1.
+#define cTileSize 64
+
+/* Calculates the stride of an image row: its size rounded up to a
+ * multiple of cImageAlign bytes
+ */
+
+static size_t calculateStride(int width, int bpp) {
+	return ((size_t)width * (bpp / 8) + cImageAlign - 1) / cImageAlign * cImageAlign;
+}
+
+/* Calculates the bytes createImage() takes for the pixels of an image:
+ * room for it, or for it transposed if that is more
+ */
+
+size_t calculateImageSize(int width, int height, int bpp) {
+	size_t size = calculateStride(width, bpp) * height;
+	size_t transposedSize = calculateStride(height, bpp) * width;
+	return size > transposedSize ? size : transposedSize;
+}
+
+/* Allocates an image as one aligned block with every row padded out
+ * to a multiple of cImageAlign bytes. The block is big enough for the
+ * transposed image too, so the image can be rotated in place.
+ * @params: width - width of the image in pixels
+ *			height - height of the image in pixels
+ *			bpp - bits per pixel
+ *			buffers - pool to take the memory from, or NULL
+ * Returns: the new image, pixels uninitialized, or NULL if out of memory
+ */
+
+tImage *createImage(int width, int height, int bpp, tBufferPool *buffers) {
+	tImage *img = (tImage *)takeBuffer(buffers, sizeof(tImage));
+	if (img == NULL) {
+		return NULL;
+	}
+
+	img->width = width;
+	img->height = height;
+	img->bpp = bpp;
+	img->mapping = NULL;
+	img->mappingSize = 0;
+	img->buffers = buffers;
+	img->stride = calculateStride(width, bpp);
+
+	img->pixels = (byte *)takeBuffer(buffers, calculateImageSize(width, height, bpp));
+	if (img->pixels == NULL) {
+		giveBuffer(buffers, img);
+		return NULL;
+	}
+
+	return img;
+}
+
+/* turns image upside down without moving a pixel, by starting it at its
+ * last row and negating its stride. Doing it twice restores the image.
+ * Returns: image
+ */
+
+static tImage *flipView(tImage *image) {
+	image->pixels = (byte *)imageRow(image, image->height - 1);
+	image->stride = -image->stride;
+	return image;
+}
+
+/* frees an image created by createImage() or mapBmpPixels(), giving its
+ * memory back to the pool it came from
+ * @params: img - the image to be freed
+ */
+
+void freeImage(tImage *img) {
+	if (img->mapping) {
+		munmap(img->mapping, img->mappingSize);
+	} else {
+		// A flipped image's block starts at its last row.
+		giveBuffer(img->buffers, img->stride < 0 ? (byte *)imageRow(img, img->height - 1) : img->pixels);
+	}
+	giveBuffer(img->buffers, img);
+}
+
+/* adds a horizontal flip after orientation o
+ * Returns: the combined orientation
+ */
+
+tOrient orientFlipH(tOrient o) {
+	o.flipX = !o.flipX;
+	return o;
+}
+
+/* adds a vertical flip after orientation o
+ * Returns: the combined orientation
+ */
+
+tOrient orientFlipV(tOrient o) {
+	o.flipY = !o.flipY;
+	return o;
+}
+
+/* adds n clockwise quarter turns after orientation o. A quarter turn is a
+ * horizontal flip followed by a transpose; moving the transpose to the
+ * front turns the column flip into a row flip and vice versa.
+ * Returns: the combined orientation
+ */
+
+tOrient orientRotate(tOrient o, int n) {
+	for (n = (n % 4 + 4) % 4; n > 0; n--) {
+		bool flipX = o.flipX;
+		o.flipX = o.flipY;
+		o.flipY = !flipX;
+		o.transpose = !o.transpose;
+	}
+	return o;
+}
+
+/* adds a vertical flip before orientation o. Flipping the rows before a
+ * transpose is flipping the columns after it.
+ * Returns: the combined orientation
+ */
+
+static tOrient orientAfterFlipV(tOrient o) {
+	if (o.transpose) {
+		o.flipX = !o.flipX;
+	} else {
+		o.flipY = !o.flipY;
+	}
+	return o;
+}
+
+/* Returns: true if orientation o leaves the image unchanged
+ */
+
+bool orientIsIdentity(tOrient o) {
+	return !o.transpose && !o.flipX && !o.flipY;
+}
+
+/* maps r, a region of the image that orientation o makes of a width x
+ * height image, back to the region of that image its pixels come from.
+ * The flips are undone first, in the oriented image, then the transpose
+ * swaps the columns and rows.
+ * Returns: the source region, of the same pixels
+ */
+
+tRegion orientSourceRegion(tOrient o, int width, int height, tRegion r) {
+	int W = o.transpose ? height : width;
+	int H = o.transpose ? width : height;
+	if (o.flipX) r.col = W - r.col - r.width;
+	if (o.flipY) r.row = H - r.row - r.height;
+	if (o.transpose) {
+		tRegion t = { r.row, r.col, r.height, r.width };
+		r = t;
+	}
+	return r;
+}
+
+/* The arguments shared by the tasks of one parallel transform
+ */
+typedef struct {
+	const tImage   *src;
+	tImage		   *dst;
+	tOrient			o;
+	int				bandRows;	// Rows per task for the row band kernels
+	int				blockCols;	// Blocks per block row for the transpose kernel
+	const tColor   *color;		// The colors to give the pixels as they are written, or NULL
+} tTransformJob;
+
+/* Calculates how many rows make up one band of about cBandSize bytes
+ */
+
+static int calculateBandRows(const tImage *image) {
+	size_t rowSize = (size_t)image->width * (image->bpp / 8);
+	int rows = rowSize > 0 ? (int)(cBandSize / rowSize) : 1;
+	return rows < 1 ? 1 : rows;
+}
+
+/* Calculates how many tasks of job->bandRows rows cover rows rows
+ */
+
+static int calculateBandCount(tTransformJob *job, int rows) {
+	return (rows + job->bandRows - 1) / job->bandRows;
+}
+
+/* Returns: the bytes per pixel of image
+ */
+
+static int pixelSize(const tImage *image) {
+	return image->bpp / 8;
+}
+
+/* takes a scratch row for the in-place kernels from the image's pool;
+ * give it back with giveBuffer()
+ * Returns: the row, or NULL if out of memory
+ */
+
+static byte *createRowBuffer(const tImage *image) {
+	return (byte *)takeBuffer(image->buffers, calculateStride(image->width, image->bpp));
+}
+
+/* copies one pixel of size bytes
+ */
+
+static inline void copyPixel(byte *to, const byte *from, int size) {
+	switch (size) {
+	case 1:  *(tPixel8 *)to = *(const tPixel8 *)from; break;
+	case 2:  *(tPixel16 *)to = *(const tPixel16 *)from; break;
+	case 4:  *(tPixel32 *)to = *(const tPixel32 *)from; break;
+	default: *(tPixel *)to = *(const tPixel *)from; break;
+	}
+}
+
+/* swaps each pixel c of row lo with pixel cols-1-c of row hi, one pixel at
+ * a time. If lo and hi are the same row, it is reversed in place. The
+ * in-place kernels fall back on this when there is no memory for a
+ * scratch row.
+ */
+
+static void reverseSwapRows(byte *lo, byte *hi, int cols, int size) {
+	int end = lo == hi ? cols / 2 : cols;
+	byte temp[4];
+	for (int c = 0; c < end; c++) {
+		copyPixel(temp, lo + (size_t)c * size, size);
+		copyPixel(lo + (size_t)c * size, hi + (size_t)(cols-1-c) * size, size);
+		copyPixel(hi + (size_t)(cols-1-c) * size, temp, size);
+	}
+}
+
+/* Defines the transpose kernels for one pixel type, so that each pixel
+ * size moves its pixels whole: a 32-bit pixel is one 4-byte load and
+ * store, not three byte moves through tPixel.
+ *
+ * transposeTile<bits>() transposes one tile of src, rows r0..r1-1 and
+ * columns c0..c1-1, into dst. Source row r becomes column r of the
+ * transposed image and source column c becomes its row c. Each dst row
+ * segment is written in order while the tile's source rows stay in L1.
+ *
+ * transposeSquareTile<bits>() swaps rows r0..r1-1 of a square image, from
+ * column c0 up to c1, with their mirror across the diagonal; on the
+ * diagonal tile only the pixels right of the diagonal are swapped.
  */
 
-tPixel ** rotateBmp(tPixel** bmpToRot, int n) {
-	int M = bmpInfoHeader.height;
-	int N = bmpInfoHeader.width;
-	int timesToRot;
+#define DEFINE_TRANSPOSE_KERNELS(bits, tType)												\
+static void transposeTile##bits(const tImage *src, tImage *dst, tOrient o, int r0, int r1,	\
+		int c0, int c1) {																	\
+	int W = dst->width;																		\
+	int H = dst->height;																	\
+																							\
+	for (int c = c0; c < c1; c++) {															\
+		tType *to = (tType *)imageRow(dst, o.flipY ? H-1-c : c);							\
+		const byte *from = (const byte *)imageRow(src, r0) + (size_t)c * sizeof(tType);		\
+		if (o.flipX) {																		\
+			/* Walk the source rows upwards so the destination is still written in order. */\
+			from += (ptrdiff_t)(r1 - r0 - 1) * src->stride;									\
+			for (int r = r1 - 1; r >= r0; r--, from -= src->stride) {						\
+				to[W-1-r] = *(const tType *)from;											\
+			}																				\
+		} else {																			\
+			for (int r = r0; r < r1; r++, from += src->stride) {							\
+				to[r] = *(const tType *)from;												\
+			}																				\
+		}																					\
+	}																						\
+}																							\
+																							\
+static void transposeSquareTile##bits(tImage *image, int r0, int r1, int c0, int c1) {		\
+	for (int r = r0; r < r1; r++) {															\
+		tType *row = (tType *)imageRow(image, r);											\
+		for (int c = c0 == r0 ? r + 1 : c0; c < c1; c++) {									\
+			tType *mirror = (tType *)imageRow(image, c) + r;								\
+			tType temp = row[c];															\
+			row[c] = *mirror;																\
+			*mirror = temp;																	\
+		}																					\
+	}																						\
+}
+
+DEFINE_TRANSPOSE_KERNELS(8, tPixel8)
+DEFINE_TRANSPOSE_KERNELS(16, tPixel16)
+DEFINE_TRANSPOSE_KERNELS(24, tPixel)
+DEFINE_TRANSPOSE_KERNELS(32, tPixel32)
+
+/* runs the transposeTile kernel for the pixel size of src
+ */
+
+static void transposeTile(const tImage *src, tImage *dst, tOrient o, int r0, int r1, int c0, int c1) {
+	switch (src->bpp) {
+	case 8:  transposeTile8(src, dst, o, r0, r1, c0, c1); break;
+	case 16: transposeTile16(src, dst, o, r0, r1, c0, c1); break;
+	case 32: transposeTile32(src, dst, o, r0, r1, c0, c1); break;
+	default: transposeTile24(src, dst, o, r0, r1, c0, c1); break;
+	}
+}
+
+/* gives color to the pixels of dst that transposeTile() wrote from the
+ * tile of src at rows r0..r1-1 and columns c0..c1-1, while they are in L1
+ */
+
+static void colorTile(tImage *dst, tOrient o, const tColor *color, int r0, int r1, int c0, int c1) {
+	int size = pixelSize(dst);
+	int col = o.flipX ? dst->width - r1 : r0;
+	for (int c = c0; c < c1; c++) {
+		byte *row = (byte *)imageRow(dst, o.flipY ? dst->height-1-c : c);
+		colorRow(color, row + (size_t)col * size, r1 - r0, size);
+	}
+}
+
+/* transposes the block of src at rows r0..r1-1 and columns c0..c1-1 by
+ * halving its longer side until it fits in a tile. The recursion keeps
+ * working sets inside each cache level without knowing their sizes, and
+ * the tiles keep L1 and the TLB hot on the rows they touch.
+ */
 
-	if ((timesToRot = n % 4) == 0) {
-		return bmpToRot;	
+static void transposeBlock(const tImage *src, tImage *dst, tOrient o, const tColor *color, int r0, int r1,
+		int c0, int c1) {
+	if (r1 - r0 <= cTileSize && c1 - c0 <= cTileSize) {
+		transposeTile(src, dst, o, r0, r1, c0, c1);
+		if (color) colorTile(dst, o, color, r0, r1, c0, c1);
+	} else if (r1 - r0 >= c1 - c0) {
+		int rm = r0 + (r1 - r0) / 2;
+		transposeBlock(src, dst, o, color, r0, rm, c0, c1);
+		transposeBlock(src, dst, o, color, rm, r1, c0, c1);
+	} else {
+		int cm = c0 + (c1 - c0) / 2;
+		transposeBlock(src, dst, o, color, r0, r1, c0, cm);
+		transposeBlock(src, dst, o, color, r0, r1, cm, c1);
 	}
-	else {
-		tPixel **newBmp = (tPixel**)malloc(N * sizeof(tPixel*));
-		for (int i = 0; i < N; i++) {
-			newBmp[i] = (tPixel*)malloc(M * sizeof(tPixel));
-		}		
+}
+
+/* writes src in orientation o into dst in one pass, giving the pixels
+ * color, if any, on the way. dst must be src->height x src->width pixels
+ * if o transposes, else the same size as src. Row dy of dst is row sy =
+ * flipY ? H-1-dy : dy of the transposed (if at all) source, read
+ * backwards if flipX.
+ */
 
-		for(int r = 0; r < M; r++) {
-			for (int c = 0; c < N; c++) {				
-				newBmp[c][r] = bmpToRot[r][N-1-c];
-			}
+static void transformRowsTask(void *arg, int task) {
+	tTransformJob *job = (tTransformJob *)arg;
+	const tImage *src = job->src;
+	tImage *dst = job->dst;
+	int W = dst->width;
+	int H = dst->height;
+	size_t rowSize = (size_t)W * (src->bpp / 8);
+	int end = (task + 1) * job->bandRows < H ? (task + 1) * job->bandRows : H;
+
+	for (int dy = task * job->bandRows; dy < end; dy++) {
+		tPixel *from = imageRow(src, job->o.flipY ? H-1-dy : dy);
+		tPixel *to = imageRow(dst, dy);
+		if (job->o.flipX) {
+			reverseRow((byte *)to, (const byte *)from, W, src->bpp);
+		} else {
+			memcpy(to, from, rowSize);
 		}
+		colorRow(job->color, (byte *)to, W, pixelSize(dst));
+	}
+}
+
+static void transposeBlockTask(void *arg, int task) {
+	tTransformJob *job = (tTransformJob *)arg;
+	int r0 = task / job->blockCols * cBlockSize;
+	int c0 = task % job->blockCols * cBlockSize;
+	int r1 = r0 + cBlockSize < job->src->height ? r0 + cBlockSize : job->src->height;
+	int c1 = c0 + cBlockSize < job->src->width ? c0 + cBlockSize : job->src->width;
+	transposeBlock(job->src, job->dst, job->o, job->color, r0, r1, c0, c1);
+}
 
-		updateBmpInfo(M, N);
-		return rotateBmp(newBmp, n-1);				
+void transformBmpInto(const tImage *src, tImage *dst, tOrient o, const tColor *color, tThreadPool *pool) {
+	tTransformJob job = { src, dst, o, calculateBandRows(dst), 0, color };
+
+	if (!o.transpose) {
+		threadPoolRun(pool, calculateBandCount(&job, dst->height), transformRowsTask, &job);
+		return;
 	}
-	
+
+	// Each task recursively transposes one cBlockSize square of the source.
+	job.blockCols = (src->width + cBlockSize - 1) / cBlockSize;
+	int blockRows = (src->height + cBlockSize - 1) / cBlockSize;
+	threadPoolRun(pool, blockRows * job.blockCols, transposeBlockTask, &job);
 }
 
-tPixel** flipBmpHoriz(tPixel **bmpToHorFlip){
-	int rows  = bmpInfoHeader.height;
-	int cols = bmpInfoHeader.width;
-	tPixel temp;
-	
-	for (int i = 0; i < rows; i++) {
-		for(int j = 0; j< cols/2; j++) {
-			temp = bmpToHorFlip[i][j];
-			bmpToHorFlip[i][j] = bmpToHorFlip[i][cols-(j+1)];
-			bmpToHorFlip[i][cols-(j+1)] = temp;
+/* transposes a square image in place, tile by tile: each diagonal tile
+ * is transposed within itself and every other tile is swapped with its
+ * mirror across the diagonal, after which both are given the colors of
+ * the job, if any
+ */
+
+static void transposeSquareTask(void *arg, int task) {
+	tImage *image = ((tTransformJob *)arg)->dst;
+	const tColor *color = ((tTransformJob *)arg)->color;
+	tOrient o = { false, false, false };
+	int N = image->width;
+	int r0 = task * cTileSize;
+	int r1 = r0 + cTileSize < N ? r0 + cTileSize : N;
+
+	// Task r0 owns the tiles from the diagonal to the right edge of its tile row.
+	for (int c0 = r0; c0 < N; c0 += cTileSize) {
+		int c1 = c0 + cTileSize < N ? c0 + cTileSize : N;
+		switch (image->bpp) {
+		case 8:  transposeSquareTile8(image, r0, r1, c0, c1); break;
+		case 16: transposeSquareTile16(image, r0, r1, c0, c1); break;
+		case 32: transposeSquareTile32(image, r0, r1, c0, c1); break;
+		default: transposeSquareTile24(image, r0, r1, c0, c1); break;
+		}
+		if (color) {
+			colorTile(image, o, color, r0, r1, c0, c1);
+			if (c0 != r0) colorTile(image, o, color, c0, c1, r0, r1);
 		}
 	}
+}
 
-	return bmpToHorFlip;
+static void transposeSquareInPlace(tImage *image, const tColor *color, tThreadPool *pool) {
+	tTransformJob job = { image, image, { false, false, false }, 0, 0, color };
+	threadPoolRun(pool, (image->width + cTileSize - 1) / cTileSize, transposeSquareTask, &job);
 }
 
-tPixel ** flipBmpVer(tPixel **bmpToFlipVer){
-	int rows  = bmpInfoHeader.height;
-	int cols = bmpInfoHeader.width;
-	tPixel temp;
-	
-	for (int i = 0; i < rows/2; i++) {
-		for(int j = 0; j< cols; j++) {
-			temp = bmpToFlipVer[i][j];
-			bmpToFlipVer[i][j] = bmpToFlipVer[rows-(i+1)][j];
-			bmpToFlipVer[rows-(i+1)][j] = temp;
+/* transposes an image of any shape in place. The rows are packed together,
+ * the H x W matrix of pixels is transposed by following the cycles of the
+ * permutation, and the W rows of the result are spread out to the new
+ * stride. The only extra memory is one bit per pixel to mark the pixels
+ * already moved; createImage() reserves room for the new stride.
+ * Returns: false, with image untouched, if there is no memory for the bits
+ */
+
+static bool transposeInPlace(tImage *image) {
+	int W = image->width;
+	int H = image->height;
+	int size = pixelSize(image);
+	size_t rowSize = (size_t)W * size;
+	size_t newRowSize = (size_t)H * size;
+	size_t newStride = calculateStride(H, image->bpp);
+	byte *pixels = image->pixels;
+	uint64_t N = (uint64_t)W * H;
+	byte *moved = (byte *)takeBuffer(image->buffers, N / 8 + 1);
+	if (moved == NULL) {
+		return false;
+	}
+	memset(moved, 0, N / 8 + 1);
+
+	for (int r = 1; r < H; r++) {
+		memmove(image->pixels + r * rowSize, imageRow(image, r), rowSize);
+	}
+
+	// Pixel k = r*W + c moves to c*H + r, i.e. k*H mod (N-1); so slot j is filled from j*W mod (N-1). The
+	// first and last pixels never move.
+	for (uint64_t start = 1; start + 1 < N; start++) {
+		if (moved[start / 8] & (1 << start % 8)) continue;
+		byte temp[4];
+		copyPixel(temp, pixels + start * size, size);
+		uint64_t j = start;
+		for (;;) {
+			moved[j / 8] |= 1 << j % 8;
+			uint64_t i = j * W % (N - 1);
+			if (i == start) break;
+			copyPixel(pixels + j * size, pixels + i * size, size);
+			j = i;
 		}
+		copyPixel(pixels + j * size, temp, size);
 	}
+	giveBuffer(image->buffers, moved);
 
-	return bmpToFlipVer;
+	for (int r = W - 1; r > 0; r--) {
+		memmove(image->pixels + r * newStride, image->pixels + r * newRowSize, newRowSize);
+	}
+
+	image->width = H;
+	image->height = W;
+	image->stride = newStride;
+	return true;
 }
 
+/* gives a band of rows of an image the colors of the job, for when no
+ * pixels move
+ */
 
-/* updates the bmpInfoHeader with new information
- * Params: newWidth - the new width of the bmp
- * 		   newHeight - the new height of the bmp
+static void colorRowsTask(void *arg, int task) {
+	tTransformJob *job = (tTransformJob *)arg;
+	tImage *image = job->dst;
+	int end = (task + 1) * job->bandRows < image->height ? (task + 1) * job->bandRows : image->height;
+	for (int r = task * job->bandRows; r < end; r++) {
+		colorRow(job->color, (byte *)imageRow(image, r), image->width, pixelSize(image));
+	}
+}
+
+/* applies orientation o to image, giving its pixels color, if any, on the
+ * way, and spreading the work over pool. A vertical flip on its own only
+ * flips the view of the rows, see flipView(); other flips and half turns
+ * are done in place. Orientations that transpose are done in place too
+ * for square images, or for any image if lowMemory is set; otherwise they
+ * need a new image and free the old one. Only when no pixel moves do the
+ * colors take a pass of their own.
+ * Returns: the transformed image, or NULL with image untouched if there is
+ * no memory for the new image, or with lowMemory for the in-place one
+ */
+
+tImage *transformBmp(tImage *image, tOrient o, const tColor *color, bool lowMemory, tThreadPool *pool) {
+	// The kernels below want rows in address order, so fold a flipped view into o first.
+	if (image->stride < 0) {
+		flipView(image);
+		o = orientAfterFlipV(o);
+	}
+
+	if (!o.transpose) {
+		if (o.flipX && o.flipY) return rotateBmp180(image, color, pool);
+		if (o.flipX) return flipBmpHoriz(image, color, pool);
+		if (color) {
+			tTransformJob job = { image, image, o, calculateBandRows(image), 0, color };
+			threadPoolRun(pool, calculateBandCount(&job, image->height), colorRowsTask, &job);
+		}
+		if (o.flipY) return flipView(image);
+		return image;
+	}
+
+	// The flips in o come after the transpose, so do them as a second in-place pass, which then takes the colors.
+	if (image->width == image->height || lowMemory) {
+		o.transpose = false;
+		bool square = image->width == image->height;
+		const tColor *transposeColor = square && orientIsIdentity(o) ? color : NULL;
+		if (square) {
+			transposeSquareInPlace(image, transposeColor, pool);
+		} else if (!transposeInPlace(image)) {
+			return NULL;
+		}
+		return transformBmp(image, o, transposeColor ? NULL : color, lowMemory, pool);
+	}
+
+	tImage *newBmp = createImage(image->height, image->width, image->bpp, image->buffers);
+	if (newBmp == NULL) return NULL;
+	transformBmpInto(image, newBmp, o, color, pool);
+	freeImage(image);
+	return newBmp;
+}
+
+/* rotates image n % 4 times clockwise
+ * @params: bmpToRot - image to be rotated
+ *			n - number of times to rotate
+ *			pool - threads to share the work, or NULL
+ * Returns: rotated image
+ */
+
+tImage *rotateBmp(tImage *bmpToRot, int n, tThreadPool *pool) {
+	tOrient o = { false, false, false };
+	return transformBmp(bmpToRot, orientRotate(o, n), NULL, false, pool);
+}
+
+/* rotates a band of row pairs a half turn: each row in the bottom half is
+ * swapped with the reverse of its mirror row in the top half, and both
+ * are given the colors of the job, if any
  */
 
-void updateBmpInfo(int newWidth, int newHeight) {
-	bmpInfoHeader.width = newWidth;
-	bmpInfoHeader.height = newHeight;
+static void rotate180Task(void *arg, int task) {
+	tImage *image = ((tTransformJob *)arg)->dst;
+	int bandRows = ((tTransformJob *)arg)->bandRows;
+	const tColor *color = ((tTransformJob *)arg)->color;
+	int rows = image->height;
+	int cols = image->width;
+	size_t rowSize = (size_t)cols * pixelSize(image);
+	int end = (task + 1) * bandRows < (rows+1)/2 ? (task + 1) * bandRows : (rows+1)/2;
+	byte *temp = createRowBuffer(image);
+
+	for (int i = task * bandRows; i < end; i++) {
+		byte *lo = (byte *)imageRow(image, i);
+		byte *hi = (byte *)imageRow(image, rows-(i+1));
+		if (temp == NULL) {
+			reverseSwapRows(lo, hi, cols, pixelSize(image));
+		} else {
+			reverseRow(temp, lo, cols, image->bpp);
+			// The middle row of an odd height image is its own mirror.
+			if (lo != hi) reverseRow(lo, hi, cols, image->bpp);
+			memcpy(hi, temp, rowSize);
+		}
+		colorRow(color, lo, cols, pixelSize(image));
+		if (lo != hi) colorRow(color, hi, cols, pixelSize(image));
+	}
+
+	giveBuffer(image->buffers, temp);
+}
+
+tImage *rotateBmp180(tImage *bmpToRot, const tColor *color, tThreadPool *pool) {
+	tTransformJob job = { bmpToRot, bmpToRot, { false, false, false }, calculateBandRows(bmpToRot), 0, color };
+	threadPoolRun(pool, calculateBandCount(&job, (bmpToRot->height+1)/2), rotate180Task, &job);
+	return bmpToRot;
 }
 
+static void flipHorizTask(void *arg, int task) {
+	tImage *image = ((tTransformJob *)arg)->dst;
+	int bandRows = ((tTransformJob *)arg)->bandRows;
+	const tColor *color = ((tTransformJob *)arg)->color;
+	int cols = image->width;
+	size_t rowSize = (size_t)cols * pixelSize(image);
+	int end = (task + 1) * bandRows < image->height ? (task + 1) * bandRows : image->height;
+	byte *temp = createRowBuffer(image);
+	
+	for (int i = task * bandRows; i < end; i++) {
+		byte *row = (byte *)imageRow(image, i);
+		if (temp == NULL) {
+			reverseSwapRows(row, row, cols, pixelSize(image));
+		} else {
+			reverseRow(temp, row, cols, image->bpp);
+			memcpy(row, temp, rowSize);
+		}
+		colorRow(color, row, cols, pixelSize(image));
+	}
+
+	giveBuffer(image->buffers, temp);
+}
+
+tImage *flipBmpHoriz(tImage *bmpToHorFlip, const tColor *color, tThreadPool *pool){
+	tTransformJob job = { bmpToHorFlip, bmpToHorFlip, { false, false, false }, calculateBandRows(bmpToHorFlip), 0,
+		color };
+	threadPoolRun(pool, calculateBandCount(&job, bmpToHorFlip->height), flipHorizTask, &job);
+	return bmpToHorFlip;
+}
+
+static void flipVerTask(void *arg, int task) {
+	tImage *image = ((tTransformJob *)arg)->dst;
+	int bandRows = ((tTransformJob *)arg)->bandRows;
+	int rows = image->height;
+	size_t rowSize = (size_t)image->width * pixelSize(image);
+	int end = (task + 1) * bandRows < rows/2 ? (task + 1) * bandRows : rows/2;
+	
+	for (int i = task * bandRows; i < end; i++) {
+		swapRows((byte *)imageRow(image, i), (byte *)imageRow(image, rows-(i+1)), rowSize);
+	}
+}
+
+tImage *flipBmpVer(tImage *bmpToFlipVer, tThreadPool *pool){
+	tTransformJob job = { bmpToFlipVer, bmpToFlipVer, { false, false, false }, calculateBandRows(bmpToFlipVer) };
+	threadPoolRun(pool, calculateBandCount(&job, bmpToFlipVer->height/2), flipVerTask, &job);
+	return bmpToFlipVer;
+}
@@ -1,12 +1,42 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 #include "Bmp.h"
+#include "Color.h"
+#include "Thread.h"
+
+/* An element of the 8 orientations reachable with flips and quarter turns:
+ * transpose first if set, then reverse the columns if flipX, then the rows
+ * if flipY. Any chain of --fliph, --flipv and --rotr reduces to one of these.
+ */
+typedef struct {
+	bool	transpose;
+	bool	flipX;
+	bool	flipY;
+} tOrient;
+
+// Every image buffer and every row within it starts on a 64-byte boundary.
+#define cImageAlign 64
+
+/* Returns a pointer to the first pixel of row r of img.
+ */
+static inline tPixel *imageRow(const tImage *img, int r) {
+	return (tPixel *)(img->pixels + (ptrdiff_t)r * img->stride);
+}
 
 //function declarations
-tPixel **rotateBmp(tPixel**, int);
-tPixel** flipBmpHoriz(tPixel **);
-tPixel ** flipBmpVer(tPixel **);
-tPixel **flipVert(tPixel **bmpToFlip);
-void updateBmpInfo(int, int);
+size_t calculateImageSize(int width, int height, int bpp);
+tImage *createImage(int width, int height, int bpp, tBufferPool *);
+void freeImage(tImage *);
+tOrient orientFlipH(tOrient);
+tOrient orientFlipV(tOrient);
+tOrient orientRotate(tOrient, int);
+bool orientIsIdentity(tOrient);
+tRegion orientSourceRegion(tOrient, int width, int height, tRegion);
+void transformBmpInto(const tImage *src, tImage *dst, tOrient, const tColor *, tThreadPool *);
+tImage *transformBmp(tImage *, tOrient, const tColor *, bool lowMemory, tThreadPool *);
+tImage *rotateBmp(tImage *, int, tThreadPool *);
+tImage *rotateBmp180(tImage *, const tColor *, tThreadPool *);
+tImage *flipBmpHoriz(tImage *, const tColor *, tThreadPool *);
+tImage *flipBmpVer(tImage *, tThreadPool *);
 
-#endif
\ No newline at end of file
+#endif
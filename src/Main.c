@@ -9,30 +9,104 @@
  *
  **************************************************************************************************************/
 #include <stdbool.h>  // For bool data type
+#include <errno.h>    // For errno
+#include <signal.h>   // For sigaction()
+#include <stdint.h>   // For SIZE_MAX
 #include <stdio.h>    // For printf()
 #include <stdlib.h>   // For exit(), strtod()
+#include <string.h>   // For strtok_r()
+#include <sys/stat.h> // For stat()
+#include <unistd.h>   // For close(), unlink()
 #include "Main.h"
 #include "Arg.h"
 #include "Error.h"
 #include "String.h"
-#include "Bmp.h"
-#include "Image.h"
+#include "Bimpie.h"
+#include "Serve.h"
+#include "Trace.h"
 //==============================================================================================================
 // TYPEDEFS 
 //==============================================================================================================
+typedef struct {
+	char   *name;			// "fliph", "flipv", "rotr", "crop", "resize", "filter", "thumbnail", or a color or
+							// convolution operation
+	int		arg;			// The argument n following --rotr or --thumbnail, or the cBimpieFilter of --filter
+	tBimpieRect rect;		// The region following --crop, or the size following --resize
+	double	value;			// The argument following --brightness, --contrast, --gamma or --blur
+	char   *file;			// The file name following --kernel
+} tCmd;
+
+// What the operations on one file add up to: a region of the file, turned to one orientation and maybe resized.
+typedef struct {
+	tBimpieRect		rect;		// The region of the file the output is made from, the whole file without --crop
+	tBimpieOrient	orient;
+	bool			resize;		// The output is width x height pixels instead of the size of rect
+	int				width;
+	int				height;
+	int				filter;		// The cBimpieFilter of the resize
+	int				thumbnail;	// The largest side of a --thumbnail, 0 for none
+	bool			color;		// The colors change, after any resize and convolution
+	bool			convolve;	// The image is blurred, sharpened or convolved, after any resize
+} tPlan;
+
  typedef struct {
 	int		argc;			// argc from main()
 	char  **argv;			// argv from main()
-	bool	fliph;			// --fliph was specified
+	bool	blur;			// --blur sigma
+	bool	brightness;		// --brightness n
+	bool	contrast;		// --contrast f
+	bool	crop;			// --crop x,y,w,h was specified
+	bool	filter;			// --filter name
+	bool	fliph;			// --fliph
 	bool	flipv;			// --flipv
 	bool	h;				// -h, --help
-	char   *inFile;			// The file name of the input BMP image
+	bool	inPlace;		// --in-place
+	bool	invert;			// --invert
+	char  **inFiles;		// The file names of the input BMP images
+	int		inFileCount;	// The number of input file names
+	int		inFileMax;		// The number of file names inFiles has room for
+	bool	fromList;		// --from-list listfile
+	bool	gamma;			// --gamma g
+	bool	grayscale;		// --grayscale
+	bool	journal;		// --journal
+	bool	kernel;			// --kernel file
+	bool	lowMemory;		// --low-memory
+	bool	maxMemory;		// --max-memory size
+	size_t	memoryLimit;	// The argument size following --max-memory, in bytes
+	bool	mmap;			// --mmap
 	bool	o;				// -o file, --output file
-	char   *outFile;		// The output file name following -o or --output
-	int		rotArg;			// The argument n following --rotr
+	char   *outFile;		// The output file name or template following -o or --output
+	bool	reserve;		// --reserve size
+	bool	resize;			// --resize WxH
+	size_t	reserveSize;		// The argument size following --reserve, in bytes
 	bool	rotr;			// --rotr n
+	bool	serve;			// --serve socket
+	bool	sharpen;		// --sharpen
+	char   *socketFile;		// The socket file name following --serve
+	bool	stats;			// --stats
+	bool	thumbnail;		// --thumbnail maxdim
+	bool	trace;			// --trace file
+	char   *traceFile;		// The file name following --trace
+	bool	threads;		// --threads n
+	int		threadCount;	// The argument n following --threads
 	bool	v;				// -v, --version
 } tCmdLine;
+
+// The state shared by the files of a batch while they are processed on the library's threads.
+typedef struct {
+	tCmdLine   *cmdLine;
+	tBimpie	   *bimpie;			// The threads and buffers all the files share
+	tTrace	   *trace;			// The stages of each file for --stats and --trace, NULL if neither was given
+	int			failures;		// The number of files that could not be processed
+} tBatch;
+
+// What the server threads of --serve share.
+typedef struct {
+	tCmdLine   *cmdLine;
+	tBimpie	   *bimpie;
+	tJobServer *jobServer;		// The socket the clients connect to, and their connections
+	size_t		keepBuffers;	// The bytes of free buffers kept after each job
+} tServer;
 //==============================================================================================================
 // CONSTANT DEFINITIONS
 //==============================================================================================================
@@ -41,40 +115,75 @@ const char *cAuthor  = "Brian Blanchard <bcblanch@asu.edu>";
 const char *cBinary  = "bimpie";
 const char *cVersion = "1.0 (2013.3.11)";
 
+// The bytes of free buffers a server keeps for each thread after a job, besides those --reserve set aside, unless
+// --max-memory says otherwise: as much as the library holds of one image by default.
+static const size_t cKeepBuffers = (size_t)256 << 20;
+
 //==============================================================================================================
 // VARIABLE DECLARATIONS
 //==============================================================================================================
-char *cmdOrder[3];
+// The image operations in command line order. An operation may be given more than once.
+tCmd *cmdOrder;
 int cmdOrderCount = 0;
+
+// Set by SIGINT or SIGTERM to make --serve finish the jobs it is running and exit.
+static volatile sig_atomic_t stopServer = 0;
 //==============================================================================================================
 // FUNCTION DECLARATIONS
 //==============================================================================================================
-static tPixel** callFuncInOrder(tCmdLine*, tPixel**);
+static void AddInFile(tCmdLine *, char *pFile);
+static int callFuncInOrder(tBimpie *, tCmdLine*, tBimpieOrient, tBimpieImage*);
+static tPlan ReduceCmdOrder(tCmd *pCmds, int pCount, int pWidth, int pHeight);
 static bool CheckDupOpt(bool pOptFlag, char *pOptStr);
+static int Convolve(tBimpie *, tBimpieImage *, tCmd *pCmds, int pCount, tBimpieOrient);
 static void Help();
-static void Run(tCmdLine *);
+static void MakeOutFileName(char *pTemplate, char *pInFile, char *pOutFile, size_t pSize);
+static const char *OrientStage(tBimpieOrient);
+static int ProcessFile(tCmdLine *, char *pInFile, char *pOutFile, tCmd *pCmds, int pCmdCount, tBimpie *, tTrace *);
+static void ProcessFileTask(void *pArg, int pTask);
+static bool SameFile(char *pFile1, char *pFile2);
+static bool ScanOps(char *pOps, tCmd *pCmds, int *pCount);
+static void ReadFileList(tCmdLine *, char *pListFile);
+static int RunJob(void *pArg, tJob *pJob, char *pMessage, char *pStages, size_t pSize);
+static int Run(tCmdLine *);
+static int RunServer(tCmdLine *, tBimpie *);
 static void ScanCmdLine(tCmdLine *);
+static double ScanColorArg(char *pOpt, char *pArg);
+static bool ScanCropArg(char *pArg, tBimpieRect *pRect);
+static int ScanFilterArg(char *pArg);
+static bool ScanResizeArg(char *pArg, tBimpieRect *pSize);
 static int ScanRotArg(char *pOpt, char *pArg);
+static size_t ScanSizeArg(char *pOpt, char *pArg);
+static int ScanThreadsArg(char *pOpt, char *pArg);
+static void ServeTask(void *pArg, int pTask);
+static int SetColors(tBimpie *, tBimpieImage *, tCmd *pCmds, int pCount);
+static void StopServer(int pSignal);
 static void Version();
 
 //==============================================================================================================
 // FUNCTION DEFINITIONS
 //==============================================================================================================
-static tPixel** callFuncInOrder(tCmdLine *pCmdLine, tPixel **pixelsToProcess) {
-	for (int i = 0; i < cmdOrderCount; i++) {
-		if(strcmp(cmdOrder[i], "fliph") == 0) {
-			pixelsToProcess = flipBmpHoriz(pixelsToProcess);
-		}
-		else if (strcmp(cmdOrder[i], "flipv") == 0) {
-			pixelsToProcess = flipBmpVer(pixelsToProcess);
-		}
-		else if (strcmp(cmdOrder[i], "rotr") == 0) {
-			pixelsToProcess = rotateBmp(pixelsToProcess, pCmdLine->rotArg);
-		}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: AddInFile()
+ *
+ * DESCRIPTION
+ * Appends a copy of pFile to the list of input files, growing the list as needed.
+ *------------------------------------------------------------------------------------------------------------*/
+static void AddInFile(tCmdLine *pCmdLine, char *pFile)
+{
+	if (pCmdLine->inFileCount == pCmdLine->inFileMax) {
+		pCmdLine->inFileMax = pCmdLine->inFileMax ? 2 * pCmdLine->inFileMax : 16;
+		pCmdLine->inFiles = (char **) realloc(pCmdLine->inFiles, pCmdLine->inFileMax * sizeof(char *));
+		if (!pCmdLine->inFiles) ErrorExit(cErrorMemory, "out of memory");
 	}
+	if (!(pCmdLine->inFiles[pCmdLine->inFileCount++] = strdup(pFile))) ErrorExit(cErrorMemory, "out of memory");
+}
 
-	return pixelsToProcess;
+static int callFuncInOrder(tBimpie *pBimpie, tCmdLine *pCmdLine, tBimpieOrient pO, tBimpieImage *pixelsToProcess) {
+	return bimpieTransform(pBimpie, pixelsToProcess, pO, pCmdLine->lowMemory);
 }
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: CheckDupOpt()
  *
@@ -88,6 +197,37 @@ static bool CheckDupOpt(bool pOptFlag, char *pOptStr)
 	return true;
 }
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: Convolve()
+ *
+ * DESCRIPTION
+ * Runs the --blur, --sharpen and --kernel operations among pCmds, in order, on the pixels of pImage, each as it
+ * would look on the image turned to pO. A kernel file is read for every image, so one that changes between the
+ * jobs of a server is picked up.
+ *
+ * RETURNS
+ * 0 or a cBimpieError code.
+ *------------------------------------------------------------------------------------------------------------*/
+static int Convolve(tBimpie *pBimpie, tBimpieImage *pImage, tCmd *pCmds, int pCount, tBimpieOrient pO)
+{
+	int status = 0;
+	for (int i = 0; i < pCount && status == 0; i++) {
+		tBimpieKernel *kernel = NULL;
+		if (streq(pCmds[i].name, "blur")) {
+			status = bimpieKernelBlur(pCmds[i].value, &kernel);
+		} else if (streq(pCmds[i].name, "sharpen")) {
+			status = bimpieKernelSharpen(&kernel);
+		} else if (streq(pCmds[i].name, "kernel")) {
+			status = bimpieKernelRead(pCmds[i].file, &kernel);
+		} else {
+			continue;
+		}
+		if (status == 0) status = bimpieConvolve(pBimpie, pImage, kernel, pO);
+		bimpieKernelFree(kernel);
+	}
+	return status;
+}
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: Help()
  *
@@ -96,16 +236,81 @@ static bool CheckDupOpt(bool pOptFlag, char *pOptStr)
  *------------------------------------------------------------------------------------------------------------*/
 static void Help()
 {
-	printf("Usage: %s [options] bmpfile\n", cBinary);
-	printf("Perform image processing operations on a BMP image.\n\n");
+	printf("Usage: %s [options] bmpfile...\n", cBinary);
+	printf("Perform image processing operations on one or more BMP images.\n\n");
 	printf("Options:\n\n");
+	printf("    --blur sigma             Blurs the image with a Gaussian of standard deviation 'sigma' pixels, up\n");
+	printf("                             to 42.\n");
+	printf("    --brightness n           Adds 'n', from -255 to 255, to the blue, green and red of every pixel.\n");
+	printf("    --contrast f             Scales how far the blue, green and red of every pixel are from the middle\n");
+	printf("                             by 'f': above 1 gives more contrast, below 1 less, and 0 a flat gray.\n");
+	printf("    --crop x,y,w,h           Crops the image to the 'w' x 'h' pixels whose top left corner is 'x' pixels\n");
+	printf("                             from the left and 'y' from the top, clipped to the image. Only the rows\n");
+	printf("                             and parts of rows of the file that end up in the output are ever read.\n");
+	printf("    --filter name            Resizes with the filter 'name': box, which averages the pixels each new\n");
+	printf("                             one covers, weighing each by how much of it is covered, bilinear (the\n");
+	printf("                             default) or lanczos, the sharpest and slowest.\n");
 	printf("    --fliph                  Flips the image horizontally.\n");
-	printf("    --flipv                  Flips the image vertically.\n");
+	printf("    --flipv                  Flips the image vertically. When that is all the operations add up to,\n");
+	printf("                             the rows are written out as they are and the file is turned over.\n");
+	printf("    --from-list listfile     Also process the files named in 'listfile', one per line.\n");
+	printf("    --gamma g                Gamma corrects the image: above 1 brightens the darker colors, below 1\n");
+	printf("                             darkens them.\n");
+	printf("    --grayscale              Turns the image to shades of gray.\n");
 	printf("    -h, --help               Display a help message and exit.\n");
-	printf("    -o file, --output file   Write the modified image to 'file' in .bmp format.\n");
+	printf("    --in-place               Flip or half turn each file where it lies, when it is its own output,\n");
+	printf("                             holding a few MB and making no copy of it on disk.\n");
+	printf("    --invert                 Inverts the colors of the image.\n");
+	printf("    --journal                With --in-place, journal each change first so that an edit cut short by\n");
+	printf("                             a crash is undone the next time the file is opened.\n");
+	printf("    --kernel file            Convolves the image with the kernel in 'file': a row of weights per line,\n");
+	printf("                             the top row first, separated by spaces or commas, as the pixels they\n");
+	printf("                             weigh lie around the middle one. The width and height must be odd. The\n");
+	printf("                             weights are divided by their sum unless it is 0, as for edge detection.\n");
+	printf("    --low-memory             Rotate in place, keeping memory use close to the image size.\n");
+	printf("    --max-memory size        Hold at most 'size' bytes of pixels for each file, e.g., 512M or 2G. Images\n");
+	printf("                             that need more are never read in whole: they are streamed to the output\n");
+	printf("                             in strips, rotations through a scratch file of tiles next to it.\n");
+	printf("    --mmap                   Map the input and output files instead of reading and writing them.\n");
+	printf("    -o file, --output file   Write the modified image to 'file' in .bmp format. With several input\n");
+	printf("                             files, 'file' is a template in which %%f is replaced by the input file\n");
+	printf("                             name, %%b by that name without its extension, %%d by the directory of\n");
+	printf("                             the input file and %%%% by %%, e.g., -o out/%%b-rotated.bmp.\n");
+	printf("    --reserve size           With --serve, allocate two buffers of 'size' bytes per thread up front,\n");
+	printf("                             about the size of the images to come, so the first jobs find them ready.\n");
+	printf("                             After each job, free buffers beyond those plus the --max-memory size (256\n");
+	printf("                             MB by default) per thread are given back to the system.\n");
+	printf("    --resize WxH             Resizes the image to 'W' x 'H' pixels. Rotations before or after it are done\n");
+	printf("                             in the same pass. Only 24 and 32-bit images can be resized, and --crop\n");
+	printf("                             must come before --resize.\n");
 	printf("    --rotr n                 Rotate the image 90 degs right (clockwise) n mod 4 times.\n");
+	printf("    --serve socket           Stay running and take jobs from clients on the Unix domain socket\n");
+	printf("                             'socket' instead of processing files: one job per line, 'ops<TAB>input\n");
+	printf("                             <TAB>output', e.g., 'rotr 1 fliph<TAB>in.bmp<TAB>out.bmp', answered by\n");
+	printf("                             'status<TAB>microseconds<TAB>message<TAB>stages'. Each thread runs one job\n");
+	printf("                             at a time. SIGINT or SIGTERM stops the server. See bimpie-client.\n");
+	printf("    --sharpen                Sharpens the image with a 3x3 unsharp mask.\n");
+	printf("    --stats                  Print the time, bytes read and written, and pixels/s of each stage:\n");
+	printf("                             header parse, pixel decode, transform and encode.\n");
+	printf("    --thumbnail maxdim       Shrinks the image by the smallest whole factor n that makes it fit in\n");
+	printf("                             'maxdim' x 'maxdim' pixels, as it is read: each pixel is the average of n\n");
+	printf("                             x n, or for 8 and 16-bit images the middle one. The full size image is\n");
+	printf("                             never held in memory. Not with --crop or --resize.\n");
+	printf("    --trace file             Write the stages of every file to 'file' as Chrome trace events JSON,\n");
+	printf("                             for chrome://tracing or Perfetto.\n");
+	printf("    --threads n              Use n threads. Default: the number of online CPUs.\n");
 	printf("    -v, --version            Display version info and exit.\n\n");
-	printf("By default, the modified image is written to 'bmpfile'.\n");
+	printf("Flips and half turns stream each file through in strips, reading, transforming and writing at once.\n");
+	printf("By default, each modified image is written back to its 'bmpfile', through a temporary file that is\n");
+	printf("renamed over it, so a crash leaves either the old file or the new one. The new file gets the mode and\n");
+	printf("owner of the old one, but other hard links to the old one are left naming it. The files are processed\n");
+	printf("concurrently; a file that fails is reported and the others are still processed.\n\n");
+	printf("The color operations are applied in the order given, after any resize, in the same pass as the rest:\n");
+	printf("they add no pass over the pixels of their own unless there is nothing else to do. 8-bit images have\n");
+	printf("their palette changed instead; the colors of 16-bit images cannot be changed.\n\n");
+	printf("--blur, --sharpen and --kernel are applied in the order given, after any crop, resize or thumbnail\n");
+	printf("and before the colors change, to the image as it is turned and flipped in the output. Pixels past\n");
+	printf("the edges are taken to be the edge pixels. Only 24 and 32-bit images can be convolved.\n");
 	exit(0);
 }
 
@@ -125,26 +330,440 @@ int main(int pArgc, char *pArgv[])
 	cmdLine.argc = pArgc;
 	cmdLine.argv = pArgv;
 	ScanCmdLine(&cmdLine);
-	Run(&cmdLine);
-	return 0;
+	int failures = Run(&cmdLine);
+
+	for (int i = 0; i < cmdLine.inFileCount; i++) free(cmdLine.inFiles[i]);
+	free(cmdLine.inFiles);
+	free(cmdOrder);
+	return failures == 0 ? 0 : EXIT_FAILURE;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: MakeOutFileName()
+ *
+ * DESCRIPTION
+ * Builds the output file name for pInFile from the -o template pTemplate, replacing %f with the input file name,
+ * %b with the input file name less its extension, %d with the directory of the input file, and %% with %.
+ *------------------------------------------------------------------------------------------------------------*/
+static void MakeOutFileName(char *pTemplate, char *pInFile, char *pOutFile, size_t pSize)
+{
+	char *name = strrchr(pInFile, '/') ? strrchr(pInFile, '/') + 1 : pInFile;
+	char *ext = strrchr(name, '.');
+	int baseLen = ext && ext != name ? (int)(ext - name) : (int)strlen(name);
+	int dirLen = name == pInFile ? 1 : (int)(name - pInFile - 1);
+	char *dir = name == pInFile ? "." : pInFile;
+
+	size_t len = 0;
+	pOutFile[0] = '\0';
+	for (char *t = pTemplate; *t && len + 1 < pSize; t++) {
+		if (*t == '%' && t[1] == 'f') {
+			len += snprintf(pOutFile + len, pSize - len, "%s", name);
+			t++;
+		} else if (*t == '%' && t[1] == 'b') {
+			len += snprintf(pOutFile + len, pSize - len, "%.*s", baseLen, name);
+			t++;
+		} else if (*t == '%' && t[1] == 'd') {
+			len += snprintf(pOutFile + len, pSize - len, "%.*s", dirLen, dir);
+			t++;
+		} else {
+			if (*t == '%' && t[1] == '%') t++;
+			pOutFile[len++] = *t;
+			pOutFile[len] = '\0';
+		}
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: OrientStage()
+ *
+ * DESCRIPTION
+ * Returns the name of the transform stage for orientation pO. However many operations are on the command line,
+ * they are reduced to one orientation and applied in one pass, so that pass is the one stage they all share.
+ *------------------------------------------------------------------------------------------------------------*/
+static const char *OrientStage(tBimpieOrient pO)
+{
+	static const char *stages[] = { "transform none", "transform flipv", "transform fliph", "transform rotr 2",
+		"transform transpose", "transform rotr 1", "transform rotr 3", "transform transverse" };
+	return stages[pO.transpose * 4 + pO.flipX * 2 + pO.flipY];
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ProcessFile()
+ *
+ * DESCRIPTION
+ * Reads pInFile, applies the pCmdCount operations pCmds to it and writes the result to pOutFile, recording each
+ * stage in pTrace. Nothing in here exits; on failure the cBimpieError code is returned and bimpieLastError() says what
+ * went wrong, so one bad file cannot stop a batch or a server.
+ *
+ * REMARKS
+ * Flips and half turns, and any image that needs more memory than --max-memory allows, are streamed to the output
+ * without being decoded: the reads, transforms and writes of successive strips overlap, so they are all counted in
+ * one transform stage. With --mmap the pixels are paged in and out while they are transformed, so the bytes of the
+ * file are counted in the transform stage too, which also unmaps the output and moves it into place. With
+ * --in-place, a flip or half turn of a file that is its own output is done on the file itself, so it has no
+ * encode stage either; not when the colors change, though. A crop is decoded on its own, reading just the pixels
+ * it keeps, then transformed. A resize turns the image to its orientation on the way, in the resize stage. A
+ * thumbnail is shrunk as it is decoded and then transformed. A convolution needs the whole image decoded too,
+ * and comes after any resize but before the transform, its kernels turned to match. The colors change in
+ * whichever stage moves the pixels.
+ *------------------------------------------------------------------------------------------------------------*/
+static int ProcessFile(tCmdLine *pCmdLine, char *pInFile, char *pOutFile, tCmd *pCmds, int pCmdCount,
+	tBimpie *pBimpie, tTrace *pTrace)
+{
+	tBimpieImage *image;
+	double start = traceTime(pTrace);
+	int status = bimpieOpen(pBimpie, pInFile, &image);
+	traceStage(pTrace, "header", pInFile, start, 0, 0, 0);
+	if (status != 0) return status;
+	int width = bimpieWidth(image), height = bimpieHeight(image);
+	long pixels = (long)width * height;
+	size_t bytesRead = bimpieBytesRead(image);
+
+	tPlan plan = ReduceCmdOrder(pCmds, pCmdCount, width, height);
+	tBimpieOrient pO = plan.orient;
+	if (plan.color && !plan.convolve && (status = SetColors(pBimpie, image, pCmds, pCmdCount)) != 0) {
+		bimpieClose(pBimpie, image);
+		return status;
+	}
+	bool crop = plan.rect.width != width || plan.rect.height != height;
+	if (crop || plan.resize || plan.thumbnail || plan.convolve) {
+		bool map = pCmdLine->mmap && !crop && !plan.thumbnail;
+		start = traceTime(pTrace);
+		if (plan.thumbnail) {
+			status = bimpieDecodeThumbnail(pBimpie, image, plan.thumbnail);
+		} else {
+			pixels = (long)plan.rect.width * plan.rect.height;
+			status = crop ? bimpieDecodeRect(pBimpie, image, plan.rect) : map ? bimpieMap(pBimpie, image) :
+				bimpieDecode(pBimpie, image);
+		}
+		traceStage(pTrace, map ? "map" : "decode", pInFile, start, bimpieBytesRead(image) - bytesRead, 0,
+			map ? 0 : pixels);
+		if (plan.thumbnail) pixels = (long)bimpieWidth(image) * bimpieHeight(image);
+		if (status == 0 && plan.resize) {
+			start = traceTime(pTrace);
+			pixels = (long)plan.width * plan.height;
+			status = bimpieResize(pBimpie, image, pO, plan.width, plan.height, plan.filter);
+			traceStage(pTrace, "resize", pInFile, start, 0, 0, pixels);
+		}
+		if (status == 0 && plan.convolve) {
+			start = traceTime(pTrace);
+			status = Convolve(pBimpie, image, pCmds, pCmdCount, plan.resize ? bimpieIdentity() : pO);
+			traceStage(pTrace, "convolve", pInFile, start, 0, 0, pixels);
+			if (status == 0 && plan.color) status = SetColors(pBimpie, image, pCmds, pCmdCount);
+		}
+		if (status == 0 && !plan.resize) {
+			start = traceTime(pTrace);
+			status = callFuncInOrder(pBimpie, pCmdLine, pO, image);
+			traceStage(pTrace, OrientStage(pO), pInFile, start, 0, 0, pixels);
+		}
+		if (status == 0) {
+			start = traceTime(pTrace);
+			status = bimpieEncode(pBimpie, image, pOutFile);
+			traceStage(pTrace, "encode", pInFile, start, 0, bimpieBytesWritten(image), pixels);
+		}
+		bimpieClose(pBimpie, image);
+		return status;
+	}
+
+	if (pCmdLine->inPlace && !pO.transpose && !plan.color && SameFile(pInFile, pOutFile)) {
+		start = traceTime(pTrace);
+		status = bimpieEditInPlace(pBimpie, image, pO, pInFile, pCmdLine->journal);
+		traceStage(pTrace, OrientStage(pO), pInFile, start, bimpieBytesRead(image) - bytesRead,
+			bimpieBytesWritten(image), pixels);
+		bimpieClose(pBimpie, image);
+		return status;
+	}
+
+	bool stream = (!pO.transpose && !pCmdLine->mmap) || (pCmdLine->maxMemory &&
+		bimpieMemoryNeeded(image, pO, pCmdLine->lowMemory) > pCmdLine->memoryLimit);
+	if (stream) {
+		start = traceTime(pTrace);
+		status = bimpieTransformToFile(pBimpie, image, pO, pOutFile);
+		traceStage(pTrace, OrientStage(pO), pInFile, start, bimpieBytesRead(image) - bytesRead,
+			bimpieBytesWritten(image), pixels);
+		bimpieClose(pBimpie, image);
+		return status;
+	}
+
+	if (pCmdLine->mmap) {
+		start = traceTime(pTrace);
+		status = bimpieMap(pBimpie, image);
+		traceStage(pTrace, "map", pInFile, start, 0, 0, 0);
+		if (status == 0) {
+			start = traceTime(pTrace);
+			status = bimpieTransformToFile(pBimpie, image, pO, pOutFile);
+			traceStage(pTrace, OrientStage(pO), pInFile, start, bimpieBytesRead(image) - bytesRead,
+				bimpieBytesWritten(image), pixels);
+		}
+		bimpieClose(pBimpie, image);
+		return status;
+	}
+
+	start = traceTime(pTrace);
+	status = bimpieDecode(pBimpie, image);
+	traceStage(pTrace, "decode", pInFile, start, bimpieBytesRead(image) - bytesRead, 0, pixels);
+
+	if (status == 0) {
+		start = traceTime(pTrace);
+		status = callFuncInOrder(pBimpie, pCmdLine, pO, image);
+		traceStage(pTrace, OrientStage(pO), pInFile, start, 0, 0, pixels);
+	}
+
+	if (status == 0) {
+		start = traceTime(pTrace);
+		status = bimpieEncode(pBimpie, image, pOutFile);
+		traceStage(pTrace, "encode", pInFile, start, 0, bimpieBytesWritten(image), pixels);
+	}
+
+	bimpieClose(pBimpie, image);
+	return status;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ProcessFileTask()
+ *
+ * DESCRIPTION
+ * Processes input file number pTask of a batch on one of the library's threads and reports it if it fails.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ProcessFileTask(void *pArg, int pTask)
+{
+	tBatch *batch = (tBatch *) pArg;
+	char *inFile = batch->cmdLine->inFiles[pTask];
+	char outFile[4096];
+	if (batch->cmdLine->outFile) {
+		MakeOutFileName(batch->cmdLine->outFile, inFile, outFile, sizeof(outFile));
+	} else {
+		snprintf(outFile, sizeof(outFile), "%s", inFile);
+	}
+
+	if (ProcessFile(batch->cmdLine, inFile, outFile, cmdOrder, cmdOrderCount, batch->bimpie, batch->trace) != 0) {
+		printf("%s: %s: %s\n", cBinary, inFile, bimpieLastError());
+		__atomic_fetch_add(&batch->failures, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ReadFileList()
+ *
+ * DESCRIPTION
+ * Adds the file names in pListFile, one per line, to the input files. Blank lines are skipped.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ReadFileList(tCmdLine *pCmdLine, char *pListFile)
+{
+	FILE *list = fopen(pListFile, "r");
+	if (!list) ErrorExit(cErrorFileOpenRead, "cannot open file list %s", pListFile);
+
+	char line[4096];
+	while (fgets(line, sizeof(line), list)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0') continue;
+		AddInFile(pCmdLine, line);
+	}
+	fclose(list);
 }
 
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: Run()
  *
  * DESCRIPTION
+ * Processes every input file. A single file gets all the threads for its transforms. Several files are spread
+ * over the threads, one file per task, each transformed on the thread that picked it up. All the files share
+ * the buffers of one library context, so once the first few have been processed the rest reuse their memory.
+ *
+ * RETURNS
+ * The number of files that failed.
  *------------------------------------------------------------------------------------------------------------*/
-static void Run(tCmdLine *pCmdLine)
+static int Run(tCmdLine *pCmdLine)
 {	
-	tPixel **processedBmp;
-	readBmpHeaders(pCmdLine->inFile);
-	processedBmp = readBmpPixels(pCmdLine);
-	// processedBmp = rotateBmp(processedBmp, pCmdLine->rotArg);
-	processedBmp = callFuncInOrder(pCmdLine, processedBmp);
-	if (!pCmdLine->outFile) {
-		pCmdLine->outFile = pCmdLine->inFile;
-	}
-	writeBmp(pCmdLine->outFile, processedBmp);
+	tBimpie *bimpie = bimpieCreate(pCmdLine->threads ? pCmdLine->threadCount : 0);
+	if (bimpie == NULL) ErrorExit(cErrorMemory, "cannot start the worker threads");
+	if (pCmdLine->maxMemory) bimpieSetMaxMemory(bimpie, pCmdLine->memoryLimit);
+	if (pCmdLine->serve) {
+		int failures = RunServer(pCmdLine, bimpie);
+		bimpieFree(bimpie);
+		return failures;
+	}
+	tBatch batch = { pCmdLine, bimpie, pCmdLine->stats || pCmdLine->trace ? createTrace() : NULL, 0 };
+
+	bimpieRun(bimpie, pCmdLine->inFileCount, ProcessFileTask, &batch);
+
+	if (pCmdLine->stats) {
+		size_t highWater;
+		long allocs;
+		printTraceStats(batch.trace, stdout);
+		bimpieBufferStats(bimpie, &highWater, &allocs);
+		printf("buffer pool high-water mark %.1f MB in %ld buffers\n", highWater / 1e6, allocs);
+	}
+	if (pCmdLine->trace && writeTraceJson(batch.trace, pCmdLine->traceFile) != 0) {
+		printf("%s: %s: %s\n", cBinary, pCmdLine->traceFile, "The trace could not be written.");
+		batch.failures++;
+	}
+
+	freeTrace(batch.trace);
+	bimpieFree(bimpie);
+	return batch.failures;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RunJob()
+ *
+ * DESCRIPTION
+ * Runs one job that came to --serve, the same way a file on the command line is processed but with the
+ * operations and output of the job. The stages of the job go back to its client instead of to --stats.
+ *------------------------------------------------------------------------------------------------------------*/
+static int RunJob(void *pArg, tJob *pJob, char *pMessage, char *pStages, size_t pSize)
+{
+	tServer *server = (tServer *) pArg;
+
+	// Every operation takes at least two characters of pJob->ops.
+	int count;
+	tCmd *cmds = (tCmd *) malloc((strlen(pJob->ops) / 2 + 1) * sizeof(tCmd));
+	if (cmds == NULL) {
+		snprintf(pMessage, pSize, "out of memory");
+		return cErrorMemory;
+	}
+	if (!ScanOps(pJob->ops, cmds, &count)) {
+		snprintf(pMessage, pSize, "expecting operations such as fliph, flipv, rotr n, crop x,y,w,h, resize WxH, "
+			"thumbnail n, grayscale or blur sigma");
+		free(cmds);
+		return cErrorArg;
+	}
+
+	tTrace *trace = createTrace();
+	int status = ProcessFile(server->cmdLine, pJob->input, pJob->output, cmds, count, server->bimpie, trace);
+	if (status != 0) snprintf(pMessage, pSize, "%s", bimpieLastError());
+	formatTraceStages(trace, pStages, pSize);
+	freeTrace(trace);
+	free(cmds);
+	bimpieTrimBuffers(server->bimpie, server->keepBuffers);
+	return status;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: RunServer()
+ *
+ * DESCRIPTION
+ * Listens on the --serve socket and runs the jobs that come on it until SIGINT or SIGTERM. Every thread of
+ * pBimpie takes jobs from any of the connections, so the threads, and the buffers the jobs leave in the pool,
+ * stay warm from one job to the next. A job runs on the one thread that took it, the same as a file of a batch,
+ * so as many jobs as there are threads run at once. After each job the free buffers beyond what a job may hold
+ * are given back, so one very large job does not keep its memory for the life of the server.
+ *
+ * RETURNS
+ * 0 once the server has stopped.
+ *------------------------------------------------------------------------------------------------------------*/
+static int RunServer(tCmdLine *pCmdLine, tBimpie *pBimpie)
+{
+	int threads = bimpieThreads(pBimpie);
+	if (pCmdLine->reserve && bimpieReserveBuffers(pBimpie, pCmdLine->reserveSize, 2 * threads) != 0) {
+		ErrorExit(cErrorMemory, "--reserve: %s", (char *)bimpieLastError());
+	}
+
+	// Keep what --reserve set aside and what a job may hold free for the next jobs, and give back the rest of
+	// what a larger one took.
+	size_t keep = pCmdLine->maxMemory ? pCmdLine->memoryLimit : cKeepBuffers;
+	size_t keepBuffers = threads * (keep + (pCmdLine->reserve ? 2 * pCmdLine->reserveSize : 0));
+	tServer server = { pCmdLine, pBimpie, NULL, keepBuffers };
+	if ((server.jobServer = createJobServer(pCmdLine->socketFile, RunJob, &server)) == NULL) {
+		ErrorExit(cErrorFileOpen, "%s: cannot listen on the socket: %s", pCmdLine->socketFile,
+			strerror(errno));
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = StopServer;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	printf("%s: serving %s on %d thread%s\n", cBinary, pCmdLine->socketFile, threads, threads == 1 ? "" : "s");
+	fflush(stdout);
+	bimpieRun(pBimpie, threads, ServeTask, &server);
+
+	freeJobServer(server.jobServer);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ReduceCmdOrder()
+ *
+ * DESCRIPTION
+ * Every chain of flips and quarter turns is one of the 8 orientations in tBimpieOrient. Fold the operations in
+ * command line order into that one orientation, so the image is remapped in a single pass no matter how many
+ * operations were given, and chains such as "--rotr 4" or "--fliph --fliph" do no pixel work at all.
+ *
+ * A crop keeps part of whatever image the operations before it made. Mapped back through the orientation they
+ * add up to, that is a part of the pWidth x pHeight image in the file, so every chain is one region of the file
+ * turned to one orientation. Each crop is clipped to the image it cuts; one that misses it leaves an empty
+ * region. A resize, which comes after any crop, scales that region: turning and then resizing is resizing to the
+ * turned size and then turning, so its size is kept as it is before the orientation and turned at the end. The
+ * colors of a pixel do not depend on where it is, so the color operations, which SetColors() chains, can be done
+ * after all the rest. The convolutions, which Convolve() runs, are done on the image as it ends up.
+ *------------------------------------------------------------------------------------------------------------*/
+static tPlan ReduceCmdOrder(tCmd *pCmds, int pCount, int pWidth, int pHeight)
+{
+	tPlan plan = { { 0, 0, pWidth, pHeight }, bimpieIdentity(), false, 0, 0, cBimpieFilterBilinear, 0, false, false };
+	tBimpieRect *pRect = &plan.rect;
+	tBimpieOrient orient = bimpieIdentity();
+	for (int i = 0; i < pCount; i++) {
+		if (streq(pCmds[i].name, "fliph")) {
+			orient = bimpieFlipH(orient);
+		} else if (streq(pCmds[i].name, "flipv")) {
+			orient = bimpieFlipV(orient);
+		} else if (streq(pCmds[i].name, "rotr")) {
+			orient = bimpieRotate(orient, pCmds[i].arg);
+		} else if (streq(pCmds[i].name, "crop")) {
+			// Clip the crop to the image so far, which is the region turned to the orientation so far.
+			tBimpieRect crop = pCmds[i].rect;
+			int width = orient.transpose ? pRect->height : pRect->width;
+			int height = orient.transpose ? pRect->width : pRect->height;
+			if (crop.x >= width || crop.y >= height) {
+				pRect->width = pRect->height = 0;
+				return plan;
+			}
+			if (crop.width > width - crop.x) crop.width = width - crop.x;
+			if (crop.height > height - crop.y) crop.height = height - crop.y;
+
+			tBimpieRect source = bimpieSourceRect(orient, pRect->width, pRect->height, crop);
+			*pRect = (tBimpieRect){ pRect->x + source.x, pRect->y + source.y, source.width, source.height };
+		} else if (streq(pCmds[i].name, "resize")) {
+			plan.resize = true;
+			plan.width = orient.transpose ? pCmds[i].rect.height : pCmds[i].rect.width;
+			plan.height = orient.transpose ? pCmds[i].rect.width : pCmds[i].rect.height;
+		} else if (streq(pCmds[i].name, "filter")) {
+			plan.filter = pCmds[i].arg;
+		} else if (streq(pCmds[i].name, "thumbnail")) {
+			plan.thumbnail = pCmds[i].arg;
+		} else if (streq(pCmds[i].name, "blur") || streq(pCmds[i].name, "sharpen") || streq(pCmds[i].name, "kernel")) {
+			plan.convolve = true;
+		} else {
+			plan.color = true;
+		}
+	}
+
+	// A resize to the size the image already has leaves it as it is.
+	if (plan.resize && plan.width == pRect->width && plan.height == pRect->height) plan.resize = false;
+	if (orient.transpose) {
+		int width = plan.width;
+		plan.width = plan.height;
+		plan.height = width;
+	}
+	plan.orient = orient;
+	return plan;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: SameFile()
+ *
+ * DESCRIPTION
+ * Returns true if pFile1 and pFile2 name the same file, even by different paths or links.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool SameFile(char *pFile1, char *pFile2)
+{
+	struct stat stat1, stat2;
+	if (streq(pFile1, pFile2)) return true;
+	return stat(pFile1, &stat1) == 0 && stat(pFile2, &stat2) == 0 && stat1.st_dev == stat2.st_dev &&
+		stat1.st_ino == stat2.st_ino;
 }
 
 /*--------------------------------------------------------------------------------------------------------------
@@ -159,9 +778,14 @@ static void ScanCmdLine(tCmdLine *pCmdLine)
 	memset(&argScan, 0, sizeof(tArgScan));
 	argScan.argc = pCmdLine->argc;
 	argScan.argv = pCmdLine->argv;
-	argScan.longOpts = "fliph;flipv;help;output:;rotr:;version;";
+	argScan.longOpts = "blur:;brightness:;contrast:;crop:;filter:;fliph;flipv;from-list:;gamma:;grayscale;help;"
+		"in-place;invert;journal;kernel:;low-memory;max-memory:;mmap;output:;reserve:;resize:;rotr:;serve:;sharpen;"
+		"stats;thumbnail:;threads:;trace:;version;";
 	argScan.shortOpts = "ho:v";
 
+	// Each option names at most one operation, so argc entries is always enough.
+	cmdOrder = (tCmd *) malloc(pCmdLine->argc * sizeof(tCmd));
+
 	// Start scanning the command line at argv[1]. Note: argv[0] is always the name of the binary.
 	argScan.index = 1;
 	int result = ArgScan(&argScan);
@@ -182,48 +806,156 @@ static void ScanCmdLine(tCmdLine *pCmdLine)
 		} else if (result == cArgUnexpStr) {
 			ErrorExit(cErrorArgUnexpStr, "%s", argScan.error);
 
-		// Was an argument encountered? The only argument on the command line should be the BMP image file name.
+		// Was an argument encountered? The only arguments on the command line should be BMP image file names.
 		} else if (result == cArg) {
-			// Check for two arguments.
-			if (pCmdLine->inFile) ErrorExit(cErrorArgUnexpStr, "unexpected string %s", argScan.arg);
-			pCmdLine->inFile = argScan.arg;
+			AddInFile(pCmdLine, argScan.arg);
 
-		// We encountered a valid option. Was it --fliph?
-		} else if (streq(argScan.opt, "--fliph")) {
-			pCmdLine->fliph = CheckDupOpt(pCmdLine->fliph, argScan.opt);
+		// We encountered a valid option. Was it --blur? ScanColorArg() does not return if the argument is not a
+		// number.
+		} else if (streq(argScan.opt, "--blur")) {
+			pCmdLine->blur = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "blur", 0, { 0 }, ScanColorArg(argScan.opt, argScan.arg) };
+
+		// Was it --brightness?
+		} else if (streq(argScan.opt, "--brightness")) {
+			pCmdLine->brightness = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "brightness", 0, { 0 }, ScanColorArg(argScan.opt, argScan.arg) };
+
+		// Was it --contrast?
+		} else if (streq(argScan.opt, "--contrast")) {
+			pCmdLine->contrast = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "contrast", 0, { 0 }, ScanColorArg(argScan.opt, argScan.arg) };
+
+		// Was it --crop?
+		} else if (streq(argScan.opt, "--crop")) {
+			pCmdLine->crop = true;
+			cmdOrder[cmdOrderCount] = (tCmd){ "crop", 0 };
+			if (!ScanCropArg(argScan.arg, &cmdOrder[cmdOrderCount++].rect)) {
+				ErrorExit(cErrorArg, "%s: invalid argument %s", argScan.opt, argScan.arg);
+			}
+			if (pCmdLine->resize) ErrorExit(cErrorArg, "%s: expecting it before --resize", argScan.opt);
 
-			if (pCmdLine->fliph) {
-				cmdOrder[cmdOrderCount++] = "fliph";				
+		// Was it --filter? ScanFilterArg() returns -1 if the argument does not name a filter.
+		} else if (streq(argScan.opt, "--filter")) {
+			pCmdLine->filter = CheckDupOpt(pCmdLine->filter, argScan.opt);
+			cmdOrder[cmdOrderCount++] = (tCmd){ "filter", ScanFilterArg(argScan.arg) };
+			if (cmdOrder[cmdOrderCount - 1].arg < 0) {
+				ErrorExit(cErrorArg, "%s: invalid argument %s", argScan.opt, argScan.arg);
 			}
 
+		// Was it --fliph?
+		} else if (streq(argScan.opt, "--fliph")) {
+			pCmdLine->fliph = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "fliph", 0 };
+
 		// Was it --flipv?
 		} else if (streq(argScan.opt, "--flipv")) {
-			pCmdLine->flipv = CheckDupOpt(pCmdLine->flipv, argScan.opt);
+			pCmdLine->flipv = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "flipv", 0 };
 
-			if (pCmdLine->flipv) {
-				cmdOrder[cmdOrderCount++] = "flipv";				
-			}
+		// Was it --from-list?
+		} else if (streq(argScan.opt, "--from-list")) {
+			pCmdLine->fromList = CheckDupOpt(pCmdLine->fromList, argScan.opt);
+			ReadFileList(pCmdLine, argScan.arg);
+
+		// Was it --gamma?
+		} else if (streq(argScan.opt, "--gamma")) {
+			pCmdLine->gamma = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "gamma", 0, { 0 }, ScanColorArg(argScan.opt, argScan.arg) };
+
+		// Was it --grayscale?
+		} else if (streq(argScan.opt, "--grayscale")) {
+			pCmdLine->grayscale = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "grayscale", 0 };
 
 		// Was it -h or --help?
 		} else if (streq(argScan.opt, "-h") || streq(argScan.opt, "--help")) {
 			pCmdLine->h= CheckDupOpt(pCmdLine->h, argScan.opt);
 
+		// Was it --in-place?
+		} else if (streq(argScan.opt, "--in-place")) {
+			pCmdLine->inPlace = CheckDupOpt(pCmdLine->inPlace, argScan.opt);
+
+		// Was it --invert?
+		} else if (streq(argScan.opt, "--invert")) {
+			pCmdLine->invert = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "invert", 0 };
+
+		// Was it --journal?
+		} else if (streq(argScan.opt, "--journal")) {
+			pCmdLine->journal = CheckDupOpt(pCmdLine->journal, argScan.opt);
+
+		// Was it --kernel?
+		} else if (streq(argScan.opt, "--kernel")) {
+			pCmdLine->kernel = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "kernel", 0, { 0 }, 0, argScan.arg };
+
+		// Was it --low-memory?
+		} else if (streq(argScan.opt, "--low-memory")) {
+			pCmdLine->lowMemory = CheckDupOpt(pCmdLine->lowMemory, argScan.opt);
+
+		// Was it --max-memory? ScanSizeArg() does not return if the argument is not a size.
+		} else if (streq(argScan.opt, "--max-memory")) {
+			pCmdLine->maxMemory = CheckDupOpt(pCmdLine->maxMemory, argScan.opt);
+			pCmdLine->memoryLimit = ScanSizeArg(argScan.opt, argScan.arg);
+
+		// Was it --mmap?
+		} else if (streq(argScan.opt, "--mmap")) {
+			pCmdLine->mmap = CheckDupOpt(pCmdLine->mmap, argScan.opt);
+
 		// Was it -o or --output?
 		} else if (streq(argScan.opt, "-o") || streq(argScan.opt, "--output")) {
 			pCmdLine->o = CheckDupOpt(pCmdLine->o, argScan.opt);
 			pCmdLine->outFile = argScan.arg;
 
 			
+		// Was it --reserve? ScanSizeArg() does not return if the argument is not a size.
+		} else if (streq(argScan.opt, "--reserve")) {
+			pCmdLine->reserve = CheckDupOpt(pCmdLine->reserve, argScan.opt);
+			pCmdLine->reserveSize = ScanSizeArg(argScan.opt, argScan.arg);
+
+		// Was it --resize?
+		} else if (streq(argScan.opt, "--resize")) {
+			pCmdLine->resize = CheckDupOpt(pCmdLine->resize, argScan.opt);
+			cmdOrder[cmdOrderCount] = (tCmd){ "resize", 0 };
+			if (!ScanResizeArg(argScan.arg, &cmdOrder[cmdOrderCount++].rect)) {
+				ErrorExit(cErrorArg, "%s: invalid argument %s", argScan.opt, argScan.arg);
+			}
+
 		// Was it --rotr? If so, attempt to convert the argument following --rotr to an integer. ScanRotArg()
 		// does not return if the conversion fails.
 		} else if (streq(argScan.opt, "--rotr")) {
-			pCmdLine->rotr = CheckDupOpt(pCmdLine->rotr, argScan.opt);
-			pCmdLine->rotArg = ScanRotArg(argScan.opt, argScan.arg);
+			pCmdLine->rotr = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "rotr", ScanRotArg(argScan.opt, argScan.arg) };
 
-			if (pCmdLine->rotr) {
-				cmdOrder[cmdOrderCount++] = "rotr";
-			}
+		// Was it --serve?
+		} else if (streq(argScan.opt, "--serve")) {
+			pCmdLine->serve = CheckDupOpt(pCmdLine->serve, argScan.opt);
+			pCmdLine->socketFile = argScan.arg;
 
+		// Was it --sharpen?
+		} else if (streq(argScan.opt, "--sharpen")) {
+			pCmdLine->sharpen = true;
+			cmdOrder[cmdOrderCount++] = (tCmd){ "sharpen", 0 };
+
+		// Was it --stats?
+		} else if (streq(argScan.opt, "--stats")) {
+			pCmdLine->stats = CheckDupOpt(pCmdLine->stats, argScan.opt);
+
+		// Was it --thumbnail? ScanThreadsArg() does not return if the argument is not a positive integer.
+		} else if (streq(argScan.opt, "--thumbnail")) {
+			pCmdLine->thumbnail = CheckDupOpt(pCmdLine->thumbnail, argScan.opt);
+			cmdOrder[cmdOrderCount++] = (tCmd){ "thumbnail", ScanThreadsArg(argScan.opt, argScan.arg) };
+
+		// Was it --threads? ScanThreadsArg() does not return if the argument is not a positive integer.
+		} else if (streq(argScan.opt, "--threads")) {
+			pCmdLine->threads = CheckDupOpt(pCmdLine->threads, argScan.opt);
+			pCmdLine->threadCount = ScanThreadsArg(argScan.opt, argScan.arg);
+
+		// Was it --trace?
+		} else if (streq(argScan.opt, "--trace")) {
+			pCmdLine->trace = CheckDupOpt(pCmdLine->trace, argScan.opt);
+			pCmdLine->traceFile = argScan.arg;
 
 		// Was it -v or --version?
 		} else if (streq(argScan.opt, "-v") || streq(argScan.opt, "--version")) {
@@ -237,10 +969,175 @@ static void ScanCmdLine(tCmdLine *pCmdLine)
 	if (pCmdLine->h) Help();     // Help() does not return.
 	if (pCmdLine->v) Version();  // Version does not return.
 
+	// A server takes its files, operations and outputs from its jobs, and reports the stages of each to its client.
+	if (pCmdLine->serve && (pCmdLine->inFileCount > 0 || cmdOrderCount > 0 || pCmdLine->o || pCmdLine->stats ||
+			pCmdLine->trace)) {
+		ErrorExit(cErrorArg, "--serve: expecting the files, operations and outputs in the jobs");
+	}
+	if (pCmdLine->reserve && !pCmdLine->serve) {
+		ErrorExit(cErrorArg, "--reserve: expecting --serve");
+	}
+
 	// Check that an input file name was specified.
-	if (!pCmdLine->inFile) {
+	if (pCmdLine->inFileCount == 0 && !pCmdLine->serve) {
 		ErrorExit(cErrorArgRot, "expecting input file");
 	}
+
+	// A thumbnail is made of the whole image at a size of its own.
+	if (pCmdLine->thumbnail && (pCmdLine->crop || pCmdLine->resize)) {
+		ErrorExit(cErrorArg, "--thumbnail: expecting no --crop or --resize");
+	}
+
+	// Only an edit in place has anything to journal.
+	if (pCmdLine->journal && !pCmdLine->inPlace) {
+		ErrorExit(cErrorArg, "--journal: expecting --in-place");
+	}
+
+	// Several files cannot all be written to one output file.
+	if (pCmdLine->inFileCount > 1 && pCmdLine->outFile && !strchr(pCmdLine->outFile, '%')) {
+		ErrorExit(cErrorArg, "%s: expecting a template such as %s when there are several input files",
+			pCmdLine->outFile, "out/%b.bmp");
+	}
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanColorArg()
+ *
+ * DESCRIPTION
+ * The --brightness, --contrast, --gamma and --blur options are followed by a number, which may be negative.
+ * Whether it is in range is up to the library.
+ *------------------------------------------------------------------------------------------------------------*/
+static double ScanColorArg(char *pOpt, char *pArg)
+{
+	char *end;
+	double value = strtod(pArg, &end);
+	if (end == pArg || *end != '\0') {
+		ErrorExit(cErrorArg, "%s: invalid argument %s", pOpt, pArg);
+	}
+	return value;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanCropArg()
+ *
+ * DESCRIPTION
+ * The --crop option is followed by x,y,w,h: the top left corner of the region to keep, which must be in the
+ * image, and its width and height, which must be positive.
+ *
+ * RETURNS
+ * false if pArg is not of that form.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool ScanCropArg(char *pArg, tBimpieRect *pRect)
+{
+	char extra;
+	if (sscanf(pArg, "%d,%d,%d,%d%c", &pRect->x, &pRect->y, &pRect->width, &pRect->height, &extra) != 4) {
+		return false;
+	}
+	return pRect->x >= 0 && pRect->y >= 0 && pRect->width > 0 && pRect->height > 0;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanFilterArg()
+ *
+ * DESCRIPTION
+ * The --filter option is followed by the name of a resize filter: box, bilinear or lanczos.
+ *
+ * RETURNS
+ * The cBimpieFilter code of the filter, or -1 if pArg names none.
+ *------------------------------------------------------------------------------------------------------------*/
+static int ScanFilterArg(char *pArg)
+{
+	if (streq(pArg, "box")) return cBimpieFilterBox;
+	if (streq(pArg, "bilinear")) return cBimpieFilterBilinear;
+	if (streq(pArg, "lanczos")) return cBimpieFilterLanczos;
+	return -1;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanOps()
+ *
+ * DESCRIPTION
+ * Scans the operations of a --serve job, e.g., "rotr 1 crop 0,0,100,100", into *pCount entries of pCmds, the way
+ * ScanCmdLine() scans those of the command line. "-" stands for no operation. pOps is split up in the process.
+ *
+ * RETURNS
+ * false if pOps holds anything but fliph, flipv, rotr n, crop x,y,w,h, resize WxH, filter name, thumbnail n,
+ * grayscale, invert, brightness n, contrast f, gamma g, blur sigma, sharpen and kernel file, a crop after a
+ * resize, or a thumbnail with either.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool ScanOps(char *pOps, tCmd *pCmds, int *pCount)
+{
+	char *save, *end;
+	bool resize = false, crop = false, thumbnail = false;
+	*pCount = 0;
+	for (char *op = strtok_r(pOps, " ", &save); op; op = strtok_r(NULL, " ", &save)) {
+		if (streq(op, "fliph")) {
+			pCmds[(*pCount)++] = (tCmd){ "fliph", 0 };
+		} else if (streq(op, "flipv")) {
+			pCmds[(*pCount)++] = (tCmd){ "flipv", 0 };
+		} else if (streq(op, "rotr")) {
+			char *n = strtok_r(NULL, " ", &save);
+			if (n == NULL) return false;
+			int turns = (int)strtol(n, &end, 10);
+			if (*end != '\0') return false;
+			pCmds[(*pCount)++] = (tCmd){ "rotr", turns };
+		} else if (streq(op, "crop")) {
+			char *region = strtok_r(NULL, " ", &save);
+			pCmds[*pCount] = (tCmd){ "crop", 0 };
+			if (resize || thumbnail || region == NULL || !ScanCropArg(region, &pCmds[(*pCount)++].rect)) return false;
+			crop = true;
+		} else if (streq(op, "resize")) {
+			char *size = strtok_r(NULL, " ", &save);
+			pCmds[*pCount] = (tCmd){ "resize", 0 };
+			if (resize || thumbnail || size == NULL || !ScanResizeArg(size, &pCmds[(*pCount)++].rect)) return false;
+			resize = true;
+		} else if (streq(op, "thumbnail")) {
+			char *n = strtok_r(NULL, " ", &save);
+			if (n == NULL || crop || resize || thumbnail) return false;
+			int size = (int)strtol(n, &end, 10);
+			if (*end != '\0' || size <= 0) return false;
+			pCmds[(*pCount)++] = (tCmd){ "thumbnail", size };
+			thumbnail = true;
+		} else if (streq(op, "filter")) {
+			char *name = strtok_r(NULL, " ", &save);
+			pCmds[*pCount] = (tCmd){ "filter", name ? ScanFilterArg(name) : -1 };
+			if (pCmds[(*pCount)++].arg < 0) return false;
+		} else if (streq(op, "grayscale") || streq(op, "invert") || streq(op, "sharpen")) {
+			pCmds[(*pCount)++] = (tCmd){ streq(op, "grayscale") ? "grayscale" : streq(op, "invert") ? "invert" :
+				"sharpen", 0 };
+		} else if (streq(op, "kernel")) {
+			char *file = strtok_r(NULL, " ", &save);
+			if (file == NULL) return false;
+			pCmds[(*pCount)++] = (tCmd){ "kernel", 0, { 0 }, 0, file };
+		} else if (streq(op, "brightness") || streq(op, "contrast") || streq(op, "gamma") || streq(op, "blur")) {
+			char *name = streq(op, "brightness") ? "brightness" : streq(op, "contrast") ? "contrast" :
+				streq(op, "gamma") ? "gamma" : "blur";
+			char *value = strtok_r(NULL, " ", &save);
+			if (value == NULL) return false;
+			pCmds[(*pCount)++] = (tCmd){ name, 0, { 0 }, strtod(value, &end) };
+			if (end == value || *end != '\0') return false;
+		} else if (!streq(op, "-")) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanResizeArg()
+ *
+ * DESCRIPTION
+ * The --resize option is followed by WxH, the new width and height, which must be positive. Only the width and
+ * height of *pSize are set.
+ *
+ * RETURNS
+ * false if pArg is not of that form.
+ *------------------------------------------------------------------------------------------------------------*/
+static bool ScanResizeArg(char *pArg, tBimpieRect *pSize)
+{
+	char extra;
+	if (sscanf(pArg, "%dx%d%c", &pSize->width, &pSize->height, &extra) != 2) return false;
+	return pSize->width > 0 && pSize->height > 0;
 }
 
 /*--------------------------------------------------------------------------------------------------------------
@@ -264,6 +1161,100 @@ static int ScanRotArg(char *pOpt, char *pArg)
 	return n;
 }
 
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanSizeArg()
+ *
+ * DESCRIPTION
+ * The --max-memory option is followed by a number of bytes, which may end in K, M or G for KiB, MiB or GiB.
+ *------------------------------------------------------------------------------------------------------------*/
+static size_t ScanSizeArg(char *pOpt, char *pArg)
+{
+	char *end;
+	unsigned long long n = strtoull(pArg, &end, 10);
+	int shift = 0;
+	if (*end == 'K' || *end == 'k') shift = 10;
+	if (*end == 'M' || *end == 'm') shift = 20;
+	if (*end == 'G' || *end == 'g') shift = 30;
+	if (shift) end++;
+	if (n == 0 || *end != '\0' || end == pArg || pArg[0] == '-' || n > (SIZE_MAX >> shift)) {
+		ErrorExit(cErrorArg, "%s: invalid argument %s", pOpt, pArg);
+	}
+	return (size_t)n << shift;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ScanThreadsArg()
+ *
+ * DESCRIPTION
+ * The --threads option is followed by the number of threads to use, which must be a positive integer.
+ *------------------------------------------------------------------------------------------------------------*/
+static int ScanThreadsArg(char *pOpt, char *pArg)
+{
+	char *end;
+	int n = (int)strtol(pArg, &end, 10);
+	if (n <= 0 || *end != '\0') {
+		ErrorExit(cErrorArg, "%s: invalid argument %s", pOpt, pArg);
+	}
+	return n;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: ServeTask()
+ *
+ * DESCRIPTION
+ * Runs the jobs of --serve clients on one of the library's threads until the server is stopped.
+ *------------------------------------------------------------------------------------------------------------*/
+static void ServeTask(void *pArg, int pTask)
+{
+	tServer *server = (tServer *) pArg;
+	serveJobs(server->jobServer, &stopServer);
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: SetColors()
+ *
+ * DESCRIPTION
+ * Chains the color operations among pCmds, in order, and sets them on pImage, to be applied by whichever stage
+ * moves its pixels.
+ *
+ * RETURNS
+ * 0 or a cBimpieError code.
+ *------------------------------------------------------------------------------------------------------------*/
+static int SetColors(tBimpie *pBimpie, tBimpieImage *pImage, tCmd *pCmds, int pCount)
+{
+	tBimpieColor *color = bimpieColorCreate();
+	if (color == NULL) return cBimpieErrorMemory;	// bimpieColorCreate() has set bimpieLastError()
+	int status = 0;
+	for (int i = 0; i < pCount && status == 0; i++) {
+		if (streq(pCmds[i].name, "grayscale")) {
+			status = bimpieGrayscale(color);
+		} else if (streq(pCmds[i].name, "invert")) {
+			status = bimpieInvert(color);
+		} else if (streq(pCmds[i].name, "brightness")) {
+			status = bimpieBrightness(color, pCmds[i].value);
+		} else if (streq(pCmds[i].name, "contrast")) {
+			status = bimpieContrast(color, pCmds[i].value);
+		} else if (streq(pCmds[i].name, "gamma")) {
+			status = bimpieGamma(color, pCmds[i].value);
+		}
+	}
+	if (status == 0) status = bimpieSetColor(pBimpie, pImage, color);
+	bimpieColorFree(color);
+	return status;
+}
+
+/*--------------------------------------------------------------------------------------------------------------
+ * FUNCTION: StopServer()
+ *
+ * DESCRIPTION
+ * The SIGINT and SIGTERM handler of --serve. The server threads see the flag within a quarter of a second, finish
+ * the jobs they are running and return.
+ *------------------------------------------------------------------------------------------------------------*/
+static void StopServer(int pSignal)
+{
+	stopServer = 1;
+}
+
 /*--------------------------------------------------------------------------------------------------------------
  * FUNCTION: Version()
  *
@@ -0,0 +1,159 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "Pool.h"
+
+// Buffers start on this boundary, the same as image rows.
+#define cBufferAlign 64
+
+/* A free buffer is only handed out for requests of at least half its
+ * size, so a scratch row never takes an image-sized buffer.
+ */
+#define cMaxWaste 2
+
+typedef struct {
+	void   *buffer;
+	size_t	size;
+	bool	inUse;
+} tBufferEntry;
+
+struct tBufferPool {
+	tBufferEntry   *entries;
+	int				count;
+	int				capacity;
+	size_t			inUse;		// Bytes given out now
+	tBufferPoolStats stats;
+	pthread_mutex_t	lock;
+};
+
+/* creates an empty pool
+ * Returns: the pool, or NULL if out of memory
+ */
+
+tBufferPool *createBufferPool() {
+	tBufferPool *buffers = (tBufferPool *)calloc(1, sizeof(tBufferPool));
+	if (buffers == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&buffers->lock, NULL);
+	return buffers;
+}
+
+/* frees the pool and every buffer in it. All of them must have been given
+ * back.
+ */
+
+void freeBufferPool(tBufferPool *buffers) {
+	for (int i = 0; i < buffers->count; i++) {
+		free(buffers->entries[i].buffer);
+	}
+	pthread_mutex_destroy(&buffers->lock);
+	free(buffers->entries);
+	free(buffers);
+}
+
+/* hands out the smallest free buffer of at least size bytes, allocating
+ * one if none fits. A NULL pool allocates every time.
+ * Returns: the buffer, contents undefined, or NULL if out of memory
+ */
+
+void *takeBuffer(tBufferPool *buffers, size_t size) {
+	void *buffer;
+	if (buffers == NULL) {
+		return posix_memalign(&buffer, cBufferAlign, size) == 0 ? buffer : NULL;
+	}
+
+	pthread_mutex_lock(&buffers->lock);
+	buffers->stats.takes++;
+
+	tBufferEntry *best = NULL;
+	for (int i = 0; i < buffers->count; i++) {
+		tBufferEntry *e = &buffers->entries[i];
+		if (!e->inUse && e->size >= size && e->size / cMaxWaste <= size && (!best || e->size < best->size)) {
+			best = e;
+		}
+	}
+
+	if (best == NULL) {
+		if (buffers->count == buffers->capacity) {
+			int capacity = buffers->capacity ? 2 * buffers->capacity : 16;
+			tBufferEntry *entries = (tBufferEntry *)realloc(buffers->entries, capacity * sizeof(tBufferEntry));
+			if (entries == NULL) {
+				pthread_mutex_unlock(&buffers->lock);
+				return NULL;
+			}
+			buffers->entries = entries;
+			buffers->capacity = capacity;
+		}
+		if (posix_memalign(&buffer, cBufferAlign, size) != 0) {
+			pthread_mutex_unlock(&buffers->lock);
+			return NULL;
+		}
+		best = &buffers->entries[buffers->count++];
+		best->buffer = buffer;
+		best->size = size;
+		buffers->stats.allocs++;
+		buffers->stats.held += size;
+	}
+
+	best->inUse = true;
+	buffers->inUse += best->size;
+	if (buffers->inUse > buffers->stats.highWater) buffers->stats.highWater = buffers->inUse;
+	buffer = best->buffer;
+	pthread_mutex_unlock(&buffers->lock);
+	return buffer;
+}
+
+/* gives back a buffer from takeBuffer() for reuse. A NULL buffer is
+ * ignored.
+ */
+
+void giveBuffer(tBufferPool *buffers, void *buffer) {
+	if (buffers == NULL || buffer == NULL) {
+		free(buffer);
+		return;
+	}
+
+	pthread_mutex_lock(&buffers->lock);
+	for (int i = 0; i < buffers->count; i++) {
+		if (buffers->entries[i].buffer == buffer) {
+			buffers->entries[i].inUse = false;
+			buffers->inUse -= buffers->entries[i].size;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&buffers->lock);
+}
+
+/* frees the largest free buffers until those left free add up to no more
+ * than keep bytes, so that one large image does not keep its buffers for
+ * the life of the pool while smaller ones cannot use them
+ */
+
+void trimBufferPool(tBufferPool *buffers, size_t keep) {
+	pthread_mutex_lock(&buffers->lock);
+	size_t idle = buffers->stats.held - buffers->inUse;
+	while (idle > keep) {
+		int largest = -1;
+		for (int i = 0; i < buffers->count; i++) {
+			tBufferEntry *e = &buffers->entries[i];
+			if (!e->inUse && (largest < 0 || e->size > buffers->entries[largest].size)) largest = i;
+		}
+		tBufferEntry *e = &buffers->entries[largest];
+		free(e->buffer);
+		idle -= e->size;
+		buffers->stats.held -= e->size;
+		*e = buffers->entries[--buffers->count];
+	}
+	pthread_mutex_unlock(&buffers->lock);
+}
+
+/* Returns: the pool's counters so far
+ */
+
+tBufferPoolStats bufferPoolStats(tBufferPool *buffers) {
+	pthread_mutex_lock(&buffers->lock);
+	tBufferPoolStats stats = buffers->stats;
+	pthread_mutex_unlock(&buffers->lock);
+	return stats;
+}
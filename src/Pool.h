@@ -0,0 +1,29 @@
+#ifndef POOL_H
+#define POOL_H
+#include <stddef.h>
+
+/* A cache of 64-byte aligned buffers shared by the threads of a run. A
+ * buffer given back is kept and handed out again to the next request it
+ * fits, so a pipeline or a batch of similar images stops allocating once
+ * it has seen its largest working set. Nothing is returned to the system
+ * until trimBufferPool() or freeBufferPool(), which also spares the page
+ * faults on buffers that would otherwise be unmapped and mapped again.
+ */
+typedef struct tBufferPool tBufferPool;
+
+typedef struct {
+	size_t	held;		// Bytes in all the buffers, given out or not
+	size_t	highWater;	// Most bytes given out at one time
+	long	takes;		// Buffers handed out
+	long	allocs;		// Buffers that had to be allocated
+} tBufferPoolStats;
+
+//function declarations
+tBufferPool *createBufferPool();
+void freeBufferPool(tBufferPool *);
+void *takeBuffer(tBufferPool *, size_t size);
+void giveBuffer(tBufferPool *, void *buffer);
+void trimBufferPool(tBufferPool *, size_t keep);
+tBufferPoolStats bufferPoolStats(tBufferPool *);
+
+#endif
@@ -0,0 +1,266 @@
+#include <math.h>
+#include "Bimpie.h"
+#include "Resize.h"
+#include "Simd.h"
+#include "String.h"
+
+// Each parallel task resamples a band of about cBandSize bytes of rows, and at least cMinBandRows of them when
+// the band is transposed on the way out, so the transpose has whole tiles to work on.
+#define cBandSize (256 * 1024)
+#define cMinBandRows 64
+
+/* The weights of one direction of a resize: destination pixel j is the
+ * sum of source pixels starts[j] to starts[j]+taps-1, each times its
+ * weight from weights + j*taps. Every pixel has the same number of taps;
+ * those past the edge of a narrow window weigh 0.
+ */
+typedef struct {
+	int			taps;
+	int		   *starts;
+	int16_t	   *weights;
+} tWeights;
+
+/* The arguments shared by the tasks of one resize
+ */
+typedef struct {
+	const tImage   *src;
+	tImage		   *mid;		// src resampled along its rows: the new width, the old height
+	tImage		   *dst;
+	tOrient			o;
+	const tColor   *color;		// Given to the resized rows as they are made, or NULL
+	tWeights		cols;
+	tWeights		rows;
+	int				bandRows;	// Rows per task
+	int				failed;		// Set when a task runs out of memory
+} tResizeJob;
+
+/* Returns: the distance from a sample within which filter gives it any
+ * weight, in pixels
+ */
+
+static double filterSupport(int filter) {
+	switch (filter) {
+	case cBimpieFilterBox:      return 0.5;
+	case cBimpieFilterBilinear: return 1.0;
+	default:                    return 3.0;
+	}
+}
+
+static double sinc(double x) {
+	const double pi = 3.14159265358979323846;
+	return x == 0 ? 1 : sin(pi * x) / (pi * x);
+}
+
+/* Returns: the weight filter gives a sample x pixels away; not for the
+ * box filter, which weighs whole pixels by coverage()
+ */
+
+static double filterWeight(int filter, double x) {
+	switch (filter) {
+	case cBimpieFilterBilinear:
+		x = fabs(x);
+		return x < 1 ? 1 - x : 0;
+	default:
+		return fabs(x) < 3 ? sinc(x) * sinc(x / 3) : 0;
+	}
+}
+
+/* Returns: how much of source pixel x, from x to x+1, lies between lo and
+ * hi
+ */
+
+static double coverage(int x, double lo, double hi) {
+	double from = x > lo ? x : lo;
+	double to = x + 1 < hi ? x + 1 : hi;
+	return to > from ? to - from : 0;
+}
+
+/* works out the weights that resample srcCount pixels to dstCount with
+ * filter. Destination pixel j is centred on source position (j+0.5)*scale;
+ * the weights of its window are normalized to add up to 1 in fixed point
+ * exactly, so flat areas stay flat. The box filter averages the source
+ * pixels under destination pixel j, from j*scale to (j+1)*scale, each by
+ * how much of it is covered; the others sample their curve at the centres
+ * of the source pixels, stretched to the destination pixels if shrinking.
+ * Returns: false if out of memory
+ */
+
+static bool createWeights(tWeights *w, int srcCount, int dstCount, int filter, tBufferPool *buffers) {
+	double scale = (double)srcCount / dstCount;
+	double stretch = scale > 1 ? scale : 1;
+	bool box = filter == cBimpieFilterBox;
+	double support = filterSupport(filter) * (box ? scale : stretch);
+	int taps = (int)ceil(support * 2) + 1;
+	w->taps = taps < srcCount ? taps : srcCount;
+	w->starts = (int *)takeBuffer(buffers, dstCount * sizeof(int));
+	w->weights = (int16_t *)takeBuffer(buffers, (size_t)dstCount * w->taps * sizeof(int16_t));
+	double *window = (double *)malloc(w->taps * sizeof(double));
+	if (w->starts == NULL || w->weights == NULL || window == NULL) {
+		free(window);
+		return false;
+	}
+
+	for (int j = 0; j < dstCount; j++) {
+		double center = (j + 0.5) * scale;
+		int lo = box ? (int)floor(center - support) : (int)(center - support + 0.5);
+		int hi = box ? (int)ceil(center + support) : (int)(center + support + 0.5);
+		if (lo < 0) lo = 0;
+		if (hi > srcCount) hi = srcCount;
+		if (hi - lo > w->taps) hi = lo + w->taps;
+
+		double sum = 0;
+		for (int x = lo; x < hi; x++) {
+			window[x - lo] = box ? coverage(x, center - support, center + support) :
+				filterWeight(filter, (x - center + 0.5) / stretch);
+			sum += window[x - lo];
+		}
+
+		// Slide a window that runs into the right edge back, so all the taps lie in the row.
+		int start = lo < srcCount - w->taps ? lo : srcCount - w->taps;
+		int16_t *weights = w->weights + (size_t)j * w->taps;
+		memset(weights, 0, w->taps * sizeof(int16_t));
+		w->starts[j] = start;
+		if (sum == 0) {
+			weights[(lo + hi) / 2 - start] = 1 << cWeightBits;
+			continue;
+		}
+
+		// Round each weight, then give what the rounding lost to the heaviest one.
+		int total = 0, heaviest = lo - start;
+		for (int x = lo; x < hi; x++) {
+			int16_t *weight = &weights[x - start];
+			*weight = (int16_t)lround(window[x - lo] / sum * (1 << cWeightBits));
+			total += *weight;
+			if (*weight > weights[heaviest]) heaviest = x - start;
+		}
+		weights[heaviest] += (1 << cWeightBits) - total;
+	}
+	free(window);
+	return true;
+}
+
+static void freeWeights(tWeights *w, tBufferPool *buffers) {
+	giveBuffer(buffers, w->starts);
+	giveBuffer(buffers, w->weights);
+}
+
+/* resamples a band of the rows of src to the new width, into mid
+ */
+
+static void resampleRowsTask(void *arg, int task) {
+	tResizeJob *job = (tResizeJob *)arg;
+	int size = job->src->bpp / 8;
+	int end = (task + 1) * job->bandRows < job->src->height ? (task + 1) * job->bandRows : job->src->height;
+
+	for (int r = task * job->bandRows; r < end; r++) {
+		resampleRow((byte *)imageRow(job->mid, r), (const byte *)imageRow(job->src, r), job->src->width, size,
+			job->cols.starts, job->cols.weights, job->cols.taps, job->mid->width);
+	}
+}
+
+/* resamples row r of the resized image down the columns of mid, into to,
+ * and gives it the colors of the job. rows has room for a pointer to each
+ * row a tap reads.
+ */
+
+static void resampleColumnsRow(tResizeJob *job, int r, byte *to, const byte **rows) {
+	for (int t = 0; t < job->rows.taps; t++) {
+		rows[t] = (const byte *)imageRow(job->mid, job->rows.starts[r] + t);
+	}
+	resampleColumns(to, rows, job->rows.weights + (size_t)r * job->rows.taps, job->rows.taps,
+		(size_t)job->mid->width * (job->mid->bpp / 8));
+	colorRow(job->color, to, job->mid->width, job->mid->bpp / 8);
+}
+
+/* resamples a band of rows of the resized image and writes them where
+ * orientation o puts them in dst. Without a transpose each row is a row of
+ * dst, written in place or reversed on the way. With one the band becomes
+ * a band of columns of dst, transposed out of a scratch image by
+ * transformBmpInto() while it is still in cache.
+ */
+
+static void resampleColumnsTask(void *arg, int task) {
+	tResizeJob *job = (tResizeJob *)arg;
+	tImage *dst = job->dst;
+	int width = job->mid->width;
+	int height = job->o.transpose ? dst->width : dst->height;
+	int r0 = task * job->bandRows;
+	int r1 = r0 + job->bandRows < height ? r0 + job->bandRows : height;
+
+	tImage *band = createImage(width, job->o.transpose ? r1 - r0 : 1, dst->bpp, dst->buffers);
+	const byte **rows = (const byte **)malloc(job->rows.taps * sizeof(byte *));
+	if (band == NULL || rows == NULL) {
+		__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+		if (band) freeImage(band);
+		free(rows);
+		return;
+	}
+
+	if (!job->o.transpose) {
+		for (int r = r0; r < r1; r++) {
+			byte *to = (byte *)imageRow(dst, job->o.flipY ? height - 1 - r : r);
+			resampleColumnsRow(job, r, job->o.flipX ? band->pixels : to, rows);
+			if (job->o.flipX) reverseRow(to, band->pixels, width, dst->bpp);
+		}
+	} else {
+		for (int r = r0; r < r1; r++) {
+			resampleColumnsRow(job, r, (byte *)imageRow(band, r - r0), rows);
+		}
+
+		// Rows r0..r1-1 become columns r0..r1-1 of dst, counted from the right if o flips the columns.
+		int c0 = job->o.flipX ? dst->width - r1 : r0;
+		tImage view = *dst;
+		view.pixels = (byte *)imageRow(dst, 0) + (size_t)c0 * (dst->bpp / 8);
+		view.width = r1 - r0;
+		transformBmpInto(band, &view, job->o, NULL, NULL);
+	}
+	free(rows);
+	freeImage(band);
+}
+
+/* resizes src to width x height pixels after turning it to orientation o,
+ * in one pass over the pixels: the resized rows are given color, if it is
+ * not NULL, and written straight to where o puts them, so neither costs
+ * much on top of the resize. src is left as it is.
+ * @params: width, height - the size of the result, in orientation o
+ *			filter - one of the cBimpieFilter codes
+ *			pool - threads to share the work, or NULL
+ * Returns: the resized image, or NULL if out of memory
+ */
+
+tImage *resizeImage(const tImage *src, int width, int height, int filter, tOrient o, const tColor *color,
+		tThreadPool *pool) {
+	tBufferPool *buffers = src->buffers;
+	int newWidth = o.transpose ? height : width;
+	int newHeight = o.transpose ? width : height;
+	tResizeJob job;
+	memset(&job, 0, sizeof(job));
+	job.src = src;
+	job.o = o;
+	job.color = color;
+
+	// Resampling to the same width changes nothing, so the rows are then read straight from src.
+	bool ok = createWeights(&job.cols, src->width, newWidth, filter, buffers) &&
+		createWeights(&job.rows, src->height, newHeight, filter, buffers);
+	job.mid = newWidth == src->width ? (tImage *)src : createImage(newWidth, src->height, src->bpp, buffers);
+	job.dst = createImage(width, height, src->bpp, buffers);
+
+	if (ok && job.mid && job.dst) {
+		size_t rowSize = (size_t)newWidth * (src->bpp / 8);
+		job.bandRows = (int)(cBandSize / rowSize) > 1 ? (int)(cBandSize / rowSize) : 1;
+		if (job.mid != src) {
+			threadPoolRun(pool, (src->height + job.bandRows - 1) / job.bandRows, resampleRowsTask, &job);
+		}
+		if (o.transpose && job.bandRows < cMinBandRows) job.bandRows = cMinBandRows;
+		threadPoolRun(pool, (newHeight + job.bandRows - 1) / job.bandRows, resampleColumnsTask, &job);
+	}
+
+	freeWeights(&job.cols, buffers);
+	freeWeights(&job.rows, buffers);
+	if (job.mid && job.mid != src) freeImage(job.mid);
+	if (!ok || job.mid == NULL || job.failed) {
+		if (job.dst) freeImage(job.dst);
+		return NULL;
+	}
+	return job.dst;
+}
@@ -0,0 +1,19 @@
+#ifndef RESIZE_H
+#define RESIZE_H
+#include "Image.h"
+
+/* Resampling to a new size with a separable filter, one of the
+ * cBimpieFilter codes. Each destination pixel is a weighted sum of a
+ * window of source pixels, first along the rows into an image of the new
+ * width, then down the columns of that. The weights are worked out once
+ * per column and once per row, as 16-bit fixed point (see cWeightBits),
+ * and the sums are done by the resample kernels of Simd.h. When shrinking,
+ * the filter is stretched to cover every source pixel. The channels of a
+ * pixel are filtered independently, so only 24 and 32-bit pixels can be
+ * resampled.
+ */
+
+//function declarations
+tImage *resizeImage(const tImage *src, int width, int height, int filter, tOrient, const tColor *, tThreadPool *);
+
+#endif
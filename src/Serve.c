@@ -0,0 +1,432 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Error.h"
+#include "Serve.h"
+
+// The longest job line: three file names and the operations.
+#define cMaxLine 16384
+
+// The most descriptors a connection may have sent ahead of the jobs they go with.
+#define cMaxFds 16
+
+// How often, in milliseconds, a server thread waiting for a client looks at the stop flag.
+#define cStopPoll 250
+
+// What the server keeps of each connection, between its jobs too.
+typedef struct tConnection {
+	int					fd;
+	char				line[cMaxLine];
+	size_t				length;			// Bytes in line, the job being read and any after it
+	int					fds[cMaxFds];	// Descriptors received and not yet taken by a job, oldest first
+	int					fdCount;
+	struct tConnection *prev;			// In the list of open connections
+	struct tConnection *next;
+} tConnection;
+
+/* The listening socket and every open connection are in one epoll set
+ * that all the server threads wait on. A connection is armed for one
+ * event at a time, so the thread that gets it has it to itself until it
+ * has answered the jobs that came and arms it again; any thread may take
+ * its next job.
+ */
+struct tJobServer {
+	int				listenFd;
+	int				epollFd;
+	char		   *path;			// The socket file, removed by freeJobServer()
+	tJobFunc		func;
+	void		   *arg;
+	tConnection	   *connections;	// Open connections, to close them all at the end
+	pthread_mutex_t	lock;			// Guards connections
+};
+
+/* fills in addr for the socket at path
+ * Returns: 0, or -1 if path is too long
+ */
+
+static int socketAddress(struct sockaddr_un *addr, const char *path) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+/* creates the socket at path and listens on it. A socket left there by a
+ * server that is gone is replaced; one a server still answers on is not.
+ * Returns: the listening descriptor, or -1 with errno set
+ */
+
+static int listenSocket(const char *path) {
+	struct sockaddr_un addr;
+	if (socketAddress(&addr, path) != 0) return -1;
+
+	int fd = connectSocket(path);
+	if (fd >= 0) {
+		close(fd);
+		errno = EADDRINUSE;
+		return -1;
+	}
+	unlink(path);
+
+	// A thread woken for a connection that another thread accepted first must not block.
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0 ||
+			fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+/* Returns: the descriptor of a connection to the socket at path, or -1
+ * with errno set
+ */
+
+int connectSocket(const char *path) {
+	struct sockaddr_un addr;
+	if (socketAddress(&addr, path) != 0) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+/* sends all size bytes of buffer, with the descriptor passFd along with
+ * the first of them unless it is -1
+ * Returns: 0, or -1 if the connection failed
+ */
+
+static int sendAll(int fd, const char *buffer, size_t size, int passFd) {
+	while (size > 0) {
+		struct iovec iov = { (void *)buffer, size };
+		struct msghdr msg;
+		union {
+			struct cmsghdr	header;
+			char			space[CMSG_SPACE(sizeof(int))];
+		} control;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (passFd >= 0) {
+			msg.msg_control = control.space;
+			msg.msg_controllen = sizeof(control.space);
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &passFd, sizeof(int));
+		}
+
+		ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent <= 0) return -1;
+		buffer += sent;
+		size -= sent;
+		passFd = -1;
+	}
+	return 0;
+}
+
+/* receives what the client of connection c has sent so far, and any
+ * descriptors sent with it, without waiting for more
+ * Returns: 0, or -1 when the client is gone or its line is too long
+ */
+
+static int receive(tConnection *c) {
+	if (c->length == sizeof(c->line)) return -1;
+
+	struct iovec iov = { c->line + c->length, sizeof(c->line) - c->length };
+	struct msghdr msg;
+	union {
+		struct cmsghdr	header;
+		char			space[CMSG_SPACE(cMaxFds * sizeof(int))];
+	} control;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.space;
+	msg.msg_controllen = sizeof(control.space);
+	ssize_t got;
+	while ((got = recvmsg(c->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+	if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+	if (got <= 0) return -1;
+	c->length += got;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+		int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (int i = 0; i < count; i++) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (c->fdCount < cMaxFds) {
+				c->fds[c->fdCount++] = fd;
+			} else {
+				close(fd);
+			}
+		}
+	}
+	return 0;
+}
+
+/* Returns: the monotonic clock in microseconds
+ */
+
+static long microsNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* replaces the tabs and line breaks in s, which would split its field of
+ * a reply, with spaces
+ */
+
+static void flattenField(char *s) {
+	for (; *s; s++) {
+		if (*s == '\t' || *s == '\n' || *s == '\r') *s = ' ';
+	}
+}
+
+/* runs the job on line, of length bytes, of connection c and sends the
+ * reply
+ * Returns: 0, or -1 if the reply could not be sent
+ */
+
+static int serveJob(tJobServer *server, tConnection *c, long length) {
+	long start = microsNow();
+	char message[1024] = "", stages[1024] = "", proc[64];
+	int status = 0, inputFd = -1;
+	tJob job;
+
+	job.ops = c->line;
+	job.input = strchr(job.ops, '\t');
+	job.output = job.input ? strchr(job.input + 1, '\t') : NULL;
+	if (job.output == NULL || strchr(job.output + 1, '\t')) {
+		status = cErrorArg;
+		snprintf(message, sizeof(message), "expecting ops, input and output separated by tabs");
+	} else {
+		*job.input++ = '\0';
+		*job.output++ = '\0';
+		if (strcmp(job.input, "-") == 0) {
+			if (c->fdCount == 0) {
+				status = cErrorArgInputFile;
+				snprintf(message, sizeof(message), "expecting an input file descriptor");
+			} else {
+				inputFd = c->fds[0];
+				memmove(c->fds, c->fds + 1, --c->fdCount * sizeof(int));
+				snprintf(proc, sizeof(proc), "/proc/self/fd/%d", inputFd);
+				job.input = proc;
+			}
+		}
+		if (job.output[0] == '\0') job.output = job.input;
+	}
+
+	if (status == 0) status = server->func(server->arg, &job, message, stages, sizeof(message));
+	if (inputFd >= 0) close(inputFd);
+	if (status == 0 && message[0] == '\0') snprintf(message, sizeof(message), "ok");
+
+	// The job is done with the line, so the next one moves to the front.
+	c->length -= length + 1;
+	memmove(c->line, c->line + length + 1, c->length);
+
+	char reply[2200];
+	flattenField(message);
+	flattenField(stages);
+	int size = snprintf(reply, sizeof(reply), "%d\t%ld\t%s\t%s\n", status, microsNow() - start, message, stages);
+	return sendAll(c->fd, reply, size < (int)sizeof(reply) ? size : sizeof(reply) - 1, -1);
+}
+
+/* closes connection c and frees it
+ */
+
+static void closeConnection(tJobServer *server, tConnection *c) {
+	pthread_mutex_lock(&server->lock);
+	if (c->prev) c->prev->next = c->next; else server->connections = c->next;
+	if (c->next) c->next->prev = c->prev;
+	pthread_mutex_unlock(&server->lock);
+
+	while (c->fdCount > 0) close(c->fds[--c->fdCount]);
+	close(c->fd);
+	free(c);
+}
+
+/* accepts a new connection, if another thread has not, and adds it to the
+ * epoll set of server
+ */
+
+static void acceptConnection(tJobServer *server) {
+	int fd = accept(server->listenFd, NULL, NULL);
+	if (fd < 0) return;
+	tConnection *c = (tConnection *)calloc(1, sizeof(tConnection));
+	if (c == NULL) {
+		close(fd);
+		return;
+	}
+	c->fd = fd;
+
+	pthread_mutex_lock(&server->lock);
+	c->next = server->connections;
+	if (c->next) c->next->prev = c;
+	server->connections = c;
+	pthread_mutex_unlock(&server->lock);
+
+	struct epoll_event event = { EPOLLIN | EPOLLONESHOT, { .ptr = c } };
+	if (epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) closeConnection(server, c);
+}
+
+/* answers every job that has come whole on connection c, then arms it for
+ * the next, or closes it if its client is gone
+ */
+
+static void serveConnection(tJobServer *server, tConnection *c) {
+	int result = receive(c);
+	char *end;
+	while (result == 0 && (end = memchr(c->line, '\n', c->length)) != NULL) {
+		*end = '\0';
+		result = serveJob(server, c, end - c->line);
+	}
+
+	struct epoll_event event = { EPOLLIN | EPOLLONESHOT, { .ptr = c } };
+	if (result != 0 || epoll_ctl(server->epollFd, EPOLL_CTL_MOD, c->fd, &event) != 0) closeConnection(server, c);
+}
+
+/* creates the socket at path, replacing one left there by a server that is
+ * gone but not one a server still answers on, to run the jobs clients
+ * send with func, arg passed through
+ * Returns: the server, or NULL with errno set
+ */
+
+tJobServer *createJobServer(const char *path, tJobFunc func, void *arg) {
+	tJobServer *server = (tJobServer *)calloc(1, sizeof(tJobServer));
+	if (server == NULL || (server->path = strdup(path)) == NULL) {
+		free(server);
+		errno = ENOMEM;
+		return NULL;
+	}
+	server->func = func;
+	server->arg = arg;
+	server->epollFd = -1;
+	pthread_mutex_init(&server->lock, NULL);
+
+	server->listenFd = listenSocket(path);
+	struct epoll_event event = { EPOLLIN | EPOLLEXCLUSIVE, { .ptr = NULL } };
+	if (server->listenFd < 0 || (server->epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+			epoll_ctl(server->epollFd, EPOLL_CTL_ADD, server->listenFd, &event) != 0) {
+		int error = errno;
+		freeJobServer(server);
+		errno = error;
+		return NULL;
+	}
+	return server;
+}
+
+/* runs the jobs that come to server until *stop is set. Run it on as many
+ * threads as should run jobs at once; the jobs of all the connections are
+ * shared between them, so a client that keeps its connection open holds a
+ * thread only while one of its jobs runs.
+ */
+
+void serveJobs(tJobServer *server, volatile sig_atomic_t *stop) {
+	while (!*stop) {
+		struct epoll_event event;
+		if (epoll_wait(server->epollFd, &event, 1, cStopPoll) != 1) continue;
+		if (event.data.ptr == NULL) {
+			acceptConnection(server);
+		} else {
+			serveConnection(server, (tConnection *)event.data.ptr);
+		}
+	}
+}
+
+/* closes every connection of server and its socket and removes the socket
+ * file. No thread may be in serveJobs() any more.
+ */
+
+void freeJobServer(tJobServer *server) {
+	while (server->connections) closeConnection(server, server->connections);
+	if (server->epollFd >= 0) close(server->epollFd);
+	if (server->listenFd >= 0) {
+		close(server->listenFd);
+		unlink(server->path);
+	}
+	pthread_mutex_destroy(&server->lock);
+	free(server->path);
+	free(server);
+}
+
+/* sends a job to the server connected on fd: the operations ops, "-" or
+ * empty for none, on input, or on the descriptor inputFd instead if it is
+ * not -1, written to output, empty for the input
+ * Returns: 0, or -1 if the connection failed
+ */
+
+int sendJob(int fd, const char *ops, const char *input, int inputFd, const char *output) {
+	char line[cMaxLine];
+	int size = snprintf(line, sizeof(line), "%s\t%s\t%s\n", ops[0] ? ops : "-", inputFd >= 0 ? "-" : input,
+		output);
+	if (size >= (int)sizeof(line)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return sendAll(fd, line, size, inputFd);
+}
+
+/* waits for the reply to the oldest job sent on fd and parses it into reply
+ * Returns: 0, or -1 if the connection failed or the reply is not one
+ */
+
+int readReply(int fd, tJobReply *reply) {
+	char line[2200];
+	size_t length = 0;
+
+	// Peek first, so that no byte past the reply is taken from the socket.
+	for (;;) {
+		ssize_t got = recv(fd, line + length, sizeof(line) - 1 - length, MSG_PEEK);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) return -1;
+		char *end = memchr(line + length, '\n', got);
+		size_t take = end ? (size_t)(end - (line + length)) + 1 : (size_t)got;
+		if (recv(fd, line + length, take, 0) != (ssize_t)take) return -1;
+		length += take;
+		if (end) break;
+		if (length == sizeof(line) - 1) return -1;
+	}
+	line[length - 1] = '\0';
+
+	// status, microseconds, message, stages
+	char *fields[4];
+	fields[0] = line;
+	for (int i = 1; i < 4; i++) {
+		fields[i] = strchr(fields[i - 1], '\t');
+		if (fields[i] == NULL) return -1;
+		*fields[i]++ = '\0';
+	}
+	char *end;
+	reply->status = (int)strtol(fields[0], &end, 10);
+	if (*end != '\0') return -1;
+	reply->micros = strtol(fields[1], &end, 10);
+	if (*end != '\0') return -1;
+	snprintf(reply->message, sizeof(reply->message), "%s", fields[2]);
+	snprintf(reply->stages, sizeof(reply->stages), "%s", fields[3]);
+	return 0;
+}
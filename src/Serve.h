@@ -0,0 +1,54 @@
+#ifndef SERVE_H
+#define SERVE_H
+#include <signal.h>
+#include <stddef.h>
+
+/* The protocol between bimpie --serve and its clients, over a Unix domain
+ * socket. A client sends one job per line and gets one reply line per job,
+ * in order, before it sends the next one on that connection:
+ *
+ *     ops <TAB> input <TAB> output <NL>
+ *     status <TAB> microseconds <TAB> message <TAB> stages <NL>
+ *
+ * ops are the operations of the command line without their dashes, e.g.,
+ * "fliph rotr 3" or "crop 0,0,640,480 rotr 1", or "-" for none. input is a
+ * file name, or "-" when the input file is sent along as a descriptor
+ * (SCM_RIGHTS) with the line. output is a file name; empty means the input
+ * file. status is 0 or a cBimpieError code, microseconds is how long the
+ * job took on the server, message is "ok" or what went wrong, and stages
+ * is the time of each stage as stage=microseconds separated by commas.
+ */
+
+typedef struct tJobServer tJobServer;
+
+// One job as the server receives it. The strings point into the line it came on.
+typedef struct {
+	char   *ops;
+	char   *input;		// "/proc/self/fd/n" when the input came as a descriptor
+	char   *output;		// The input when the job gave no output
+} tJob;
+
+// A reply as the client receives it.
+typedef struct {
+	int		status;
+	long	micros;
+	char	message[1024];
+	char	stages[1024];
+} tJobReply;
+
+/* Runs job, with arg passed through from createJobServer(), and writes
+ * the message and stages of the reply into message and stages, each of
+ * size bytes.
+ * Returns: 0 or a cBimpieError code
+ */
+typedef int (*tJobFunc)(void *arg, tJob *job, char *message, char *stages, size_t size);
+
+//function declarations
+tJobServer *createJobServer(const char *path, tJobFunc, void *arg);
+void serveJobs(tJobServer *, volatile sig_atomic_t *stop);
+void freeJobServer(tJobServer *);
+int connectSocket(const char *path);
+int sendJob(int fd, const char *ops, const char *input, int inputFd, const char *output);
+int readReply(int fd, tJobReply *);
+
+#endif
@@ -0,0 +1,585 @@
+#include <stdint.h>
+#include "Simd.h"
+#include "String.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#endif
+
+/* reverses a row of 24-bit pixels one pixel at a time
+ */
+
+static void reverseRow24Scalar(byte *dst, const byte *src, int count) {
+	const byte *from = src + (size_t)count * 3;
+	for (int j = 0; j < count; j++, dst += 3) {
+		from -= 3;
+		dst[0] = from[0];
+		dst[1] = from[1];
+		dst[2] = from[2];
+	}
+}
+
+/* reverses a row of 8, 16 or 32-bit pixels one pixel at a time. The pixel
+ * structs have byte alignment, so the rows may start anywhere, as they do
+ * in a mapped file.
+ */
+
+#define DEFINE_REVERSE_ROW_SCALAR(bits, tType)										\
+static void reverseRow##bits##Scalar(byte *dst, const byte *src, int count) {		\
+	tType *to = (tType *)dst;														\
+	const tType *from = (const tType *)src + count;									\
+	for (int j = 0; j < count; j++) {												\
+		to[j] = *--from;															\
+	}																				\
+}
+
+DEFINE_REVERSE_ROW_SCALAR(8, tPixel8)
+DEFINE_REVERSE_ROW_SCALAR(16, tPixel16)
+DEFINE_REVERSE_ROW_SCALAR(32, tPixel32)
+
+/* swaps two rows through a small buffer that stays in L1
+ */
+
+static void swapRowsScalar(byte *a, byte *b, size_t size) {
+	byte temp[256];
+	while (size > 0) {
+		size_t n = size < sizeof(temp) ? size : sizeof(temp);
+		memcpy(temp, a, n);
+		memcpy(a, b, n);
+		memcpy(b, temp, n);
+		a += n;
+		b += n;
+		size -= n;
+	}
+}
+
+/* rounds a sum of weighted bytes back to a byte
+ */
+
+static inline byte clampWeighted(int32_t sum) {
+	sum = (sum + (1 << (cWeightBits - 1))) >> cWeightBits;
+	return sum < 0 ? 0 : sum > 255 ? 255 : (byte)sum;
+}
+
+/* resamples bytes from to size-1, which the vector kernels leave over
+ */
+
+static void resampleColumnsFrom(byte *dst, const byte *const *rows, const int16_t *weights, int taps,
+		size_t from, size_t size) {
+	for (size_t i = from; i < size; i++) {
+		int32_t sum = 0;
+		for (int t = 0; t < taps; t++) {
+			sum += weights[t] * rows[t][i];
+		}
+		dst[i] = clampWeighted(sum);
+	}
+}
+
+static void resampleColumnsScalar(byte *dst, const byte *const *rows, const int16_t *weights, int taps,
+		size_t size) {
+	resampleColumnsFrom(dst, rows, weights, taps, 0, size);
+}
+
+static void resampleRowScalar(byte *dst, const byte *src, int srcCount, int size, const int *starts,
+		const int16_t *weights, int taps, int count) {
+	for (int j = 0; j < count; j++, dst += size, weights += taps) {
+		const byte *from = src + (size_t)starts[j] * size;
+		for (int ch = 0; ch < size; ch++) {
+			int32_t sum = 0;
+			for (int t = 0; t < taps; t++) {
+				sum += weights[t] * from[t * size + ch];
+			}
+			dst[ch] = clampWeighted(sum);
+		}
+	}
+}
+
+static void mixRowScalar(byte *row, int count, int size, const int16_t *weights) {
+	const int32_t round = 1 << (cMixBits - 1);
+	for (int j = 0; j < count; j++, row += size) {
+		int32_t b = row[0], g = row[1], r = row[2];
+		for (int ch = 0; ch < 3; ch++) {
+			const int16_t *w = weights + ch * 3;
+			int32_t sum = (w[0] * b + w[1] * g + w[2] * r + round) >> cMixBits;
+			row[ch] = sum < 0 ? 0 : sum > 255 ? 255 : (byte)sum;
+		}
+	}
+}
+
+#ifdef SIMD_X86
+
+/* Reverses the order of the five pixels in bytes 1..15 of a 16-byte load
+ * and leaves them in bytes 0..14. Byte 15 is zeroed; every store of it is
+ * overwritten by the next store or by the scalar tail.
+ */
+#define cReverse5 13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, 1, 2, 3, (char)0x80
+
+/* reverses a row with pshufb, five pixels per 16-byte load and store.
+ * The loads start one byte before the block so they never read past the
+ * end of the row, which is why dst pixel j comes from the load at pixel
+ * count-5-j, less one byte.
+ */
+
+__attribute__((target("ssse3")))
+static int reverseRow24Ssse3Loop(byte *dst, const byte *src, int count, int j) {
+	const __m128i mask = _mm_setr_epi8(cReverse5);
+	for (; j + 6 <= count; j += 5) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + (size_t)(count - 5 - j) * 3 - 1));
+		_mm_storeu_si128((__m128i *)(dst + (size_t)j * 3), _mm_shuffle_epi8(v, mask));
+	}
+	return j;
+}
+
+__attribute__((target("ssse3")))
+static void reverseRow24Ssse3(byte *dst, const byte *src, int count) {
+	int j = reverseRow24Ssse3Loop(dst, src, count, 0);
+	reverseRow24Scalar(dst + (size_t)j * 3, src, count - j);
+}
+
+/* reverses a row with AVX2, ten pixels per iteration. The later five
+ * source pixels go in the low lane and the earlier five in the high lane,
+ * one 256-bit pshufb reverses both, and the lanes are stored back to back.
+ */
+
+__attribute__((target("avx2")))
+static void reverseRow24Avx2(byte *dst, const byte *src, int count) {
+	const __m256i mask = _mm256_setr_epi8(cReverse5, cReverse5);
+	int j = 0;
+	for (; j + 11 <= count; j += 10) {
+		const byte *from = src + (size_t)(count - 10 - j) * 3 - 1;
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(from + 15))),
+			_mm_loadu_si128((const __m128i *)from), 1);
+		v = _mm256_shuffle_epi8(v, mask);
+		byte *to = dst + (size_t)j * 3;
+		_mm_storeu_si128((__m128i *)to, _mm256_castsi256_si128(v));
+		_mm_storeu_si128((__m128i *)(to + 15), _mm256_extracti128_si256(v, 1));
+	}
+	j = reverseRow24Ssse3Loop(dst, src, count, j);
+	reverseRow24Scalar(dst + (size_t)j * 3, src, count - j);
+}
+
+/* The pshufb masks that reverse the 8 and 16-bit pixels of a 16-byte load.
+ */
+#define cReverse8x16 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+#define cReverse16x8 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1
+
+/* reverses a row of size-byte pixels with pshufb, 16 bytes per load and
+ * store, from dst pixel j on. dst pixel j+k comes from src pixel
+ * count-1-j-k, so each store takes the load that ends at that pixel.
+ * Returns: the first dst pixel left for the scalar tail
+ */
+
+__attribute__((target("ssse3")))
+static int reverseRowSsse3Loop(byte *dst, const byte *src, int count, int size, __m128i mask, int j) {
+	int per = 16 / size;
+	for (; j + per <= count; j += per) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + (size_t)(count - per - j) * size));
+		_mm_storeu_si128((__m128i *)(dst + (size_t)j * size), _mm_shuffle_epi8(v, mask));
+	}
+	return j;
+}
+
+/* reverses a row of size-byte pixels with AVX2, 32 bytes at a time: pshufb
+ * reverses the pixels within each 16-byte lane and the lanes are swapped
+ */
+
+__attribute__((target("avx2")))
+static int reverseRowAvx2Loop(byte *dst, const byte *src, int count, int size, __m256i mask, int j) {
+	int per = 32 / size;
+	for (; j + per <= count; j += per) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + (size_t)(count - per - j) * size));
+		v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, mask), 0x4E);
+		_mm256_storeu_si256((__m256i *)(dst + (size_t)j * size), v);
+	}
+	return j;
+}
+
+__attribute__((target("ssse3")))
+static void reverseRow8Ssse3(byte *dst, const byte *src, int count) {
+	int j = reverseRowSsse3Loop(dst, src, count, 1, _mm_setr_epi8(cReverse8x16), 0);
+	reverseRow8Scalar(dst + j, src, count - j);
+}
+
+__attribute__((target("avx2")))
+static void reverseRow8Avx2(byte *dst, const byte *src, int count) {
+	int j = reverseRowAvx2Loop(dst, src, count, 1, _mm256_setr_epi8(cReverse8x16, cReverse8x16), 0);
+	j = reverseRowSsse3Loop(dst, src, count, 1, _mm_setr_epi8(cReverse8x16), j);
+	reverseRow8Scalar(dst + j, src, count - j);
+}
+
+__attribute__((target("ssse3")))
+static void reverseRow16Ssse3(byte *dst, const byte *src, int count) {
+	int j = reverseRowSsse3Loop(dst, src, count, 2, _mm_setr_epi8(cReverse16x8), 0);
+	reverseRow16Scalar(dst + (size_t)j * 2, src, count - j);
+}
+
+__attribute__((target("avx2")))
+static void reverseRow16Avx2(byte *dst, const byte *src, int count) {
+	int j = reverseRowAvx2Loop(dst, src, count, 2, _mm256_setr_epi8(cReverse16x8, cReverse16x8), 0);
+	j = reverseRowSsse3Loop(dst, src, count, 2, _mm_setr_epi8(cReverse16x8), j);
+	reverseRow16Scalar(dst + (size_t)j * 2, src, count - j);
+}
+
+/* reverses a row of 32-bit pixels four at a time with pshufd
+ */
+
+__attribute__((target("sse2")))
+static void reverseRow32Sse2(byte *dst, const byte *src, int count) {
+	int j = 0;
+	for (; j + 4 <= count; j += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + (size_t)(count - 4 - j) * 4));
+		_mm_storeu_si128((__m128i *)(dst + (size_t)j * 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+	}
+	reverseRow32Scalar(dst + (size_t)j * 4, src, count - j);
+}
+
+/* reverses a row of 32-bit pixels eight at a time with vpermd. Image rows
+ * start on a 64-byte boundary, so after the pixels in front of the first
+ * 32-byte boundary of dst the stores are aligned; rows of a mapped file
+ * that are not even 4-byte aligned are stored unaligned throughout.
+ */
+
+__attribute__((target("avx2")))
+static void reverseRow32Avx2(byte *dst, const byte *src, int count) {
+	const __m256i order = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	int j = 0;
+
+	if ((uintptr_t)dst % 4 == 0) {
+		j = (int)((32 - (uintptr_t)dst % 32) % 32 / 4);
+		if (j > count) j = count;
+		reverseRow32Scalar(dst, src + (size_t)(count - j) * 4, j);
+		for (; j + 8 <= count; j += 8) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(src + (size_t)(count - 8 - j) * 4));
+			_mm256_store_si256((__m256i *)(dst + (size_t)j * 4), _mm256_permutevar8x32_epi32(v, order));
+		}
+	}
+	for (; j + 8 <= count; j += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + (size_t)(count - 8 - j) * 4));
+		_mm256_storeu_si256((__m256i *)(dst + (size_t)j * 4), _mm256_permutevar8x32_epi32(v, order));
+	}
+	reverseRow32Scalar(dst + (size_t)j * 4, src, count - j);
+}
+
+/* swaps two rows 16 bytes at a time; SSE2 is part of every x86-64 CPU
+ */
+
+__attribute__((target("sse2")))
+static void swapRowsSse2(byte *a, byte *b, size_t size) {
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		_mm_storeu_si128((__m128i *)(a + i), vb);
+		_mm_storeu_si128((__m128i *)(b + i), va);
+	}
+	swapRowsScalar(a + i, b + i, size - i);
+}
+
+/* swaps two rows 64 bytes at a time
+ */
+
+__attribute__((target("avx2")))
+static void swapRowsAvx2(byte *a, byte *b, size_t size) {
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		__m256i va0 = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i va1 = _mm256_loadu_si256((const __m256i *)(a + i + 32));
+		__m256i vb0 = _mm256_loadu_si256((const __m256i *)(b + i));
+		__m256i vb1 = _mm256_loadu_si256((const __m256i *)(b + i + 32));
+		_mm256_storeu_si256((__m256i *)(a + i), vb0);
+		_mm256_storeu_si256((__m256i *)(a + i + 32), vb1);
+		_mm256_storeu_si256((__m256i *)(b + i), va0);
+		_mm256_storeu_si256((__m256i *)(b + i + 32), va1);
+	}
+	swapRowsSse2(a + i, b + i, size - i);
+}
+
+/* Multiplies the bytes of a and b, widened to 16 bits and interleaved, by
+ * the weight pair wab and adds the products pairwise: channel i of the
+ * result is a[i]*wa + b[i]*wb, for the 4 bytes of lo and the 4 of hi.
+ */
+#define cInterleave(a, b, half) _mm_unpack##half##_epi16(_mm_unpack##half##_epi8(a, zero), \
+	_mm_unpack##half##_epi8(b, zero))
+
+/* resamples 16 bytes at a time from byte from on: each pair of rows is
+ * interleaved into 16-bit lanes and pmaddwd multiplies and adds both taps
+ * at once. An odd last tap is paired with itself at weight 0.
+ * Returns: the first byte left over
+ */
+
+__attribute__((target("sse2")))
+static size_t resampleColumnsSse2Loop(byte *dst, const byte *const *rows, const int16_t *weights, int taps,
+		size_t from, size_t size) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (cWeightBits - 1));
+	size_t i = from;
+	for (; i + 16 <= size; i += 16) {
+		__m128i sum0 = round, sum1 = round, sum2 = round, sum3 = round;
+		for (int t = 0; t < taps; t += 2) {
+			int u = t + 1 < taps ? t + 1 : t;
+			int16_t wb = t + 1 < taps ? weights[t + 1] : 0;
+			__m128i w = _mm_set1_epi32((uint16_t)weights[t] | (uint32_t)(uint16_t)wb << 16);
+			__m128i a = _mm_loadu_si128((const __m128i *)(rows[t] + i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(rows[u] + i));
+			__m128i lo = _mm_unpacklo_epi8(a, zero), hi = _mm_unpackhi_epi8(a, zero);
+			__m128i blo = _mm_unpacklo_epi8(b, zero), bhi = _mm_unpackhi_epi8(b, zero);
+			sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(lo, blo), w));
+			sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi16(lo, blo), w));
+			sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi16(hi, bhi), w));
+			sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi16(hi, bhi), w));
+		}
+		__m128i lo = _mm_packs_epi32(_mm_srai_epi32(sum0, cWeightBits), _mm_srai_epi32(sum1, cWeightBits));
+		__m128i hi = _mm_packs_epi32(_mm_srai_epi32(sum2, cWeightBits), _mm_srai_epi32(sum3, cWeightBits));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+__attribute__((target("sse2")))
+static void resampleColumnsSse2(byte *dst, const byte *const *rows, const int16_t *weights, int taps,
+		size_t size) {
+	size_t i = resampleColumnsSse2Loop(dst, rows, weights, taps, 0, size);
+	resampleColumnsFrom(dst, rows, weights, taps, i, size);
+}
+
+/* resamples 32 bytes at a time. The unpacks and packs work within each
+ * 128-bit lane, so the bytes come out in the order they went in.
+ */
+
+__attribute__((target("avx2")))
+static void resampleColumnsAvx2(byte *dst, const byte *const *rows, const int16_t *weights, int taps,
+		size_t size) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi32(1 << (cWeightBits - 1));
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		__m256i sum0 = round, sum1 = round, sum2 = round, sum3 = round;
+		for (int t = 0; t < taps; t += 2) {
+			int u = t + 1 < taps ? t + 1 : t;
+			int16_t wb = t + 1 < taps ? weights[t + 1] : 0;
+			__m256i w = _mm256_set1_epi32((uint16_t)weights[t] | (uint32_t)(uint16_t)wb << 16);
+			__m256i a = _mm256_loadu_si256((const __m256i *)(rows[t] + i));
+			__m256i b = _mm256_loadu_si256((const __m256i *)(rows[u] + i));
+			__m256i lo = _mm256_unpacklo_epi8(a, zero), hi = _mm256_unpackhi_epi8(a, zero);
+			__m256i blo = _mm256_unpacklo_epi8(b, zero), bhi = _mm256_unpackhi_epi8(b, zero);
+			sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(_mm256_unpacklo_epi16(lo, blo), w));
+			sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(_mm256_unpackhi_epi16(lo, blo), w));
+			sum2 = _mm256_add_epi32(sum2, _mm256_madd_epi16(_mm256_unpacklo_epi16(hi, bhi), w));
+			sum3 = _mm256_add_epi32(sum3, _mm256_madd_epi16(_mm256_unpackhi_epi16(hi, bhi), w));
+		}
+		__m256i lo = _mm256_packs_epi32(_mm256_srai_epi32(sum0, cWeightBits), _mm256_srai_epi32(sum1, cWeightBits));
+		__m256i hi = _mm256_packs_epi32(_mm256_srai_epi32(sum2, cWeightBits), _mm256_srai_epi32(sum3, cWeightBits));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+	i = resampleColumnsSse2Loop(dst, rows, weights, taps, i, size);
+	resampleColumnsFrom(dst, rows, weights, taps, i, size);
+}
+
+/* loads the 4 bytes at p, which may be unaligned
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i loadPixel(const byte *p) {
+	int32_t v;
+	memcpy(&v, p, 4);
+	return _mm_cvtsi32_si128(v);
+}
+
+/* resamples one pixel at a time, its channels side by side in the lanes
+ * of one register: each pair of taps is widened, interleaved and summed by
+ * pmaddwd as in resampleColumnsSse2(). Every load takes 4 bytes, so 24-bit
+ * pixels whose taps reach the last source pixel are left to the scalar
+ * kernel, which never reads past it.
+ */
+
+__attribute__((target("sse2")))
+static void resampleRowSse2(byte *dst, const byte *src, int srcCount, int size, const int *starts,
+		const int16_t *weights, int taps, int count) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (cWeightBits - 1));
+	int lastFull = size == 4 ? srcCount : srcCount - 1;
+	int j = 0;
+	for (; j < count && starts[j] + taps <= lastFull; j++) {
+		const byte *from = src + (size_t)starts[j] * size;
+		const int16_t *w = weights + (size_t)j * taps;
+		__m128i sum = round;
+		for (int t = 0; t < taps; t += 2) {
+			int u = t + 1 < taps ? t + 1 : t;
+			int16_t wb = t + 1 < taps ? w[t + 1] : 0;
+			__m128i pair = _mm_set1_epi32((uint16_t)w[t] | (uint32_t)(uint16_t)wb << 16);
+			__m128i a = loadPixel(from + t * size), b = loadPixel(from + u * size);
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(cInterleave(a, b, lo), pair));
+		}
+		__m128i packed = _mm_packs_epi32(_mm_srai_epi32(sum, cWeightBits), zero);
+		int32_t pixel = _mm_cvtsi128_si32(_mm_packus_epi16(packed, zero));
+		memcpy(dst + (size_t)j * size, &pixel, size);
+	}
+	resampleRowScalar(dst + (size_t)j * size, src, srcCount, size, starts + j, weights + (size_t)j * taps, taps,
+		count - j);
+}
+
+/* Spread four 24-bit pixels out to 32-bit lanes, and gather the planes of
+ * blue, green, red and the fourth bytes, four bytes each, back into four
+ * 24 or 32-bit pixels
+ */
+#define cGather24 0, 1, 2, (char)0x80, 3, 4, 5, (char)0x80, 6, 7, 8, (char)0x80, 9, 10, 11, (char)0x80
+#define cScatter24 0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, (char)0x80, (char)0x80, (char)0x80, (char)0x80
+#define cScatter32 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15
+
+/* Sets the weights of channel ch for mixPixels(): its three weights and a
+ * 0 for the fourth byte, once for each of the pixels of a 64-bit half
+ */
+#define cMixWeights(weights, ch) (weights)[ch * 3], (weights)[ch * 3 + 1], (weights)[ch * 3 + 2], 0, \
+	(weights)[ch * 3], (weights)[ch * 3 + 1], (weights)[ch * 3 + 2], 0
+
+/* mixes the four pixels in the 32-bit lanes of v. Each half of v is
+ * widened to two pixels of 16-bit channels; pmaddwd with the weights of
+ * an output channel sums blue and green, and red and the fourth byte, of
+ * each, and phaddd adds up the pairs. The sums come out as planes, which
+ * scatter shuffles back into pixels, with the fourth bytes of v.
+ */
+
+__attribute__((target("ssse3")))
+static inline __m128i mixPixels(__m128i v, const __m128i *w, __m128i scatter) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (cMixBits - 1));
+	__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+	__m128i sums[3];
+	for (int ch = 0; ch < 3; ch++) {
+		__m128i sum = _mm_hadd_epi32(_mm_madd_epi16(lo, w[ch]), _mm_madd_epi16(hi, w[ch]));
+		sums[ch] = _mm_srai_epi32(_mm_add_epi32(sum, round), cMixBits);
+	}
+	__m128i planes = _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]),
+		_mm_packs_epi32(sums[2], _mm_srli_epi32(v, 24)));
+	return _mm_shuffle_epi8(planes, scatter);
+}
+
+/* mixes four pixels at a time. 24-bit pixels are loaded 16 bytes at a time
+ * and stored 12, so the loop stops while a load still ends inside the row.
+ */
+
+__attribute__((target("ssse3")))
+static void mixRowSsse3(byte *row, int count, int size, const int16_t *weights) {
+	const __m128i w[3] = { _mm_setr_epi16(cMixWeights(weights, 0)), _mm_setr_epi16(cMixWeights(weights, 1)),
+		_mm_setr_epi16(cMixWeights(weights, 2)) };
+	int j = 0;
+	if (size == 4) {
+		const __m128i scatter = _mm_setr_epi8(cScatter32);
+		for (; j + 4 <= count; j += 4) {
+			__m128i *p = (__m128i *)(row + (size_t)j * 4);
+			_mm_storeu_si128(p, mixPixels(_mm_loadu_si128(p), w, scatter));
+		}
+	} else {
+		const __m128i gather = _mm_setr_epi8(cGather24), scatter = _mm_setr_epi8(cScatter24);
+		for (; j + 6 <= count; j += 4) {
+			byte *p = row + (size_t)j * 3;
+			__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), gather);
+			v = mixPixels(v, w, scatter);
+			_mm_storel_epi64((__m128i *)p, v);
+			int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+			memcpy(p + 8, &last, 4);
+		}
+	}
+	mixRowScalar(row + (size_t)j * size, count - j, size, weights);
+}
+
+/* mixPixels() on eight pixels, four in each lane
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i mixPixels8(__m256i v, const __m256i *w, __m256i scatter) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi32(1 << (cMixBits - 1));
+	__m256i lo = _mm256_unpacklo_epi8(v, zero), hi = _mm256_unpackhi_epi8(v, zero);
+	__m256i sums[3];
+	for (int ch = 0; ch < 3; ch++) {
+		__m256i sum = _mm256_hadd_epi32(_mm256_madd_epi16(lo, w[ch]), _mm256_madd_epi16(hi, w[ch]));
+		sums[ch] = _mm256_srai_epi32(_mm256_add_epi32(sum, round), cMixBits);
+	}
+	__m256i planes = _mm256_packus_epi16(_mm256_packs_epi32(sums[0], sums[1]),
+		_mm256_packs_epi32(sums[2], _mm256_srli_epi32(v, 24)));
+	return _mm256_shuffle_epi8(planes, scatter);
+}
+
+/* mixes eight pixels at a time. 24-bit pixels are loaded as two groups of
+ * four, one per lane, and the 12 bytes each lane gets back are moved
+ * together before the store.
+ */
+
+__attribute__((target("avx2")))
+static void mixRowAvx2(byte *row, int count, int size, const int16_t *weights) {
+	const __m256i w[3] = { _mm256_setr_epi16(cMixWeights(weights, 0), cMixWeights(weights, 0)),
+		_mm256_setr_epi16(cMixWeights(weights, 1), cMixWeights(weights, 1)),
+		_mm256_setr_epi16(cMixWeights(weights, 2), cMixWeights(weights, 2)) };
+	int j = 0;
+	if (size == 4) {
+		const __m256i scatter = _mm256_setr_epi8(cScatter32, cScatter32);
+		for (; j + 8 <= count; j += 8) {
+			__m256i *p = (__m256i *)(row + (size_t)j * 4);
+			_mm256_storeu_si256(p, mixPixels8(_mm256_loadu_si256(p), w, scatter));
+		}
+	} else {
+		const __m256i gather = _mm256_setr_epi8(cGather24, cGather24);
+		const __m256i scatter = _mm256_setr_epi8(cScatter24, cScatter24);
+		const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+		for (; j + 10 <= count; j += 8) {
+			byte *p = row + (size_t)j * 3;
+			__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+				_mm_loadu_si128((const __m128i *)(p + 12)), 1);
+			v = _mm256_permutevar8x32_epi32(mixPixels8(_mm256_shuffle_epi8(v, gather), w, scatter), pack);
+			_mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(v));
+			_mm_storel_epi64((__m128i *)(p + 16), _mm256_extracti128_si256(v, 1));
+		}
+	}
+	mixRowSsse3(row + (size_t)j * size, count - j, size, weights);
+}
+
+#endif
+
+void (*reverseRow8)(byte *dst, const byte *src, int count) = reverseRow8Scalar;
+void (*reverseRow16)(byte *dst, const byte *src, int count) = reverseRow16Scalar;
+void (*reverseRow24)(byte *dst, const byte *src, int count) = reverseRow24Scalar;
+void (*reverseRow32)(byte *dst, const byte *src, int count) = reverseRow32Scalar;
+void (*swapRows)(byte *a, byte *b, size_t size) = swapRowsScalar;
+void (*resampleColumns)(byte *dst, const byte *const *rows, const int16_t *weights, int taps, size_t size) =
+	resampleColumnsScalar;
+void (*resampleRow)(byte *dst, const byte *src, int srcCount, int size, const int *starts, const int16_t *weights,
+	int taps, int count) = resampleRowScalar;
+void (*mixRow)(byte *row, int count, int size, const int16_t *weights) = mixRowScalar;
+
+/* points every kernel at the best version this CPU supports. It runs as
+ * the program is loaded, before main() and so before any thread is
+ * started, which is the only time the pointers are written.
+ */
+
+__attribute__((constructor))
+static void pickKernels(void) {
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		reverseRow8 = reverseRow8Avx2;
+		reverseRow16 = reverseRow16Avx2;
+		reverseRow24 = reverseRow24Avx2;
+		reverseRow32 = reverseRow32Avx2;
+		swapRows = swapRowsAvx2;
+		resampleColumns = resampleColumnsAvx2;
+		mixRow = mixRowAvx2;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		reverseRow8 = reverseRow8Ssse3;
+		reverseRow16 = reverseRow16Ssse3;
+		reverseRow24 = reverseRow24Ssse3;
+		reverseRow32 = reverseRow32Sse2;
+		swapRows = swapRowsSse2;
+		resampleColumns = resampleColumnsSse2;
+		mixRow = mixRowSsse3;
+	} else if (__builtin_cpu_supports("sse2")) {
+		reverseRow32 = reverseRow32Sse2;
+		swapRows = swapRowsSse2;
+		resampleColumns = resampleColumnsSse2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		resampleRow = resampleRowSse2;
+	}
+#endif
+}
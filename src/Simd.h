@@ -0,0 +1,61 @@
+#ifndef SIMD_H
+#define SIMD_H
+#include <stddef.h>
+#include <stdint.h>
+#include "Bmp.h"
+
+/* Row kernels with SSSE3 and AVX2 versions. Each pointer starts out at
+ * the scalar version and is set to the best version the CPU supports as
+ * the program is loaded, before any thread can call it, so one binary
+ * runs everywhere.
+ */
+
+// Write the count 8, 16, 24 or 32-bit pixels at src to dst in reverse order. dst and src must not overlap.
+extern void (*reverseRow8)(byte *dst, const byte *src, int count);
+extern void (*reverseRow16)(byte *dst, const byte *src, int count);
+extern void (*reverseRow24)(byte *dst, const byte *src, int count);
+extern void (*reverseRow32)(byte *dst, const byte *src, int count);
+
+/* Runs the reverseRow kernel for pixels of bpp bits.
+ */
+static inline void reverseRow(byte *dst, const byte *src, int count, int bpp) {
+	switch (bpp) {
+	case 8:  reverseRow8(dst, src, count); break;
+	case 16: reverseRow16(dst, src, count); break;
+	case 32: reverseRow32(dst, src, count); break;
+	default: reverseRow24(dst, src, count); break;
+	}
+}
+
+// Exchanges the size bytes at a with the size bytes at b.
+extern void (*swapRows)(byte *a, byte *b, size_t size);
+
+// The resampling weights are fixed point with this many fraction bits; the weights of one sum add up to 1.
+#define cWeightBits 14
+
+/* Sets each of the size bytes of dst to the sum of the bytes at the same
+ * offset in the taps rows, each times its weight, rounded and clamped to
+ * a byte. Every channel of every pixel is one byte, so the pixel size
+ * does not matter.
+ */
+extern void (*resampleColumns)(byte *dst, const byte *const *rows, const int16_t *weights, int taps, size_t size);
+
+/* Sets each of the count pixels of dst, of size bytes, 3 or 4, to the sum
+ * of the taps pixels of src from pixel starts[j] on, each times its weight
+ * from weights + j*taps, rounded and clamped, channel by channel. src has
+ * srcCount pixels, and no more are read.
+ */
+extern void (*resampleRow)(byte *dst, const byte *src, int srcCount, int size, const int *starts,
+	const int16_t *weights, int taps, int count);
+
+// The channel mixing weights are fixed point with this many fraction bits, so each lies between -8 and 8.
+#define cMixBits 12
+
+/* Replaces the blue, green and red of each of the count pixels of row, of
+ * size bytes, 3 or 4, with sums of all three, each times its weight from
+ * weights, a 3x3 matrix stored by rows, rounded and clamped. The fourth
+ * byte of a 32-bit pixel is kept.
+ */
+extern void (*mixRow)(byte *row, int count, int size, const int16_t *weights);
+
+#endif
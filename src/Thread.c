@@ -0,0 +1,338 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "Thread.h"
+
+/* Each participant owns a range of task numbers, packed into one 64-bit
+ * word as (next << 32) | end so the owner taking from the front and a
+ * thief taking from the back can both update it with a single CAS.
+ */
+typedef struct {
+	uint64_t	range;
+	char		pad[56];		// Keep each range on its own cache line
+} tTaskRange;
+
+struct tThreadPool {
+	int				size;		// Participants in a run: the worker threads plus the caller
+	pthread_t	   *threads;
+	tTaskRange	   *ranges;
+	tTaskFunc		func;
+	void		   *arg;
+	unsigned		generation;	// Bumped to start each run
+	int				active;		// Workers still busy with the current run
+	bool			stop;
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;
+	pthread_cond_t	done;
+	pthread_mutex_t	runLock;	// Lets several threads share one pool, one run at a time
+};
+
+typedef struct {
+	tThreadPool	   *pool;
+	int				index;
+} tWorker;
+
+/* A pipeline of three stages, read, work and write, each running the
+ * steps in order. A stage can start a step once the stage before it has
+ * finished that step, and read and work can run up to depth steps ahead
+ * of the stage after them, which is how many slots of buffers there are.
+ */
+typedef struct {
+	tStageFunc		funcs[3];
+	void		   *arg;
+	int				steps;
+	int				depth;
+	int				done[3];	// Steps finished by each stage
+	int				status;		// The first nonzero status of a stage
+	pthread_mutex_t	lock;
+	pthread_cond_t	changed;
+} tPipeline;
+
+typedef struct {
+	tPipeline	   *pipeline;
+	int				stage;
+} tStage;
+
+// The pool whose tasks the calling thread is running, if any.
+static __thread tThreadPool *currentPool;
+
+/* takes the next task from the front of range r
+ * Returns: the task number, or -1 if the range is empty
+ */
+
+static int takeTask(tTaskRange *r) {
+	uint64_t old = __atomic_load_n(&r->range, __ATOMIC_ACQUIRE);
+	for (;;) {
+		uint32_t next = old >> 32, end = (uint32_t)old;
+		if (next >= end) return -1;
+		uint64_t new = (uint64_t)(next + 1) << 32 | end;
+		if (__atomic_compare_exchange_n(&r->range, &old, new, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			return (int)next;
+		}
+	}
+}
+
+/* steals the back half of victim's range into thief's empty range
+ * Returns: true if anything was stolen
+ */
+
+static bool stealTasks(tTaskRange *victim, tTaskRange *thief) {
+	uint64_t old = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+	for (;;) {
+		uint32_t next = old >> 32, end = (uint32_t)old;
+		if (next >= end) return false;
+		uint32_t mid = next + (end - next) / 2;
+		uint64_t new = (uint64_t)next << 32 | mid;
+		if (__atomic_compare_exchange_n(&victim->range, &old, new, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&thief->range, (uint64_t)mid << 32 | end, __ATOMIC_RELEASE);
+			return true;
+		}
+	}
+}
+
+/* runs tasks from participant index's own range, then steals from the
+ * others until every range is empty
+ */
+
+static void runTasks(tThreadPool *pool, int index) {
+	tTaskRange *own = &pool->ranges[index];
+	for (;;) {
+		int task;
+		while ((task = takeTask(own)) >= 0) {
+			pool->func(pool->arg, task);
+		}
+
+		bool stole = false;
+		for (int i = 1; i < pool->size && !stole; i++) {
+			stole = stealTasks(&pool->ranges[(index + i) % pool->size], own);
+		}
+		if (!stole) return;
+	}
+}
+
+static void *workerMain(void *arg) {
+	tWorker *worker = (tWorker *)arg;
+	tThreadPool *pool = worker->pool;
+	unsigned seen = 0;
+	currentPool = pool;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->generation == seen && !pool->stop) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		if (pool->stop) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		runTasks(pool, worker->index);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->active == 0) pthread_cond_signal(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	free(worker);
+	return NULL;
+}
+
+/* waits until stage may start step of pipeline
+ * Returns: false if the pipeline has stopped instead
+ */
+
+static bool waitForStep(tPipeline *pipeline, int stage, int step) {
+	int *done = pipeline->done;
+	pthread_mutex_lock(&pipeline->lock);
+	for (;;) {
+		bool ready = (stage == 0 || done[stage - 1] > step) && (stage == 2 || step - done[stage + 1] < pipeline->depth);
+		if (ready || pipeline->status != 0) break;
+		pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+	}
+	bool go = pipeline->status == 0;
+	pthread_mutex_unlock(&pipeline->lock);
+	return go;
+}
+
+/* runs stages first to last of a pipeline in turn for each step,
+ * stopping all of them at the first one that fails
+ */
+
+static void runStages(tPipeline *pipeline, int first, int last) {
+	for (int step = 0; step < pipeline->steps; step++) {
+		for (int stage = first; stage <= last; stage++) {
+			if (!waitForStep(pipeline, stage, step)) return;
+			int status = pipeline->funcs[stage](pipeline->arg, step, step % pipeline->depth);
+
+			pthread_mutex_lock(&pipeline->lock);
+			if (status != 0 && pipeline->status == 0) pipeline->status = status;
+			pipeline->done[stage]++;
+			pthread_cond_broadcast(&pipeline->changed);
+			pthread_mutex_unlock(&pipeline->lock);
+		}
+	}
+}
+
+static void *stageMain(void *arg) {
+	tStage *stage = (tStage *)arg;
+	runStages(stage->pipeline, stage->stage, stage->stage);
+	return NULL;
+}
+
+/* runs read(arg, step, slot), then work, then write for step = 0..steps-1
+ * with each stage on its own thread, so the reads and writes of some
+ * steps overlap the work of another. read and write get threads of their
+ * own and work runs on the calling thread; slot is step % depth, and a
+ * stage never starts a step whose slot the next stage is still using. A
+ * stage whose thread cannot start runs on the calling thread instead.
+ * Returns: 0, or the status of the first step that failed
+ */
+
+int runPipeline(int steps, int depth, tStageFunc read, tStageFunc work, tStageFunc write, void *arg) {
+	tPipeline pipeline = { { read, work, write }, arg, steps, depth, { 0, 0, 0 }, 0 };
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.changed, NULL);
+
+	tStage reader = { &pipeline, 0 };
+	tStage writer = { &pipeline, 2 };
+	pthread_t threads[2];
+	int first = 1, last = 1;
+	if (pthread_create(&threads[0], NULL, stageMain, &reader) != 0) {
+		first = 0;
+		last = 2;
+	} else if (pthread_create(&threads[1], NULL, stageMain, &writer) != 0) {
+		last = 2;
+	}
+
+	runStages(&pipeline, first, last);
+	if (first == 1) pthread_join(threads[0], NULL);
+	if (last == 1) pthread_join(threads[1], NULL);
+
+	pthread_cond_destroy(&pipeline.changed);
+	pthread_mutex_destroy(&pipeline.lock);
+	return pipeline.status;
+}
+
+/* Returns: the number of CPUs currently online, at least 1
+ */
+
+int onlineCpuCount() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+/* starts a pool in which threads threads, counting the caller of
+ * threadPoolRun(), share the work
+ * @params: threads - number of threads, at least 1
+ * Returns: the pool, or NULL if out of memory or the threads cannot start
+ */
+
+tThreadPool *createThreadPool(int threads) {
+	tThreadPool *pool = (tThreadPool *)calloc(1, sizeof(tThreadPool));
+	if (pool == NULL) {
+		return NULL;
+	}
+
+	pool->size = threads < 1 ? 1 : threads;
+	pool->threads = (pthread_t *)malloc(pool->size * sizeof(pthread_t));
+	if (pool->threads == NULL || posix_memalign((void **)&pool->ranges, 64, pool->size * sizeof(tTaskRange)) != 0) {
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pthread_mutex_init(&pool->runLock, NULL);
+
+	// On failure, shrink the pool to the workers already started and stop them.
+	int size = pool->size;
+	for (int i = 1; i < size; i++) {
+		tWorker *worker = (tWorker *)malloc(sizeof(tWorker));
+		if (worker != NULL) {
+			worker->pool = pool;
+			worker->index = i;
+		}
+		if (worker == NULL || pthread_create(&pool->threads[i], NULL, workerMain, worker) != 0) {
+			free(worker);
+			pool->size = i;
+			freeThreadPool(pool);
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+
+/* stops the worker threads and frees the pool
+ */
+
+void freeThreadPool(tThreadPool *pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 1; i < pool->size; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->done);
+	pthread_mutex_destroy(&pool->runLock);
+	free(pool->threads);
+	free(pool->ranges);
+	free(pool);
+}
+
+/* Returns: the number of threads that share each run, 1 for no pool
+ */
+
+int threadPoolSize(const tThreadPool *pool) {
+	return pool ? pool->size : 1;
+}
+
+/* runs func(arg, task) for task = 0..taskCount-1 on the pool and the
+ * calling thread, returning when all of them are done. A NULL pool runs
+ * the tasks in order on the calling thread, and so does a task of pool
+ * that calls back into it: the other threads are busy with its siblings.
+ */
+
+void threadPoolRun(tThreadPool *pool, int taskCount, tTaskFunc func, void *arg) {
+	if (pool == NULL || pool->size == 1 || taskCount <= 1 || currentPool == pool) {
+		for (int task = 0; task < taskCount; task++) func(arg, task);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->runLock);
+	for (int i = 0; i < pool->size; i++) {
+		uint32_t begin = (uint64_t)taskCount * i / pool->size;
+		uint32_t end = (uint64_t)taskCount * (i + 1) / pool->size;
+		pool->ranges[i].range = (uint64_t)begin << 32 | end;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->arg = arg;
+	pool->active = pool->size - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	tThreadPool *outerPool = currentPool;
+	currentPool = pool;
+	runTasks(pool, 0);
+	currentPool = outerPool;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->active > 0) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->runLock);
+}
@@ -0,0 +1,27 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+/* A fixed set of worker threads that run numbered tasks. Each run splits
+ * the task numbers evenly between the workers; a worker that runs out
+ * steals half of what is left of another worker's share, so uneven tasks
+ * still balance.
+ */
+typedef struct tThreadPool tThreadPool;
+
+// Runs task number task of a job; arg is passed through from threadPoolRun().
+typedef void (*tTaskFunc)(void *arg, int task);
+
+/* Runs step step of one stage of a pipeline, on the buffers of slot slot.
+ * Returns: 0, or a nonzero status that stops the pipeline
+ */
+typedef int (*tStageFunc)(void *arg, int step, int slot);
+
+//function declarations
+int runPipeline(int steps, int depth, tStageFunc read, tStageFunc work, tStageFunc write, void *arg);
+tThreadPool *createThreadPool(int threads);
+void freeThreadPool(tThreadPool *);
+int threadPoolSize(const tThreadPool *);
+void threadPoolRun(tThreadPool *, int taskCount, tTaskFunc, void *arg);
+int onlineCpuCount();
+
+#endif
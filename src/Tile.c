@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "Bimpie.h"
+#include "String.h"
+#include "Tile.h"
+
+// Each pass is a pipeline holding this many strips at each stage: while one is transformed, the next is read and
+// the one before is written.
+#define cSlots 2
+
+// Strips of flipped rows are kept to about this many bytes, and tiles to this many pixels a side, so that even
+// an image that just misses the memory limit takes enough steps for the reads, transforms and writes to overlap.
+#define cStripSize ((size_t)4 << 20)
+#define cMaxTileSide 512
+
+/* The tile store of one transpose. Tile (tr, tc) holds output rows
+ * tr*side to tr*side+side-1 of output columns tc*side to tc*side+side-1,
+ * as side rows of stride bytes, in slot tr*tileCols+tc of the file. A row
+ * of tiles is then one contiguous read.
+ */
+typedef struct {
+	int			fd;
+	int			side;		// Pixels on a side of a tile
+	int			tileCols;	// Tiles across the output
+	ptrdiff_t	stride;		// Bytes from one row of a tile to the next
+	size_t		slotSize;	// Bytes per tile in the file
+} tTileStore;
+
+/* The state the stages of a streaming pass share. The reads of a pass
+ * report their errors in in and the writes in out, so the two threads
+ * never write the same message.
+ */
+typedef struct {
+	tBmp		   *in;
+	tBmp		   *out;
+	tOrient			o;
+	const tColor   *color;				// Given to the pixels as they are transformed, or NULL
+	tThreadPool	   *pool;
+	tTileStore		store;
+	int				rows;				// Input rows per strip; when transposing, the side of a tile
+	tImage		   *from[cSlots];		// Strips of input rows
+	byte		   *tileRows[cSlots];	// Rows of tiles read back from the store
+	tImage		   *to[cSlots];			// Strips of output rows, or columns of tiles for the store
+} tStreamJob;
+
+/* Records an error message in bmp->error
+ * Returns: code
+ */
+
+static int tileError(tBmp *bmp, int code, char *message) {
+	snprintf(bmp->error, sizeof(bmp->error), "%s", message);
+	return code;
+}
+
+/* Calculates the bytes of one row of a tile side pixels wide, padded like
+ * an image row
+ */
+
+static size_t calculateTileStride(int side, int bpp) {
+	return ((size_t)side * (bpp / 8) + cImageAlign - 1) / cImageAlign * cImageAlign;
+}
+
+/* Calculates the most bytes a transpose of in through tiles of side
+ * pixels holds at once: the strips of side input rows and the columns of
+ * tiles they become, then the rows of tiles and the strips of output rows
+ * they become, cSlots of each. The buffer pool may keep them all.
+ */
+
+static size_t calculateTileMemory(tBmp *in, int side) {
+	int W = in->info.width;
+	int H = in->info.height;
+	int bpp = in->info.bitsPerPixel;
+	size_t tileCols = (H + (size_t)side - 1) / side;
+	size_t outRowSize = (size_t)H * (bpp / 8) + 3;
+	return cSlots * (side * calculateFileRowSize(in) + calculateImageSize(side, W, bpp) +
+		tileCols * side * calculateTileStride(side, bpp) + side * outRowSize);
+}
+
+/* Finds the largest tiles, up to cMaxTileSide, whose transpose fits in
+ * maxMemory bytes
+ * Returns: the pixels on a side of a tile, 0 if not even one row fits
+ */
+
+static int calculateTileSide(tBmp *in, size_t maxMemory) {
+	int lo = 0;
+	int hi = in->info.width > in->info.height ? in->info.width : in->info.height;
+	if (hi > cMaxTileSide) hi = cMaxTileSide;
+	while (lo < hi) {
+		int side = hi - (hi - lo) / 2;
+		if (calculateTileMemory(in, side) <= maxMemory) {
+			lo = side;
+		} else {
+			hi = side - 1;
+		}
+	}
+	return lo;
+}
+
+/* Creates the tile store for transposing in into fileName, as a file next
+ * to it that is removed at once, so it is gone when closed even after a
+ * crash. The slots are not written yet, so they take no disk space.
+ * @params: tiles - a column of tiles; their stride is the store's
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int createTileStore(tTileStore *store, tBmp *in, char *fileName, const tImage *tiles) {
+	store->side = tiles->width;
+	store->tileCols = (in->info.height + store->side - 1) / store->side;
+	store->stride = tiles->stride;
+	store->slotSize = (size_t)store->side * store->stride;
+	size_t tileRows = (in->info.width + (size_t)store->side - 1) / store->side;
+
+	char name[4096];
+	snprintf(name, sizeof(name), "%s.tiles.XXXXXX", fileName);
+	store->fd = mkstemp(name);
+	if (store->fd < 0) {
+		return tileError(in, cBimpieErrorFileOpen, "The tile store could not be created.");
+	}
+	unlink(name);
+	if (ftruncate(store->fd, tileRows * store->tileCols * store->slotSize) != 0) {
+		close(store->fd);
+		store->fd = -1;
+		return tileError(in, cBimpieErrorFileWrite, "The tile store could not be created.");
+	}
+	return 0;
+}
+
+/* Returns: the offset in the store of the slot of tile (tr, tc)
+ */
+
+static off_t tileOffset(tTileStore *store, int tr, int tc) {
+	return ((off_t)tr * store->tileCols + tc) * store->slotSize;
+}
+
+/* Returns: the number of rows strip step of a pass over rows rows holds
+ */
+
+static int stripRows(tStreamJob *job, int step, int rows) {
+	int row = step * job->rows;
+	return rows - row < job->rows ? rows - row : job->rows;
+}
+
+/* Takes cSlots strips of up to job->rows rows of bmp
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int createStrips(tStreamJob *job, tBmp *bmp, tImage **strips) {
+	for (int slot = 0; slot < cSlots; slot++) {
+		if ((strips[slot] = createBmpRows(bmp, job->rows)) == NULL) {
+			return tileError(job->in, cBimpieErrorMemory, "Out of memory.");
+		}
+	}
+	return 0;
+}
+
+/* Gives back the buffers of the slots that have any
+ */
+
+static void freeSlots(tStreamJob *job) {
+	for (int slot = 0; slot < cSlots; slot++) {
+		if (job->from[slot]) freeImage(job->from[slot]);
+		if (job->to[slot]) freeImage(job->to[slot]);
+		giveBuffer(job->in->buffers, job->tileRows[slot]);
+		job->from[slot] = job->to[slot] = NULL;
+		job->tileRows[slot] = NULL;
+	}
+}
+
+/* Reads strip step of the input. The output rows or columns of the strip
+ * come from input rows counted down from the top if o flips them.
+ */
+
+static int readStrip(void *arg, int step, int slot) {
+	tStreamJob *job = (tStreamJob *)arg;
+	int H = job->in->info.height;
+	int rows = stripRows(job, step, H);
+	bool reversed = job->o.transpose ? job->o.flipX : job->o.flipY;
+	return readBmpRows(job->in, reversed ? H - step * job->rows - rows : step * job->rows, rows, job->from[slot]);
+}
+
+/* Transforms strip step, which does not transpose, into the output rows
+ * it becomes
+ */
+
+static int flipStrip(void *arg, int step, int slot) {
+	tStreamJob *job = (tStreamJob *)arg;
+	setBmpRowCount(job->out, job->to[slot], job->from[slot]->height);
+	transformBmpInto(job->from[slot], job->to[slot], job->o, job->color, job->pool);
+	return 0;
+}
+
+/* Writes strip step of the output
+ */
+
+static int writeStrip(void *arg, int step, int slot) {
+	tStreamJob *job = (tStreamJob *)arg;
+	return writeBmpRows(job->out, step * job->rows, job->to[slot]);
+}
+
+/* Transposes strip step into the column of tiles it becomes
+ */
+
+static int tileStrip(void *arg, int step, int slot) {
+	tStreamJob *job = (tStreamJob *)arg;
+	job->to[slot]->width = job->from[slot]->height;
+	transformBmpInto(job->from[slot], job->to[slot], job->o, job->color, job->pool);
+	return 0;
+}
+
+/* Writes the column of tiles of strip step tile by tile to their slots
+ */
+
+static int writeTiles(void *arg, int step, int slot) {
+	tStreamJob *job = (tStreamJob *)arg;
+	tTileStore *store = &job->store;
+	const tImage *tiles = job->to[slot];
+	for (int r0 = 0, tr = 0; r0 < tiles->height; r0 += store->side, tr++) {
+		int rows = tiles->height - r0 < store->side ? tiles->height - r0 : store->side;
+		if (!writeAt(store->fd, imageRow(tiles, r0), rows * store->stride, tileOffset(store, tr, step))) {
+			return tileError(job->out, cBimpieErrorFileWrite, "Error writing the tile store.");
+		}
+	}
+	return 0;
+}
+
+/* Reads row of tiles step from the store in one go
+ */
+
+static int readTileRow(void *arg, int step, int slot) {
+	tStreamJob *job = (tStreamJob *)arg;
+	tTileStore *store = &job->store;
+	if (!readAt(store->fd, job->tileRows[slot], store->tileCols * store->slotSize, tileOffset(store, step, 0))) {
+		return tileError(job->in, cBimpieErrorFileRead, "Error reading the tile store.");
+	}
+	return 0;
+}
+
+/* Copies row of tiles step to the strip of output rows it covers
+ */
+
+static int untileRow(void *arg, int step, int slot) {
+	tStreamJob *job = (tStreamJob *)arg;
+	tTileStore *store = &job->store;
+	tImage *rows = job->to[slot];
+	int size = rows->bpp / 8;
+
+	setBmpRowCount(job->out, rows, stripRows(job, step, job->in->info.width));
+	for (int r = 0; r < rows->height; r++) {
+		byte *to = (byte *)imageRow(rows, r);
+		const byte *from = job->tileRows[slot] + r * store->stride;
+		for (int c0 = 0; c0 < rows->width; c0 += store->side, from += store->slotSize) {
+			int cols = rows->width - c0 < store->side ? rows->width - c0 : store->side;
+			memcpy(to + (size_t)c0 * size, from, (size_t)cols * size);
+		}
+	}
+	return 0;
+}
+
+/* Writes the input of job in orientation o, which transposes, to its
+ * output in two pipelined passes through a tile store next to fileName
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int transposeFile(tStreamJob *job, char *fileName, size_t maxMemory) {
+	tBmp *in = job->in;
+	int W = in->info.width;
+	int H = in->info.height;
+	if ((job->rows = calculateTileSide(in, maxMemory)) == 0) {
+		return tileError(in, cBimpieErrorMemory, "The memory limit is too small for this image.");
+	}
+	int side = job->rows;
+
+	int status = createStrips(job, in, job->from);
+	for (int slot = 0; slot < cSlots && status == 0; slot++) {
+		if ((job->to[slot] = createImage(side, W, in->info.bitsPerPixel, in->buffers)) == NULL) {
+			status = tileError(in, cBimpieErrorMemory, "Out of memory.");
+		}
+	}
+	job->store.fd = -1;
+	if (status == 0) status = createTileStore(&job->store, in, fileName, job->to[0]);
+	if (status == 0) status = runPipeline((H + side - 1) / side, cSlots, readStrip, tileStrip, writeTiles, job);
+	freeSlots(job);
+
+	status = status ? status : createStrips(job, job->out, job->to);
+	for (int slot = 0; slot < cSlots && status == 0; slot++) {
+		job->tileRows[slot] = (byte *)takeBuffer(in->buffers, job->store.tileCols * job->store.slotSize);
+		if (job->tileRows[slot] == NULL) {
+			status = tileError(in, cBimpieErrorMemory, "Out of memory.");
+		}
+	}
+	if (status == 0) status = runPipeline((W + side - 1) / side, cSlots, readTileRow, untileRow, writeStrip, job);
+	freeSlots(job);
+	if (job->store.fd >= 0) close(job->store.fd);
+	return status;
+}
+
+/* Writes the input of job in orientation o, which does not transpose, to
+ * its output in one pipelined pass: each strip of output rows is a strip
+ * of input rows, flipped
+ * Returns: 0 or a cBimpieError code
+ */
+
+static int flipFile(tStreamJob *job, size_t maxMemory) {
+	int H = job->in->info.height;
+	size_t rowSize = calculateFileRowSize(job->in);
+	size_t rows = maxMemory / (cSlots * 2 * rowSize);
+	if (rows == 0) {
+		return tileError(job->in, cBimpieErrorMemory, "The memory limit is too small for this image.");
+	}
+	if (rows > cStripSize / rowSize) rows = cStripSize / rowSize > 0 ? cStripSize / rowSize : 1;
+	job->rows = rows < (size_t)H ? (int)rows : H;
+
+	int status = createStrips(job, job->in, job->from);
+	if (status == 0) status = createStrips(job, job->out, job->to);
+	if (status == 0) status = runPipeline((H + job->rows - 1) / job->rows, cSlots, readStrip, flipStrip, writeStrip, job);
+	freeSlots(job);
+	return status;
+}
+
+/* writes the image of in, opened by readBmpHeaders(), to fileName in
+ * orientation o, with its pixels given color if it is not NULL, without
+ * reading all of its pixels into memory. The new
+ * file replaces any old one only once it is complete, so fileName may be
+ * the input. Like bimpieTransformToFile(), a vertical flip on its own is
+ * written by turning the file over: each row goes back where it was read
+ * from.
+ * @params: maxMemory - the most bytes of pixels to hold at once
+ *			pool - threads to transform each strip with, or NULL
+ * Returns: 0 or a cBimpieError code, with the message in in->error
+ */
+
+int transformBmpFile(tBmp *in, char *fileName, tOrient o, const tColor *color, size_t maxMemory,
+		tThreadPool *pool) {
+	bool turnOver = !o.transpose && !o.flipX && o.flipY;
+
+	// The output keeps its own copy of the header bytes.
+	size_t kept = in->extraHeaderSize + in->trailerSize;
+	maxMemory = maxMemory > kept ? maxMemory - kept : 0;
+
+	tBmp out;
+	memset(&out, 0, sizeof(out));
+	tStreamJob job;
+	memset(&job, 0, sizeof(job));
+	job.in = in;
+	job.out = &out;
+	job.o = o;
+	job.color = color;
+	job.pool = pool;
+
+	int status = openBmpOutput(&out, in, fileName, o.transpose ? in->info.height : in->info.width,
+		o.transpose ? in->info.width : in->info.height, in->topDown != turnOver);
+	if (status == 0) {
+		status = o.transpose ? transposeFile(&job, fileName, maxMemory) : flipFile(&job, maxMemory);
+		if (status == 0) {
+			status = closeBmpOutput(&out, NULL);
+		} else {
+			discardBmpOutput(&out);
+		}
+	}
+
+	if (status != 0 && out.error[0] != '\0') {
+		snprintf(in->error, sizeof(in->error), "%s", out.error);
+	}
+	in->bytesWritten += out.bytesWritten;
+	freeBmp(&out);
+	return status;
+}
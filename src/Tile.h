@@ -0,0 +1,23 @@
+#ifndef TILE_H
+#define TILE_H
+#include "Image.h"
+
+/* Out-of-core transforms, for images bigger than the memory they may use.
+ * The pixels go from the input file to the output file a strip of rows at
+ * a time and are never all in memory. Flips and half turns need one pass.
+ * Orientations that transpose need two, through a tile store: a scratch
+ * file next to the output that holds the transposed image as square
+ * tiles. The first pass turns each strip of input rows into a column of
+ * tiles; the second reads back each row of tiles, which is a strip of
+ * output rows. The strips and tiles are sized to fit maxMemory.
+ *
+ * Each pass is a pipeline (see runPipeline()): a reader thread, the
+ * transform on the caller and the pool, and a writer thread hand the
+ * strips along through two slots each, so the disk and the CPUs are busy
+ * at the same time and a pass takes about as long as the slower of them.
+ */
+
+//function declarations
+int transformBmpFile(tBmp *in, char *fileName, tOrient, const tColor *, size_t maxMemory, tThreadPool *);
+
+#endif
@@ -0,0 +1,210 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Trace.h"
+#include "Error.h"
+
+/* One stage of one file. Times are seconds since the trace was created.
+ */
+typedef struct {
+	const char *stage;
+	const char *file;
+	double		start;
+	double		end;
+	size_t		bytesRead;
+	size_t		bytesWritten;
+	long		pixels;
+	int			thread;
+} tTraceEvent;
+
+struct tTrace {
+	double			origin;		// The monotonic clock when the trace was created
+	tTraceEvent	   *events;
+	int				count;
+	int				capacity;
+	int				threads;	// Threads numbered so far
+	pthread_mutex_t	lock;
+};
+
+// The number of the calling thread in the trace, 0 until it records its first stage.
+static __thread int traceThread;
+
+/* Returns: the monotonic clock in seconds
+ */
+
+static double clockNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* starts an empty trace; its clock starts now
+ */
+
+tTrace *createTrace() {
+	tTrace *trace = (tTrace *)calloc(1, sizeof(tTrace));
+	if (trace == NULL) {
+		ErrorExit(EXIT_FAILURE, "Out of memory.");
+	}
+	trace->origin = clockNow();
+	pthread_mutex_init(&trace->lock, NULL);
+	return trace;
+}
+
+/* frees trace and its events
+ */
+
+void freeTrace(tTrace *trace) {
+	if (trace == NULL) return;
+	pthread_mutex_destroy(&trace->lock);
+	free(trace->events);
+	free(trace);
+}
+
+/* Returns: the seconds since trace was created, or 0 for no trace
+ */
+
+double traceTime(tTrace *trace) {
+	return trace ? clockNow() - trace->origin : 0;
+}
+
+/* records that stage of file ran on the calling thread from start, as
+ * returned by traceTime(), until now. stage and file must outlive the
+ * trace.
+ */
+
+void traceStage(tTrace *trace, const char *stage, const char *file, double start, size_t bytesRead,
+	size_t bytesWritten, long pixels) {
+	if (trace == NULL) return;
+	double end = traceTime(trace);
+
+	pthread_mutex_lock(&trace->lock);
+	if (trace->count == trace->capacity) {
+		int capacity = trace->capacity ? 2 * trace->capacity : 64;
+		tTraceEvent *events = (tTraceEvent *)realloc(trace->events, capacity * sizeof(tTraceEvent));
+		if (events == NULL) {
+			// Losing an event is better than losing the run it describes.
+			pthread_mutex_unlock(&trace->lock);
+			return;
+		}
+		trace->events = events;
+		trace->capacity = capacity;
+	}
+	if (traceThread == 0) traceThread = ++trace->threads;
+
+	tTraceEvent *e = &trace->events[trace->count++];
+	e->stage = stage;
+	e->file = file;
+	e->start = start;
+	e->end = end;
+	e->bytesRead = bytesRead;
+	e->bytesWritten = bytesWritten;
+	e->pixels = pixels;
+	e->thread = traceThread;
+	pthread_mutex_unlock(&trace->lock);
+}
+
+/* prints one line per stage, in the order the stages first ran, with the
+ * time spent in it summed over all files and threads, the bytes it read
+ * and wrote, and its throughput in pixels per second of that time
+ */
+
+void printTraceStats(tTrace *trace, FILE *out) {
+	if (trace == NULL) return;
+	double wall = traceTime(trace);
+
+	pthread_mutex_lock(&trace->lock);
+	fprintf(out, "%-22s %6s %10s %10s %10s %12s\n", "stage", "files", "time s", "read MB", "written MB",
+		"Mpixels/s");
+	for (int i = 0; i < trace->count; i++) {
+		int j;
+		for (j = 0; j < i && strcmp(trace->events[j].stage, trace->events[i].stage) != 0; j++);
+		if (j < i) continue;
+
+		int files = 0;
+		double time = 0;
+		size_t bytesRead = 0, bytesWritten = 0;
+		long pixels = 0;
+		for (j = i; j < trace->count; j++) {
+			tTraceEvent *e = &trace->events[j];
+			if (strcmp(e->stage, trace->events[i].stage) != 0) continue;
+			files++;
+			time += e->end - e->start;
+			bytesRead += e->bytesRead;
+			bytesWritten += e->bytesWritten;
+			pixels += e->pixels;
+		}
+
+		fprintf(out, "%-22s %6d %10.4f %10.1f %10.1f ", trace->events[i].stage, files, time, bytesRead / 1e6,
+			bytesWritten / 1e6);
+		if (pixels > 0 && time > 0) {
+			fprintf(out, "%12.1f\n", pixels / time / 1e6);
+		} else {
+			fprintf(out, "%12s\n", "-");
+		}
+	}
+	fprintf(out, "%-22s %6s %10.4f\n", "wall time", "", wall);
+	pthread_mutex_unlock(&trace->lock);
+}
+
+/* writes the stages recorded so far into buffer of size bytes, in the
+ * order they ran, as stage=microseconds separated by commas
+ */
+
+void formatTraceStages(tTrace *trace, char *buffer, size_t size) {
+	size_t length = 0;
+	buffer[0] = '\0';
+	if (trace == NULL) return;
+
+	pthread_mutex_lock(&trace->lock);
+	for (int i = 0; i < trace->count && length < size; i++) {
+		tTraceEvent *e = &trace->events[i];
+		length += snprintf(buffer + length, size - length, "%s%s=%.0f", i ? "," : "", e->stage,
+			(e->end - e->start) * 1e6);
+	}
+	pthread_mutex_unlock(&trace->lock);
+}
+
+/* writes s as the body of a JSON string
+ */
+
+static void writeJsonString(FILE *out, const char *s) {
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fprintf(out, "\\%c", *s);
+		} else if ((unsigned char)*s < 0x20) {
+			fprintf(out, "\\u%04x", *s);
+		} else {
+			fputc(*s, out);
+		}
+	}
+}
+
+/* writes the stages to fileName in the Chrome trace event format, one
+ * complete ("X") event per stage of each file with the file, bytes and
+ * pixels as its args. Load it in chrome://tracing or Perfetto to see
+ * which stages of which files overlapped.
+ * Returns: 0, or -1 if the file could not be written
+ */
+
+int writeTraceJson(tTrace *trace, const char *fileName) {
+	if (trace == NULL) return 0;
+	FILE *out = fopen(fileName, "w");
+	if (out == NULL) return -1;
+
+	pthread_mutex_lock(&trace->lock);
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (int i = 0; i < trace->count; i++) {
+		tTraceEvent *e = &trace->events[i];
+		fprintf(out, "{\"name\":\"%s\",\"cat\":\"bimpie\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+			"\"dur\":%.3f,\"args\":{\"file\":\"", e->stage, e->thread, e->start * 1e6, (e->end - e->start) * 1e6);
+		writeJsonString(out, e->file);
+		fprintf(out, "\",\"bytesRead\":%zu,\"bytesWritten\":%zu,\"pixels\":%ld}}%s\n", e->bytesRead,
+			e->bytesWritten, e->pixels, i + 1 < trace->count ? "," : "");
+	}
+	fprintf(out, "]}\n");
+	pthread_mutex_unlock(&trace->lock);
+
+	return fclose(out) == 0 ? 0 : -1;
+}
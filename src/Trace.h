@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdio.h>
+#include <stddef.h>
+
+/* Records the stages of processing each file: when each ran, on which
+ * thread, and how many bytes and pixels it handled. The stages can be
+ * summed up per stage for --stats, written out as Chrome trace events
+ * for --trace, or listed in the reply to a --serve job. Every function accepts a NULL trace and then does nothing,
+ * so the stages can be recorded whether or not anyone asked.
+ */
+typedef struct tTrace tTrace;
+
+//function declarations
+tTrace *createTrace();
+void freeTrace(tTrace *);
+double traceTime(tTrace *);
+void traceStage(tTrace *, const char *stage, const char *file, double start, size_t bytesRead,
+	size_t bytesWritten, long pixels);
+void printTraceStats(tTrace *, FILE *);
+void formatTraceStages(tTrace *, char *buffer, size_t size);
+int writeTraceJson(tTrace *, const char *fileName);
+
+#endif